@@ -0,0 +1,255 @@
+#include <Arduino.h>
+#include "ADCSampler.h"
+#include "PWMOutput.h"
+
+/*  ADC Sampler
+ *
+ *  Oversampling and decimation: summing 4^n conversions and shifting right by n gives n
+ *  extra bits, provided there is a little noise on the input, which there always is here.
+ *
+ *  The ADC runs at 125kHz (prescaler 128) so a conversion takes 104us. The ADC interrupt
+ *  does the summing, so the main loop only has to wait for the ready flag.
+ *
+ *  When sampling in phase, a compare match is the ADC auto-trigger, Timer1 compare B or
+ *  Timer0 compare A. The PWMOutput keeps it in the low part of its charge waveform every time
+ *  the duty changes, so there is nothing to set up here but the trigger source. The flag of the
+ *  trigger the scan was started on is cleared after each conversion, the ADC only triggers on
+ *  a flag going from 0 to 1. The other is left alone, Timer0 compare A also times the optical
+ *  bursts (MorseSender), and clearing its flag could lose one of their interrupts.
+ */
+
+#define SAMPLER_PRESCALE (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))
+
+ADCSampler *ADCSampler::active = 0;
+
+ADCSampler::ADCSampler (void)
+{
+  Channels = 0;
+  ready = true;
+  Group = 0;
+  Trigger = SAMPLER_FREE;
+  Started = 0;
+  active = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Register an analog pin, returns the channel number to read
+//the result back with. 4^oversampleBits conversions make each
+//block, filterShift sets how heavily the IIR filter smooths.
+//It is scanned with the rest of its group.
+//////////////////////////////////////////////////////////////
+
+byte ADCSampler::AddChannel (int pin, byte oversampleBits, byte filterShift, byte group)
+{
+  if (Channels >= SAMPLER_CHANNELS) return (SAMPLER_NONE);   //Full, the caller reads its own pin
+  if (oversampleBits > 3) oversampleBits = 3;
+  SamplerChannel &c = Channel[Channels];
+  c.mux = (pin >= A0 ? pin - A0 : pin) & 0x07;
+  c.bits = oversampleBits;
+  c.shift = filterShift;
+  c.group = group;
+  c.primed = false;
+  c.filtered = 0;
+  c.latest = 0;
+  return (Channels++);
+}
+
+//The first channel from ch on that is in the group being scanned, Channels if none
+byte ADCSampler::NextChannel (byte ch)
+{
+  while (ch < Channels && Channel[ch].group != Group) ch++;
+  return (ch);
+}
+
+void ADCSampler::SelectChannel (byte ch)
+{
+  ADMUX = _BV(REFS0) | Channel[ch].mux;   //AVcc reference, same as analogRead
+  discard = 1;                            //First conversion after a switch may be the old channel
+}
+
+//////////////////////////////////////////////////////////////
+//Start a scan of a group's channels, returns straight away.
+//trigger is the ADC auto-trigger source to take each
+//conversion on, a charge PWM's (see PWMOutput) or SAMPLER_FREE.
+//The caller must make sure the waveform has a low period to hit.
+//////////////////////////////////////////////////////////////
+
+void ADCSampler::Start (byte group, byte trigger)
+{
+  Group = group;
+  Started = millis();
+  byte first = NextChannel(0);
+  if (first >= Channels) return;
+  cli();
+  active = this;
+  ready = false;
+  current = first;
+  blockNo = 0;
+  count = 0;
+  sum = 0;
+  Trigger = trigger;
+  SelectChannel(first);
+  if (trigger != SAMPLER_FREE)
+  {
+    ADCSRB = trigger & 0x07;                 //Auto trigger from the waveform's timer
+    Rearm(trigger);
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | SAMPLER_PRESCALE;
+  }
+  else
+  {
+    ADCSRB = 0;                              //Free running
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | _BV(ADSC) | SAMPLER_PRESCALE;
+  }
+  sei();
+}
+
+void ADCSampler::Stop (void)
+{
+  ADCSRA = _BV(ADEN) | SAMPLER_PRESCALE;   //Back to single conversions for analogRead
+  ADCSRB = 0;
+  ready = true;
+}
+
+bool ADCSampler::isReady (void)
+{
+  return (ready);
+}
+
+//////////////////////////////////////////////////////////////
+//Wait for the scan Start() began. If the interrupts haven't
+//finished within timeout ms of the start (e.g. no PWM edges to
+//trigger on) the scan is done with plain analogRead instead.
+//Returns false if it had to fall back, the results are fresh
+//either way.
+//////////////////////////////////////////////////////////////
+
+bool ADCSampler::Finish (unsigned int timeout)
+{
+  while (!ready)
+  {
+    if (millis() - Started > timeout)
+    {
+      cli();
+      Stop();
+      sei();
+      ScanBlocking();
+      return false;
+    }
+  }
+  return true;
+}
+
+//Start a scan and wait for it, see Finish()
+bool ADCSampler::Acquire (byte group, byte trigger, unsigned int timeout)
+{
+  Start(group, trigger);
+  return (Finish(timeout));
+}
+
+unsigned int ADCSampler::Result (byte channel)
+{
+  return (Channel[channel].filtered);
+}
+
+//The last scan on its own, for a reading that mustn't be blended with the ones before
+unsigned int ADCSampler::Latest (byte channel)
+{
+  return (Channel[channel].latest);
+}
+
+static unsigned int Median3 (unsigned int a, unsigned int b, unsigned int c)
+{
+  if (a > b) { unsigned int t = a; a = b; b = t; }
+  if (b > c) b = c;
+  return (a > b ? a : b);
+}
+
+//////////////////////////////////////////////////////////////
+//All blocks for a channel are in, take the median and filter
+//////////////////////////////////////////////////////////////
+
+void ADCSampler::Store (byte ch)
+{
+  SamplerChannel &c = Channel[ch];
+  unsigned int m = Median3(c.block[0], c.block[1], c.block[2]);
+  c.latest = m;
+  if (!c.primed)
+  {
+    c.filtered = m;
+    c.primed = true;
+    return;
+  }
+  c.filtered += ((long)m - (long)c.filtered) >> c.shift;
+}
+
+//////////////////////////////////////////////////////////////
+//Same scan as the interrupt version, with analogRead
+//////////////////////////////////////////////////////////////
+
+void ADCSampler::ScanBlocking (void)
+{
+  for (byte ch = NextChannel(0); ch < Channels; ch = NextChannel(ch + 1))
+  {
+    SamplerChannel &c = Channel[ch];
+    analogRead(c.mux);    //Let the sample and hold settle on the new channel
+    for (byte b = 0; b < SAMPLER_BLOCKS; b++)
+    {
+      unsigned int total = 0;
+      for (byte i = 0; i < (1 << (2 * c.bits)); i++) total += analogRead(c.mux);
+      c.block[b] = total << (6 - 2 * c.bits);
+    }
+    Store(ch);
+  }
+}
+
+//////////////////////////////////////////////////////////////
+//ADC interrupt, one call per conversion. Kept short, it is
+//only adding up until a block is complete.
+//////////////////////////////////////////////////////////////
+
+void ADCSampler::ConversionDone (void)
+{
+  unsigned int v = ADC;
+  ADCSampler *s = active;
+  if (s == 0 || s->ready) return;
+  Rearm(s->Trigger);
+  if (s->discard)
+  {
+    s->discard--;
+    return;
+  }
+  SamplerChannel &c = s->Channel[s->current];
+  s->sum += v;
+  if (++s->count < (1 << (2 * c.bits))) return;
+
+  c.block[s->blockNo] = s->sum << (6 - 2 * c.bits);   //Decimate to 10+n bits, then scale to 10.6
+  s->sum = 0;
+  s->count = 0;
+  if (++s->blockNo < SAMPLER_BLOCKS) return;
+
+  s->blockNo = 0;
+  s->Store(s->current);
+  s->current = s->NextChannel(s->current + 1);
+  if (s->current < s->Channels)
+  {
+    s->SelectChannel(s->current);
+    return;
+  }
+  s->Stop();
+}
+
+//Clear the compare flag the scan triggers on, the flag must see a new edge
+void ADCSampler::Rearm (byte trigger)
+{
+  if (trigger == PWM_TRIGGER_TIMER0) TIFR0 = _BV(OCF0A);
+  if (trigger == PWM_TRIGGER_TIMER1) TIFR1 = _BV(OCF1B);
+}
+
+ISR(ADC_vect)
+{
+  ADCSampler::ConversionDone();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ADCSampler
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,74 @@
+#define ADCSamplerLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ADC Sampler class, interrupt driven acquisition for the VoltageSensor class.
+//
+//  Each scan takes every channel registered in a group in turn. For each channel it takes three
+//  blocks of 4^n conversions, decimates each block to 10+n bits, takes the median of the three
+//  blocks to throw out spikes, then runs the result through a simple IIR filter.
+//
+//  Conversions can free-run, or be triggered from a charge waveform's timer so they land in
+//  the off part of it, see PWMOutput. That means the battery can be read without suspending
+//  the charger. A group is the pins that go with one waveform, see ChargeChannel.h.
+//
+//  Start() returns straight away and the scan runs in the ADC interrupt, so the caller can get
+//  on with something else and Finish() it later. Acquire() is the two together.
+//
+//  Results are 16 bit, the 10 bit A-D value with 6 fractional bits.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SAMPLER_CHANNELS 8    //Most channels that can be registered
+#define SAMPLER_NONE  0xFF    //AddChannel() with the table full, no channel
+#define SAMPLER_FREE     0    //Trigger for Start(), free running
+#define SAMPLER_BLOCKS   3    //Blocks per channel per scan, median is taken across these
+
+struct SamplerChannel {
+  byte mux;                   //ADMUX channel bits
+  byte bits;                  //Oversampling, 4^bits conversions per block, 0-3
+  byte shift;                 //IIR filter shift, 0 is no filtering
+  byte group;                 //Scanned together
+  bool primed;                //Filter has been loaded with a first value
+  unsigned int block[SAMPLER_BLOCKS];
+  unsigned int filtered;      //Filtered result, 10.6 fixed point
+  unsigned int latest;        //This scan's median, before the filter
+};
+
+class ADCSampler {
+
+  public:
+        ADCSampler (void);
+        byte AddChannel (int pin, byte oversampleBits, byte filterShift, byte group = 0);
+        void Start (byte group, byte trigger);
+        bool isReady (void);
+        bool Finish (unsigned int timeout);
+        bool Acquire (byte group, byte trigger, unsigned int timeout);
+        unsigned int Result (byte channel);
+        unsigned int Latest (byte channel);
+        static void ConversionDone (void);
+
+  private:
+        SamplerChannel Channel[SAMPLER_CHANNELS];
+        byte Channels;
+        volatile bool ready;
+        byte Group;                 //Being scanned
+        volatile byte Trigger;      //The scan was started on, SAMPLER_FREE or a PWM_TRIGGER_
+        unsigned long Started;      //millis() at Start()
+        volatile byte current;      //Channel being converted
+        volatile byte blockNo;      //Block within the channel
+        volatile byte discard;      //Conversions to throw away after a mux change
+        volatile byte count;        //Conversions so far in this block
+        volatile unsigned int sum;  //64 x 1023 still fits 16 bits
+        static ADCSampler *active;
+
+        byte NextChannel (byte ch);
+        void SelectChannel (byte ch);
+        void Stop (void);
+        void Store (byte ch);
+        void ScanBlocking (void);
+        static void Rearm (byte trigger);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ADCSampler
+//////////////////////////////////////////////////////////////////////////////////////////////
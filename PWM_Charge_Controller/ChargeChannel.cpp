@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include "PWMLibs.h"
+#include "ADCSampler.h"
+#include "ChargeStateMachine.h"
+#include "SocEstimator.h"
+#include "EnergyMeter.h"
+#include "ChargeProtection.h"
+#include "MorseSender.h"
+#include "ChargeController.h"
+#include "ChargeChannel.h"
+
+/*  Charge Channel
+ *
+ *  A plain class over a PWMOutput rather than a template on the timer: the charge code is the
+ *  bulk of the flash, and a template would put a copy of it in for each timer. The virtual
+ *  calls are only made when the duty changes.
+ *
+ *  The dividers are placeholders until the sketch's ApplyProfile() sets the profile's, which
+ *  is done before the first reading. The current sensor is copied from the one given, as the
+ *  battery model is.
+ *
+ *  Full on has no off part to sample in, so it is suspended for a reading, but only on the
+ *  run the control step is due, as before. A channel whose output is already off (sleeping,
+ *  or suspended for a fault) is read free running every run with nothing to resume.
+ */
+
+ChargeChannel::ChargeChannel (byte number, PWMOutput &output, int pwmPin, unsigned long hz, unsigned int top,
+                              int batteryPin, int solarPin, const CurrentSensor &current, int kp, int ki,
+                              const SocEstimator &soc, bool hysteresis)
+  : ChargeController(output, pwmPin, hz, top, kp, ki, soc, hysteresis), Battery(batteryPin, 1, 1), Solar(solarPin, 1, 1),
+    Current(current)
+{
+  Number = number;
+  BatVoltage = 0;
+  SolarVoltage = 0;
+  ChargemA = 0;
+  OpenMs = 0;
+  SolarOpen = true;
+  Control = false;
+  ServiceMicros = 0;
+  WorstServiceMicros = 0;
+  Runs = number;      //Staggered, see Wake()
+  Scan = false;
+  Suspended = false;
+  SuspendedAt = 0;
+  Trigger = SAMPLER_FREE;
+}
+
+//////////////////////////////////////////////////////////////
+//Start the controller and put the sensors in this channel's
+//group. Call from setup(), after the core has set the timers.
+//////////////////////////////////////////////////////////////
+
+void ChargeChannel::Begin (ADCSampler *sampler, byte oversampleBits, byte filterShift)
+{
+  ChargeController::Begin();
+  Battery.UseSampler(sampler, oversampleBits, filterShift, Number);
+  Solar.UseSampler(sampler, oversampleBits, filterShift, Number);
+  Current.UseSampler(sampler, oversampleBits, filterShift, Number | CHANNEL_METER_GROUP);
+}
+
+//Back from a pause, control on the first sample run, or the run after for the next channel
+void ChargeChannel::Wake (void)
+{
+  Runs = Number;
+}
+
+//////////////////////////////////////////////////////////////
+//Start of a sample run, runs is how many there are to the
+//control period. Says whether the control step is due and
+//whether to read this run. True if it has suspended full on
+//for the reading, the caller lets the battery settle.
+//////////////////////////////////////////////////////////////
+
+bool ChargeChannel::Prepare (byte runs)
+{
+  if (!runs) runs = 1;
+  if (Runs >= runs) Runs = runs - 1;      //The control period got shorter
+  Control = (Runs == 0);
+  Runs = (Control ? runs : Runs) - 1;
+
+  bool on = Charger.isHardOn() && Charger.Duty();
+  Scan = Control || !on;
+  Suspended = Control && on;
+  if (Control) OpenMs = 0;
+  if (Suspended)
+  {
+    Charger.Suspend();
+    SuspendedAt = millis();
+  }
+  return (Suspended);
+}
+
+//Start reading, in the off part of the waveform if it has one
+void ChargeChannel::StartScan (ADCSampler &sampler)
+{
+  if (!Scan) return;
+  Trigger = Charger.SampleTrigger();
+  sampler.Start(Number, Trigger);
+}
+
+//////////////////////////////////////////////////////////////
+//Wait for the scan from StartScan() and take the readings,
+//and the current if the control step is due. False if nothing
+//was read this run.
+//////////////////////////////////////////////////////////////
+
+bool ChargeChannel::FinishScan (ADCSampler &sampler, unsigned int timeout)
+{
+  if (!Scan) return (false);
+  sampler.Finish(timeout);
+  Reading(Suspended || Trigger != SAMPLER_FREE || !Charger.Duty());
+  if (Suspended)
+  {
+    Charger.Resume();
+    OpenMs = millis() - SuspendedAt;
+  }
+  Suspended = false;
+  if (Control) ReadCurrent(sampler, timeout);
+  return (true);
+}
+
+//Readings from the last scan of the group, open if the switch was open for them
+void ChargeChannel::Reading (bool open)
+{
+  BatVoltage = Battery.volts();
+  SolarVoltage = Solar.volts();
+  SolarOpen = open;
+}
+
+//A free running scan of the current sensor, with the waveform as it is
+void ChargeChannel::ReadCurrent (ADCSampler &sampler, unsigned int timeout)
+{
+  sampler.Acquire(Number | CHANNEL_METER_GROUP, SAMPLER_FREE, timeout);
+  ChargemA = Current.milliAmps();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeChannel
+//////////////////////////////////////////////////////////////////////////////////////////////
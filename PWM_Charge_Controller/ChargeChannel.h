@@ -0,0 +1,71 @@
+#define ChargeChannelLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeChannel class, one battery charged from one panel through one switch
+//
+//  A ChargeController (the ChargePWM, the absorption PI controller, the ChargeStateMachine,
+//  the SocEstimator, the EnergyMeter and ChargeProtection) wired to a board: the battery,
+//  solar and current sensors, the timer under the ChargePWM (a PWMOutput), and the last
+//  readings. The sketch keeps an
+//  array of them, Bank[], and runs the same code over each. The charge pump, the thermistor,
+//  the profile and the logs are shared.
+//
+//  A 328P has room for two: Timer1 on pin 9 with Timer1PWM, and Timer0 on pin 5 with
+//  Timer0PWM. Timer2 is the charge pump's. A channel's voltage sensors are an ADCSampler
+//  group, its number, so each is scanned with its own waveform's trigger. The current sensor
+//  is a group of its own, the number with CHANNEL_METER_GROUP, scanned free running as the
+//  current comes and goes with the waveform (see CurrentSensor in PWMLibs.h). It is only read
+//  for a control step, by ReadCurrent(), once the waveform is back on after any suspending.
+//
+//  Sampling: the sketch's sample task calls Prepare() on every channel, then StartScan() and
+//  FinishScan() in turn, starting the next channel's scan before controlling the one just read
+//  so the A-D and the CPU work at once. Control comes round every so many sample runs, see
+//  Prepare(), staggered a run apart by channel so they don't all land in the same run. Wake()
+//  starts that again after a pause, so the first readings after it are acted on.
+//
+//  Include after ChargeController.h and what it needs, and ADCSampler.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define CHANNEL_METER_GROUP 0x80    //With the channel number, the current sensor's sampler group
+#define CHANNEL_SAMPLER_PINS  3     //Sampler channels Begin() adds: battery, solar and current
+
+class ChargeChannel : public ChargeController {
+
+  public:
+        ChargeChannel (byte number, PWMOutput &output, int pwmPin, unsigned long hz, unsigned int top,
+                       int batteryPin, int solarPin, const CurrentSensor &current, int kp, int ki,
+                       const SocEstimator &soc, bool hysteresis);
+        void Begin (ADCSampler *sampler, byte oversampleBits, byte filterShift);
+        void Wake (void);
+        bool Prepare (byte runs);
+        void StartScan (ADCSampler &sampler);
+        bool FinishScan (ADCSampler &sampler, unsigned int timeout);
+        void Reading (bool open);
+        void ReadCurrent (ADCSampler &sampler, unsigned int timeout);
+
+        byte Number;                    //Index in the sketch's Bank[], and the ADCSampler group
+        VoltageSensor Battery;
+        VoltageSensor Solar;
+        CurrentSensor Current;
+
+        float BatVoltage;
+        float SolarVoltage;
+        unsigned int ChargemA;
+        unsigned int OpenMs;            //Full on suspended for the last control step's reading
+        bool SolarOpen;                 //The solar reading was of the open panel, see SocEstimator.h
+        bool Control;                   //Due a control step this sample run
+        unsigned long ServiceMicros;    //From the start of the sample run to the end of the last control step
+        unsigned long WorstServiceMicros;
+
+  private:
+        byte Runs;                      //Sample runs before the next control step
+        bool Scan;                      //Being read this run
+        bool Suspended;                 //Full on, suspended for the reading
+        unsigned long SuspendedAt;      //millis()
+        byte Trigger;                   //What the scan was started with, SAMPLER_FREE or the waveform's
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeChannel
+//////////////////////////////////////////////////////////////////////////////////////////////
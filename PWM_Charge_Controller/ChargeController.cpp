@@ -0,0 +1,185 @@
+#include <Arduino.h>
+#include "PWMLibs.h"
+#include "MorseSender.h"
+#include "ChargeStateMachine.h"
+#include "SocEstimator.h"
+#include "EnergyMeter.h"
+#include "ChargeProtection.h"
+#include "ChargeController.h"
+
+/*  Charge Controller
+ *
+ *  What was the sketch's ChargeControl() and ChargeEntry(), moved in here with the state they
+ *  worked on so nothing is shared between two of them. The ChargeStateMachine is given the
+ *  controller as its actions' context, and Entry() and Exit() turn that back into the object.
+ *
+ *  The control laws work in millivolts, from the same readings the state machine is given,
+ *  so there is no float on the PI path. The hysteresis law's trickle takes a float fraction,
+ *  as it always has.
+ *
+ *  Begin() and not the constructor hands the state machine the pointer: an array of these is
+ *  built from temporaries, and this way it doesn't matter whether the compiler copies them.
+ */
+
+ChargeController::ChargeController (PWMOutput &output, int pwmPin, unsigned long hz, unsigned int top,
+                                    int kp, int ki, const SocEstimator &soc, bool hysteresis)
+  : Charger(output, pwmPin, hz), Absorption((long)kp * top / 255, (long)ki * top / 255, top),
+    State(hysteresis), Soc(soc)
+{
+  Hysteresis = hysteresis;
+  AbsorbmV = 0;
+  FloatmV = 0;
+  Indicator = 0;
+  OnEntry = 0;
+  OnExit = 0;
+}
+
+//Start the waveform and take the state machine's actions. Call from setup(), after the core has set the timers.
+void ChargeController::Begin (void)
+{
+  Charger.Begin();
+  State.Actions(Entry, Exit, this);
+}
+
+void ChargeController::UseIndicator (MorseSender *indicator)
+{
+  Indicator = indicator;
+  Charger.UseIndicator(indicator);
+}
+
+//Called after the controller's own entry action, and for each exit. Either can be 0.
+void ChargeController::Hooks (ControllerAction entry, ControllerAction exit)
+{
+  OnEntry = entry;
+  OnExit = exit;
+}
+
+//From the charge profile, after temperature compensation
+void ChargeController::Setpoints (unsigned int bulkmV, unsigned int absorbmV, unsigned int floatmV, unsigned int gapmV, unsigned int absorbMinutes)
+{
+  AbsorbmV = absorbmV;
+  FloatmV = floatmV;
+  State.Setpoints(bulkmV, absorbmV, floatmV, gapmV, absorbMinutes);
+  Protect.Setpoints(absorbmV);
+}
+
+//////////////////////////////////////////////////////////////
+//Counts the charge since the last readings, see SocEstimator.h,
+//and the energy, see EnergyMeter.h. solarmV unfiltered,
+//solarOpen if the switch was open for it. chargemA is the
+//measured charge current, openMs how long of the period full
+//on was suspended for the readings, drainmA what the battery is
+//giving to the board and load. Asleep nothing is delivered.
+//////////////////////////////////////////////////////////////
+
+void ChargeController::Count (unsigned int batterymV, unsigned int solarmV, bool solarOpen, unsigned int chargemA, unsigned int openMs, unsigned int drainmA, unsigned long seconds)
+{
+  Soc.Update(batterymV, solarmV, solarOpen, Duty(), drainmA, seconds);
+  if (State.State() == CHARGE_SLEEPING) chargemA = 0;
+  Energy.Update(Charger.State(), batterymV, chargemA, openMs, Soc.AvailablemA(batterymV), seconds);
+  if (State.State() == CHARGE_SLEEPING) Soc.Rest(batterymV, seconds);
+}
+
+//Runs the protection checks, the state machine goes to CHARGE_FAULT at its next Step()
+void ChargeController::Check (unsigned int batterymV, unsigned int solarmV, bool solarOpen, unsigned long seconds)
+{
+  State.Fault(Protect.Check(batterymV, solarmV, solarOpen, !Charger.Duty(), seconds));
+}
+
+//////////////////////////////////////////////////////////////
+//Moves the state machine on and runs the control law for the
+//stage it is in. regulate false only moves the state, for the
+//pause task, which has no waveform to set. Returns the state.
+//////////////////////////////////////////////////////////////
+
+byte ChargeController::Step (unsigned int batterymV, unsigned int solarmV, unsigned long seconds, bool regulate)
+{
+  byte state = State.Step(batterymV, solarmV, seconds);
+  if (!regulate) return (state);
+  int absorbError = (int)AbsorbmV - (int)batterymV;
+  switch (state)
+  {
+    case CHARGE_FAULT:     //Latched until reset or cleared, see ChargeProtection.h
+      Report(Protect.Code());
+      break;
+    case CHARGE_ABSORB:
+      if (Hysteresis) Charger.chargeTrickle(absorbError * 0.001 + 0.5);    //The 0.5 is so the PWM doesn't fade away before reaching voltage,
+      else Charger.chargeRegulate(Absorption.Update(absorbError));          //it goes to CHARGE_HOLD at target so this is safe
+      break;
+    case CHARGE_FLOAT:
+      Charger.chargeRegulate(Absorption.Update((int)FloatmV - (int)batterymV));
+      break;
+    case CHARGE_HOLD:
+      Report("Y");
+      break;
+  }
+  return (state);
+}
+
+//The charge duty as 0-255 of full on, whatever the output's resolution
+byte ChargeController::Duty (void)
+{
+  return (((unsigned long)Charger.Duty() * 255 + Charger.DutyMax() / 2) / Charger.DutyMax());
+}
+
+bool ChargeController::isHysteresis (void)
+{
+  return (Hysteresis);
+}
+
+//As given to Setpoints(), after temperature compensation
+unsigned int ChargeController::AbsorbSetpoint (void)
+{
+  return (AbsorbmV);
+}
+
+unsigned int ChargeController::FloatSetpoint (void)
+{
+  return (FloatmV);
+}
+
+//////////////////////////////////////////////////////////////
+//Entry actions, the waveform is set once on the way in, not
+//every control period
+//////////////////////////////////////////////////////////////
+
+void ChargeController::Entry (byte state, void *context)
+{
+  ChargeController &c = *(ChargeController *)context;
+  switch (state)
+  {
+    case CHARGE_BULK:         //The battery is down at bulk voltage so give it the beans
+      c.Charger.chargeHardOn();
+      c.Absorption.Reset(c.Charger.DutyMax());    //So absorption starts from full on, no step down
+      break;
+    case CHARGE_ABSORB:
+    case CHARGE_FLOAT:
+      if (state == CHARGE_FLOAT && c.State.Previous() == CHARGE_ABSORB) c.Soc.Full();   //As full as it gets
+      c.Charger.Resume();     //From the duty it had, the control step takes it from there
+      break;
+    case CHARGE_HOLD:
+    case CHARGE_FAULT:
+      c.Charger.chargeOff();
+      break;
+    case CHARGE_SLEEPING:
+      c.Charger.Suspend();
+      break;
+  }
+  if (c.OnEntry) c.OnEntry(c, state);
+}
+
+void ChargeController::Exit (byte state, void *context)
+{
+  ChargeController &c = *(ChargeController *)context;
+  if (c.OnExit) c.OnExit(c, state);
+}
+
+//Dropped while the indicator is still busy with the last one, so it never holds up the control
+void ChargeController::Report (const char *text)
+{
+  if (Indicator && !Indicator->isBusy()) Indicator->SendString(text);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeController
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,82 @@
+#define ChargeControllerLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeController class, the charge decisions and control laws for one battery
+//
+//  Everything that used to be the sketch's control step, with nothing global: the ChargePWM
+//  (on whatever PWMOutput it is given), the absorption PI controller, the ChargeStateMachine,
+//  the SocEstimator, the EnergyMeter, ChargeProtection and the setpoints, and the indicator
+//  to report on. So
+//  any number can be run at once, one for each ChargeChannel on the board, or thousands on the
+//  host (pwm_charge_sweep).
+//
+//  The readings are given to it, as to the other decision classes, it doesn't read anything
+//  itself. Each control period:
+//      Count()  the charge and energy since the last readings, into the SocEstimator and
+//               EnergyMeter
+//      Check()  the protection checks, faults go to the ChargeStateMachine
+//      Step()   the ChargeStateMachine, then the control law for the stage it is in
+//
+//  The waveform is switched by its own entry actions, which then call the ones given to
+//  Hooks(), for what a board has one of for all its controllers (the gate drive, the pause).
+//  Begin() sets its actions up, call it once the object is where it will stay.
+//
+//  Control laws, the constructor's hysteresis flag:
+//    PI           absorption holds the battery at the absorption setpoint with the PI
+//                 controller, tapering the duty as the battery's acceptance falls, then float
+//                 holds it at the float setpoint. Gains are per 8 bit duty step, scaled to the
+//                 output's TOP so they mean the same whichever timer it is on.
+//    hysteresis   the original: trickle in proportion to how far the battery is under the
+//                 absorption setpoint, off in CHARGE_HOLD until it drops by the gap.
+//
+//  Faults and the hysteresis hold are reported on the indicator given to UseIndicator(), as
+//  are the ChargePWM's mode changes. None, the default, is silent.
+//
+//  Include after PWMLibs.h, MorseSender.h, ChargeStateMachine.h, SocEstimator.h,
+//  EnergyMeter.h and ChargeProtection.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ChargeController;
+
+typedef void (*ControllerAction)(ChargeController &controller, byte state);
+
+class ChargeController {
+
+  public:
+        ChargeController (PWMOutput &output, int pwmPin, unsigned long hz, unsigned int top,
+                          int kp, int ki, const SocEstimator &soc, bool hysteresis);
+        void Begin (void);
+        void UseIndicator (MorseSender *indicator);
+        void Hooks (ControllerAction entry, ControllerAction exit);
+        void Setpoints (unsigned int bulkmV, unsigned int absorbmV, unsigned int floatmV, unsigned int gapmV, unsigned int absorbMinutes);
+        void Count (unsigned int batterymV, unsigned int solarmV, bool solarOpen, unsigned int chargemA, unsigned int openMs, unsigned int drainmA, unsigned long seconds);
+        void Check (unsigned int batterymV, unsigned int solarmV, bool solarOpen, unsigned long seconds);
+        byte Step (unsigned int batterymV, unsigned int solarmV, unsigned long seconds, bool regulate = true);
+        byte Duty (void);
+        bool isHysteresis (void);
+        unsigned int AbsorbSetpoint (void);
+        unsigned int FloatSetpoint (void);
+
+        ChargePWM Charger;
+        PIController Absorption;
+        ChargeStateMachine State;
+        SocEstimator Soc;
+        EnergyMeter Energy;
+        ChargeProtection Protect;
+
+  private:
+        static void Entry (byte state, void *context);
+        static void Exit (byte state, void *context);
+        void Report (const char *text);
+        bool Hysteresis;
+        unsigned int AbsorbmV;          //Setpoints, compensated by the caller
+        unsigned int FloatmV;
+        MorseSender *Indicator;
+        ControllerAction OnEntry;
+        ControllerAction OnExit;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeController
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,105 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "PWMLibs.h"
+#include "ChargeProfile.h"
+#include "SerialLink.h"
+
+/*  Charge Profile
+ *
+ *  Presets are 12V figures from the usual manufacturer ranges, at 25C. Flooded cells take the
+ *  highest absorption voltage and need the longest at it to stir the electrolyte, gel the
+ *  lowest as gassing in a gel cell does lasting damage. Compensation is -5, -4 and -3mV per
+ *  cell per degree, times 6 cells.
+ *
+ *  A preset only sets the charge figures, the dividers are the board's and are kept.
+ */
+
+//Bulk, absorb, float, gap (mV), absorb minutes, coefficient (mV/C)
+static const int Presets[PROFILE_TYPES - 1][6] PROGMEM = {
+  {12500, 14400, 13500, 500, 240, -30},   //Flooded
+  {12500, 14400, 13600, 400, 180, -24},   //AGM
+  {12500, 14100, 13700, 400, 240, -18},   //Gel
+};
+
+static unsigned int ProfileCRC (const ChargeProfile &p)
+{
+  return (LinkCRC((const byte *)&p, sizeof(ChargeProfile) - sizeof(p.CRC)));
+}
+
+//A divider VoltageSensor can read, the resistors are the board's ints
+//and ADC_REF_MV * (high + low) / low must stay within PROFILE_SCALE_MV
+static bool DividerValid (unsigned int high, unsigned int low)
+{
+  if (!high || !low || high > INT16_MAX || low > INT16_MAX) return (false);
+  return ((unsigned long)ADC_REF_MV * ((unsigned long)high + low) <= (unsigned long)PROFILE_SCALE_MV * low);
+}
+
+//////////////////////////////////////////////////////////////
+//Load the charge figures for a chemistry. False if there
+//isn't a preset for it.
+//////////////////////////////////////////////////////////////
+
+bool ProfilePreset (ChargeProfile &p, byte chemistry)
+{
+  if (chemistry == PROFILE_CUSTOM || chemistry >= PROFILE_TYPES) return (false);
+  const int *v = Presets[chemistry - 1];
+  p.Chemistry = chemistry;
+  p.BulkmV = pgm_read_word(v + 0);
+  p.AbsorbmV = pgm_read_word(v + 1);
+  p.FloatmV = pgm_read_word(v + 2);
+  p.HystGapmV = pgm_read_word(v + 3);
+  p.AbsorbMinutes = pgm_read_word(v + 4);
+  p.TempCoeffmV = (int16_t)pgm_read_word(v + 5);
+  p.TempRefC = 25;
+  return (true);
+}
+
+//////////////////////////////////////////////////////////////
+//True if the figures make sense together
+//////////////////////////////////////////////////////////////
+
+bool ProfileValid (const ChargeProfile &p)
+{
+  if (p.Chemistry >= PROFILE_TYPES) return (false);
+  if (p.BulkmV < PROFILE_MIN_MV || p.AbsorbmV > PROFILE_MAX_MV) return (false);
+  if (p.BulkmV >= p.FloatmV || p.FloatmV > p.AbsorbmV) return (false);
+  if (p.HystGapmV < PROFILE_GAP_MIN_MV || p.HystGapmV > PROFILE_GAP_MAX_MV) return (false);
+  if (p.WaitTime < PROFILE_WAIT_MIN || p.WaitTime > PROFILE_WAIT_MAX) return (false);
+  if (p.TempCoeffmV > 0 || p.TempCoeffmV < PROFILE_COEFF_MIN_MV) return (false);
+  if (p.TempRefC < PROFILE_REF_MIN_C || p.TempRefC > PROFILE_REF_MAX_C) return (false);
+  if (!DividerValid(p.BattHighR, p.BattLowR) || !DividerValid(p.SolarHighR, p.SolarLowR)) return (false);
+  return (true);
+}
+
+//////////////////////////////////////////////////////////////
+//Read the profile from EEPROM. False, and p left alone, if
+//there isn't a good one there.
+//////////////////////////////////////////////////////////////
+
+bool ProfileLoad (ChargeProfile &p)
+{
+  ChargeProfile stored;
+  EEPROM.get(PROFILE_ADDRESS, stored);
+  if (stored.Version != PROFILE_VERSION || stored.CRC != ProfileCRC(stored)) return (false);
+  if (!ProfileValid(stored)) return (false);
+  p = stored;
+  return (true);
+}
+
+//Tells one profile from another, for the Supervisor's recovery record
+unsigned int ProfileId (const ChargeProfile &p)
+{
+  return (ProfileCRC(p));
+}
+
+//Write the profile, only the bytes that have changed are written
+void ProfileSave (ChargeProfile &p)
+{
+  p.Version = PROFILE_VERSION;
+  p.CRC = ProfileCRC(p);
+  EEPROM.put(PROFILE_ADDRESS, p);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END ChargeProfile
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,80 @@
+#define ChargeProfileLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeProfile, the charge setpoints for a battery, kept in EEPROM
+//
+//  One build covers flooded, AGM and gel batteries: the profile is read from the start of the
+//  EEPROM at reset and the control code works from the copy in RAM, so the EEPROM is only
+//  touched at reset and when a new profile is saved. If the EEPROM doesn't hold a good profile
+//  (never written, an older version, bad CRC or values out of range) the sketch falls back to
+//  the one built from PWM_Charge_Controller.h. The divider resistors are checked against what
+//  VoltageSensor can take: each an int, and a full scale of at most PROFILE_SCALE_MV, above
+//  which the fixed point reading overflows.
+//
+//  Stages, with CONTROL_PI:
+//    Bulk        battery at or below BulkmV, charge full on
+//    Absorption  hold AbsorbmV for up to AbsorbMinutes of charging (0 = no limit)
+//    Float       then hold FloatmV, until the battery is found HystGapmV below that at rest
+//
+//  The profile is saved as the struct, versioned and with a CRC16 (the serial link's) over it.
+//  It lives below TELEMETRY_BASE. PROFILE_VERSION must go up if the layout changes.
+//
+//  Temperature compensation (TempCoeffmV per degree from TempRefC) is applied to absorption
+//  and float with the thermistor reading, see CompensateSetpoints() in the sketch. It is the
+//  whole battery's figure, not per cell. The compensated setpoints are held to PROFILE_MIN_MV
+//  to PROFILE_MAX_MV like the profile's own.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define PROFILE_ADDRESS 0
+#define PROFILE_SPACE   64        //EEPROM up to TELEMETRY_BASE
+#define PROFILE_VERSION 1
+
+//Chemistry, PROFILE_CUSTOM is anything not from a preset
+#define PROFILE_CUSTOM  0
+#define PROFILE_FLOODED 1
+#define PROFILE_AGM     2
+#define PROFILE_GEL     3
+#define PROFILE_TYPES   4
+
+//Limits a profile is checked against, mV and ms
+#define PROFILE_MIN_MV    11000
+#define PROFILE_MAX_MV    15500
+#define PROFILE_GAP_MIN_MV   50
+#define PROFILE_GAP_MAX_MV 2000
+#define PROFILE_WAIT_MIN    100
+#define PROFILE_WAIT_MAX  60000
+#define PROFILE_SCALE_MV  64000   //Most a divider may read at full scale, see VoltageScaleQ16()
+#define PROFILE_COEFF_MIN_MV -100 //Temperature compensation per degree, the presets are -18 to -30
+#define PROFILE_REF_MIN_C      0  //The temperature the setpoints are for
+#define PROFILE_REF_MAX_C     40
+
+struct ChargeProfile {
+  byte Version;
+  byte Chemistry;
+  unsigned int BulkmV;            //At or below, full on
+  unsigned int AbsorbmV;          //Absorption setpoint, what TARGET was
+  unsigned int FloatmV;
+  unsigned int HystGapmV;         //See top of file, and the hysteresis control law
+  unsigned int AbsorbMinutes;     //Time at absorption before float, 0 never floats
+  int TempCoeffmV;                //Per degree C, negative
+  int TempRefC;                   //Temperature the setpoints are for
+  unsigned int WaitTime;          //Control period, ms
+  unsigned int BattHighR;         //Voltage divider resistors
+  unsigned int BattLowR;
+  unsigned int SolarHighR;
+  unsigned int SolarLowR;
+  unsigned int CRC;               //Over everything above
+};
+
+static_assert(sizeof(ChargeProfile) <= PROFILE_SPACE, "The charge profile has outgrown its EEPROM space");
+
+bool ProfilePreset (ChargeProfile &p, byte chemistry);
+bool ProfileValid (const ChargeProfile &p);
+bool ProfileLoad (ChargeProfile &p);
+void ProfileSave (ChargeProfile &p);
+unsigned int ProfileId (const ChargeProfile &p);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END ChargeProfile
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,133 @@
+#include <Arduino.h>
+#include "ChargeProtection.h"
+
+/*  Charge Protection
+ *
+ *  Why the switch checks work: the panel is only joined to the battery through the MOSFET.
+ *  With it open, in the off part of the waveform or with the charge off, the panel reading is
+ *  the open circuit voltage, which follows the light and has nothing to do with the battery.
+ *  If it sits at the battery voltage for minutes on end the switch is conducting. The battery
+ *  going up with the charge off is only measured from when the panel started following it,
+ *  so another charger on the battery (the car's alternator) isn't taken for a stuck switch,
+ *  even when the panel passes through the battery voltage at dawn.
+ *
+ *  The jump check compares with the last reading that passed, not the one before, so a step
+ *  that stays put fails every time and latches. Readings a long way apart, across a night
+ *  the comparator said was dark, start it again.
+ */
+
+static const char *const Names[FAULT_CHECKS] = {"battery sensor", "solar sensor", "over voltage", "jump", "switch"};
+static const char *const Codes[FAULT_CHECKS] = {"FB", "FS", "FV", "FJ", "FW"};
+
+ChargeProtection::ChargeProtection (void)
+{
+  AbsorbmV = 0xFFFF;
+  GoodmV = 0;
+  GoodAt = 0;
+  Clear();
+}
+
+//Absorption as it is now, after temperature compensation
+void ChargeProtection::Setpoints (unsigned int absorbmV)
+{
+  AbsorbmV = absorbmV;
+}
+
+//////////////////////////////////////////////////////////////
+//Run the checks on a set of readings. solarOpen is true if the
+//solar reading was taken with the switch open, switchOff if
+//the charge is off. Returns the latched faults.
+//////////////////////////////////////////////////////////////
+
+byte ChargeProtection::Check (unsigned int batterymV, unsigned int solarmV, bool solarOpen, bool switchOff, unsigned long seconds)
+{
+  if (Strike(FAULT_BATT_SENSOR, batterymV < PROTECT_BATT_MIN_MV)) Latch(FAULT_BATT_SENSOR, seconds);
+  if (Strike(FAULT_SOLAR_SENSOR, solarmV > PROTECT_SOLAR_MAX_MV)) Latch(FAULT_SOLAR_SENSOR, seconds);
+  if (Strike(FAULT_OVERVOLTAGE, (unsigned long)batterymV > (unsigned long)AbsorbmV + PROTECT_OVER_MV)) Latch(FAULT_OVERVOLTAGE, seconds);
+
+  if (GoodmV == 0 || seconds - GoodAt > PROTECT_JUMP_SECONDS) GoodmV = batterymV;
+  GoodAt = seconds;
+  bool jumped = (batterymV > GoodmV) ? batterymV - GoodmV > PROTECT_JUMP_MV : GoodmV - batterymV > PROTECT_JUMP_MV;
+  if (!jumped) GoodmV = batterymV;
+  if (Strike(FAULT_JUMP, jumped)) Latch(FAULT_JUMP, seconds);
+
+  bool tied = solarOpen && batterymV >= PROTECT_BATT_MIN_MV &&
+              ((solarmV > batterymV) ? solarmV - batterymV : batterymV - solarmV) <= PROTECT_TIED_MV;
+  if (tied && !Tied) TiedSince = seconds;
+  Tied = tied;
+  if (Tied && seconds - TiedSince >= PROTECT_TIED_SECONDS) Latch(FAULT_SWITCH, seconds);
+
+  if (!switchOff || !Tied) OffmV = 0;
+  else if (OffmV == 0 || batterymV < OffmV) OffmV = batterymV;
+  if (Strike(FAULT_SWITCH, Tied && OffmV && batterymV > OffmV + PROTECT_RISE_MV)) Latch(FAULT_SWITCH, seconds);
+
+  return (Latched);
+}
+
+//Counts a check failing, true once it has failed PROTECT_STRIKES in a row
+bool ChargeProtection::Strike (byte fault, bool bad)
+{
+  byte n = 0;
+  while (!(fault & (1 << n))) n++;
+  if (!bad)
+  {
+    Strikes[n] = 0;
+    return (false);
+  }
+  if (Strikes[n] < PROTECT_STRIKES) Strikes[n]++;
+  return (Strikes[n] >= PROTECT_STRIKES);
+}
+
+void ChargeProtection::Latch (byte fault, unsigned long seconds)
+{
+  if (!Latched) When = seconds;
+  Latched |= fault;
+}
+
+byte ChargeProtection::Faults (void)
+{
+  return (Latched);
+}
+
+//When the first of the latched faults was found
+unsigned long ChargeProtection::LatchedAt (void)
+{
+  return (When);
+}
+
+//Faults latched before a reset, as if found at seconds
+void ChargeProtection::Restore (byte faults, unsigned long seconds)
+{
+  if (faults) Latch(faults, seconds);
+}
+
+//Forget the faults, the checks start again from nothing
+void ChargeProtection::Clear (void)
+{
+  Latched = 0;
+  When = 0;
+  for (byte i = 0; i < FAULT_CHECKS; i++) Strikes[i] = 0;
+  OffmV = 0;
+  Tied = false;
+  TiedSince = 0;
+}
+
+//Morse for the indicator, F and a letter for the first fault latched, by bit order
+const char *ChargeProtection::Code (void)
+{
+  for (byte i = 0; i < FAULT_CHECKS; i++)
+    if (Latched & (1 << i)) return (Codes[i]);
+  return ("");
+}
+
+//For reports, fault is one of the FAULT_ bits
+const char *ChargeProtection::Name (byte fault)
+{
+  for (byte i = 0; i < FAULT_CHECKS; i++)
+    if (fault == (1 << i)) return (Names[i]);
+  return ("?");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeProtection
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,83 @@
+#define ChargeProtectionLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeProtection class, checks the readings make sense and the switch does what it is told
+//
+//  Check() is given each set of readings and returns the latched faults. Anything set stays
+//  set until Clear() (the serial link's LINK_CLEAR) or a power on, the sketch Restore()s them
+//  after other resets from the Supervisor's record. The sketch passes that on to the
+//  ChargeStateMachine, whose CHARGE_FAULT turns the charge and the gate drive off.
+//
+//  The tied panel and rising battery checks are the same fault, the first is slow and sure,
+//  the second is quicker while a stuck switch is actually pushing the battery up.
+//
+//  Faults:
+//    FAULT_BATT_SENSOR   battery below PROTECT_BATT_MIN_MV, an open divider on A0 reads 0V
+//                        which would otherwise be full on for ever
+//    FAULT_SOLAR_SENSOR  solar above PROTECT_SOLAR_MAX_MV, more than a 12V panel can give,
+//                        the divider's low side is open
+//    FAULT_OVERVOLTAGE   battery PROTECT_OVER_MV above the (compensated) absorption voltage
+//    FAULT_JUMP          battery reading moved more than PROTECT_JUMP_MV from the last good one
+//                        and stayed there, a battery can't, a loose lead or divider can
+//    FAULT_SWITCH        the MOSFET conducting when it should be open: the panel held at the
+//                        battery voltage on open switch readings for PROTECT_TIED_SECONDS, or
+//                        the battery rising PROTECT_RISE_MV with the charge off and the panel
+//                        following it
+//
+//  Apart from the tied panel, a check has to fail PROTECT_STRIKES readings in a row before it
+//  latches, so one bad scan doesn't stop the charge. Each Check() is a few compares, no loops.
+//
+//  A switch that won't close isn't checked for. Every reading the control uses is taken with
+//  it open, so there is nothing to see it by. One stuck closed is only seen once the charge
+//  backs off: near full duty the readings aren't of the open panel, and see it at the battery
+//  voltage whether the switch is working or not.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define FAULT_BATT_SENSOR   0x01
+#define FAULT_SOLAR_SENSOR  0x02
+#define FAULT_OVERVOLTAGE   0x04
+#define FAULT_JUMP          0x08
+#define FAULT_SWITCH        0x10
+#define FAULT_CHECKS        5
+
+#define PROTECT_STRIKES         3
+#define PROTECT_BATT_MIN_MV  9000     //A 12V lead acid battery is ruined well before this
+#define PROTECT_SOLAR_MAX_MV 28000    //A 36 cell panel's Voc on a cold bright day is under 25V
+#define PROTECT_OVER_MV       600
+#define PROTECT_JUMP_MV      1000
+#define PROTECT_JUMP_SECONDS   60     //Readings further apart than this aren't compared
+#define PROTECT_TIED_MV        30     //Open panel within this of the battery
+#define PROTECT_TIED_SECONDS  600     //for this long, dawn and dusk go through it in a minute or two
+#define PROTECT_RISE_MV       200
+
+class ChargeProtection {
+
+  public:
+        ChargeProtection (void);
+        void Setpoints (unsigned int absorbmV);
+        byte Check (unsigned int batterymV, unsigned int solarmV, bool solarOpen, bool switchOff, unsigned long seconds);
+        byte Faults (void);
+        unsigned long LatchedAt (void);
+        void Clear (void);
+        void Restore (byte faults, unsigned long seconds);
+        const char *Code (void);
+        static const char *Name (byte fault);
+
+  private:
+        bool Strike (byte fault, bool bad);
+        void Latch (byte fault, unsigned long seconds);
+        byte Latched;
+        unsigned long When;             //Seconds of the first latch
+        byte Strikes[FAULT_CHECKS];     //Failed in a row, by bit number
+        unsigned int AbsorbmV;
+        unsigned int GoodmV;            //Last battery reading that passed the jump check
+        unsigned long GoodAt;
+        unsigned int OffmV;             //Lowest battery since the charge went off, 0 while on
+        bool Tied;                      //Open panel reading at the battery voltage
+        unsigned long TiedSince;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeProtection
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,277 @@
+#include <Arduino.h>
+#include "ChargeStateMachine.h"
+
+/*  Charge State Machine
+ *
+ *  Each Step() goes down the table for the first row from the current state (or CHARGE_ANY)
+ *  whose condition holds, and moves to that row's state. It then looks again from the new
+ *  state, so passing through CHARGE_OFF or going straight from bulk to hold takes one Step().
+ *  A row to the state it is already in is skipped, which lets the fault row be from any state.
+ *  Rows for a state are in priority order, a fault first, then dark, then by voltage.
+ *
+ *  The table is constexpr so the checks below are done by the compiler, and in PROGMEM on the
+ *  board so it costs no RAM.
+ */
+
+//Conditions, on the readings given to Step()
+#define WHEN_ALWAYS     0
+#define WHEN_FAULT      1     //Fault() set
+#define WHEN_CLEAR      2
+#define WHEN_DARK       3     //Solar below battery
+#define WHEN_LIGHT      4
+#define WHEN_BULK       5     //Battery at or below bulk
+#define WHEN_ABOVE_BULK 6
+#define WHEN_FULL       7     //Hysteresis law, battery at absorption
+#define WHEN_DROPPED    8     //Battery below absorption less the gap
+#define WHEN_ABSORBED   9     //Absorption time used up, not with the hysteresis law
+#define WHEN_COUNT     10
+
+struct ChargeTransition {
+  byte From;
+  byte When;
+  byte To;
+};
+
+static constexpr ChargeTransition Transitions[] PROGMEM = {
+  {CHARGE_ANY,      WHEN_FAULT,      CHARGE_FAULT},
+  {CHARGE_FAULT,    WHEN_CLEAR,      CHARGE_OFF},
+  {CHARGE_SLEEPING, WHEN_LIGHT,      CHARGE_OFF},
+
+  {CHARGE_OFF,      WHEN_DARK,       CHARGE_SLEEPING},
+  {CHARGE_OFF,      WHEN_BULK,       CHARGE_BULK},
+  {CHARGE_OFF,      WHEN_ABSORBED,   CHARGE_FLOAT},
+  {CHARGE_OFF,      WHEN_ALWAYS,     CHARGE_ABSORB},
+
+  {CHARGE_BULK,     WHEN_DARK,       CHARGE_SLEEPING},
+  {CHARGE_BULK,     WHEN_ABOVE_BULK, CHARGE_ABSORB},
+
+  {CHARGE_ABSORB,   WHEN_DARK,       CHARGE_SLEEPING},
+  {CHARGE_ABSORB,   WHEN_BULK,       CHARGE_BULK},
+  {CHARGE_ABSORB,   WHEN_FULL,       CHARGE_HOLD},
+  {CHARGE_ABSORB,   WHEN_ABSORBED,   CHARGE_FLOAT},
+
+  {CHARGE_FLOAT,    WHEN_DARK,       CHARGE_SLEEPING},
+  {CHARGE_FLOAT,    WHEN_BULK,       CHARGE_BULK},
+
+  {CHARGE_HOLD,     WHEN_DARK,       CHARGE_SLEEPING},
+  {CHARGE_HOLD,     WHEN_BULK,       CHARGE_BULK},
+  {CHARGE_HOLD,     WHEN_DROPPED,    CHARGE_ABSORB},
+};
+
+#define TRANSITION_COUNT (sizeof(Transitions) / sizeof(Transitions[0]))
+
+//Every row names real states and conditions
+static constexpr bool RowsValid (unsigned int i)
+{
+  return (i >= TRANSITION_COUNT ||
+          ((Transitions[i].From < CHARGE_STATES || Transitions[i].From == CHARGE_ANY) &&
+           Transitions[i].To < CHARGE_STATES && Transitions[i].When < WHEN_COUNT && RowsValid(i + 1)));
+}
+
+//A state has a row of its own out of it
+static constexpr bool HasExit (byte state, unsigned int i)
+{
+  return (i < TRANSITION_COUNT &&
+          ((Transitions[i].From == state && Transitions[i].To != state) || HasExit(state, i + 1)));
+}
+
+static constexpr bool AllHaveExits (byte state)
+{
+  return (state >= CHARGE_STATES || (HasExit(state, 0) && AllHaveExits(state + 1)));
+}
+
+static_assert(RowsValid(0), "A charge transition names a state or condition that doesn't exist");
+static_assert(AllHaveExits(0), "A charge state has no way out");
+
+static const char *const Names[CHARGE_STATES] = {"off", "bulk", "absorb", "float", "hold", "fault", "sleeping"};
+
+ChargeStateMachine::ChargeStateMachine (bool hysteresis)
+{
+  Hysteresis = hysteresis;
+  Faulted = false;
+  Current = CHARGE_OFF;
+  Last = CHARGE_OFF;
+  Since = 0;
+  Absorbed = 0;
+  BatterymV = 0;
+  SolarmV = 0;
+  BulkmV = 0;
+  AbsorbmV = 0;
+  FloatmV = 0;
+  GapmV = 0;
+  AbsorbMinutes = 0;
+  OnEntry = 0;
+  OnExit = 0;
+  Context = 0;
+  for (byte s = 0; s < CHARGE_STATES; s++)
+  {
+    Count[s] = 0;
+    Total[s] = 0;
+  }
+}
+
+//From the charge profile, can be changed at any time
+void ChargeStateMachine::Setpoints (unsigned int bulkmV, unsigned int absorbmV, unsigned int floatmV, unsigned int gapmV, unsigned int absorbMinutes)
+{
+  BulkmV = bulkmV;
+  AbsorbmV = absorbmV;
+  FloatmV = floatmV;
+  GapmV = gapmV;
+  AbsorbMinutes = absorbMinutes;
+}
+
+//Called with the state being left and the state entered, exit first. Either can be 0.
+//context is passed on to them, whatever this one belongs to (its ChargeController).
+void ChargeStateMachine::Actions (ChargeAction entry, ChargeAction exit, void *context)
+{
+  OnEntry = entry;
+  OnExit = exit;
+  Context = context;
+}
+
+//Starts in CHARGE_OFF, the first Step() decides from there
+void ChargeStateMachine::Begin (unsigned long seconds)
+{
+  Current = CHARGE_OFF;
+  Last = CHARGE_OFF;
+  Since = seconds;
+  Count[CHARGE_OFF]++;
+}
+
+//////////////////////////////////////////////////////////////
+//In place of Begin() after a reset, straight into the state
+//it was in with the absorption time it had. The entry action
+//is run so the hardware is set up for it.
+//////////////////////////////////////////////////////////////
+
+void ChargeStateMachine::Resume (byte state, unsigned long absorbed, unsigned long seconds)
+{
+  if (state >= CHARGE_STATES) state = CHARGE_OFF;
+  Current = state;
+  Last = CHARGE_OFF;
+  Since = seconds;
+  Absorbed = absorbed;
+  Count[state]++;
+  if (OnEntry) OnEntry(state, Context);
+}
+
+//////////////////////////////////////////////////////////////
+//Take the readings and move on as the table says, see top of
+//file. Returns the state it ends up in.
+//////////////////////////////////////////////////////////////
+
+byte ChargeStateMachine::Step (unsigned int batterymV, unsigned int solarmV, unsigned long seconds)
+{
+  BatterymV = batterymV;
+  SolarmV = solarmV;
+  for (byte moves = 0; moves < CHARGE_STATES; moves++)    //Can't loop for ever on a bad table
+  {
+    byte to = Current;
+    for (byte i = 0; i < TRANSITION_COUNT && to == Current; i++)
+    {
+      byte from = pgm_read_byte(&Transitions[i].From);
+      byte next = pgm_read_byte(&Transitions[i].To);
+      if ((from == Current || from == CHARGE_ANY) && next != Current && Test(pgm_read_byte(&Transitions[i].When), seconds)) to = next;
+    }
+    if (to == Current) break;
+    Change(to, seconds);
+  }
+  return (Current);
+}
+
+bool ChargeStateMachine::Test (byte when, unsigned long seconds)
+{
+  switch (when)
+  {
+    case WHEN_ALWAYS:     return (true);
+    case WHEN_FAULT:      return (Faulted);
+    case WHEN_CLEAR:      return (!Faulted);
+    case WHEN_DARK:       return (SolarmV < BatterymV);
+    case WHEN_LIGHT:      return (SolarmV >= BatterymV);
+    case WHEN_BULK:       return (BatterymV <= BulkmV);
+    case WHEN_ABOVE_BULK: return (BatterymV > BulkmV);
+    case WHEN_FULL:       return (Hysteresis && BatterymV >= AbsorbmV);
+    case WHEN_DROPPED:    return (BatterymV + GapmV < AbsorbmV);
+    case WHEN_ABSORBED:   return (!Hysteresis && AbsorbMinutes && AbsorbSeconds(seconds) >= AbsorbMinutes * 60UL);
+  }
+  return (false);
+}
+
+void ChargeStateMachine::Change (byte to, unsigned long seconds)
+{
+  unsigned long dwell = seconds - Since;
+  if (OnExit) OnExit(Current, Context);
+  Total[Current] += dwell;
+  if (Current == CHARGE_ABSORB) Absorbed += dwell;
+  if (Current == CHARGE_SLEEPING && BatterymV + GapmV < FloatmV) Absorbed = 0;   //Drawn down at rest, absorb again
+  if (to == CHARGE_BULK) Absorbed = 0;
+  Last = Current;
+  Current = to;
+  Since = seconds;
+  Count[to]++;
+  if (OnEntry) OnEntry(to, Context);
+}
+
+//Set by whatever checks for faults, the state machine moves to CHARGE_FAULT at the next Step()
+void ChargeStateMachine::Fault (bool fault)
+{
+  Faulted = fault;
+}
+
+byte ChargeStateMachine::State (void)
+{
+  return (Current);
+}
+
+//The state before this one
+byte ChargeStateMachine::Previous (void)
+{
+  return (Last);
+}
+
+//Seconds in the current state
+unsigned long ChargeStateMachine::Dwell (unsigned long seconds)
+{
+  return (seconds - Since);
+}
+
+unsigned long ChargeStateMachine::AbsorbSeconds (unsigned long seconds)
+{
+  return (Absorbed + ((Current == CHARGE_ABSORB) ? seconds - Since : 0));
+}
+
+unsigned int ChargeStateMachine::Entries (byte state)
+{
+  return ((state < CHARGE_STATES) ? Count[state] : 0);
+}
+
+//Total seconds in a state, including the time so far if it is the current one
+unsigned long ChargeStateMachine::Seconds (byte state, unsigned long seconds)
+{
+  if (state >= CHARGE_STATES) return (0);
+  return (Total[state] + ((state == Current) ? seconds - Since : 0));
+}
+
+//For reports, lower case so it can go in CSV
+const char *ChargeStateMachine::Name (byte state)
+{
+  return ((state < CHARGE_STATES) ? Names[state] : "?");
+}
+
+void ChargeStateMachine::Report (unsigned long seconds)
+{
+  for (byte s = 0; s < CHARGE_STATES; s++)
+  {
+    Serial.print("State ");
+    Serial.print(Name(s));
+    Serial.print(" entered ");
+    Serial.print(Count[s]);
+    Serial.print(" for ");
+    Serial.print(Seconds(s, seconds));
+    Serial.println("s");
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeStateMachine
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,89 @@
+#define ChargeStateMachineLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeStateMachine class, which stage of the charge the controller is in
+//
+//  Decisions only, it doesn't touch the hardware. Step() is given the latest readings and the
+//  time, follows the transition table in ChargeStateMachine.cpp and returns the state. The
+//  entry and exit actions, set with Actions() by its ChargeController, do the switching, so the charge
+//  waveform is only changed when the state does, and the same code runs on the host fed with
+//  made up readings. Each ChargeController has its own, the actions are given it back as the
+//  context, so any number can run side by side.
+//
+//  States:
+//    CHARGE_OFF       deciding, passed through at reset, on waking and when a fault clears
+//    CHARGE_BULK      battery at or below bulk, full on
+//    CHARGE_ABSORB    bring the battery to the absorption voltage and hold it there
+//    CHARGE_FLOAT     absorption time used up, hold the float voltage
+//    CHARGE_HOLD      hysteresis law only, target reached, off until it drops by the gap
+//    CHARGE_FAULT     off while Fault() is set
+//    CHARGE_SLEEPING  solar below battery, the pause task is running things
+//
+//  Absorption time is the seconds spent in CHARGE_ABSORB since the battery was last at bulk,
+//  carried through the nights (and resets, with Resume()), and starts again if the battery is found below float less the
+//  gap on waking. With the hysteresis law (the constructor's flag) there is no float, target
+//  is held by going between CHARGE_ABSORB and CHARGE_HOLD.
+//
+//  The count of entries and total seconds of each state are kept for reports. Times are the
+//  caller's, seconds from the SleepManager so the nights count. The state numbers are also
+//  the state in TelemetryLog records and serial link status frames.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define CHARGE_OFF      0
+#define CHARGE_BULK     1
+#define CHARGE_ABSORB   2
+#define CHARGE_FLOAT    3
+#define CHARGE_HOLD     4
+#define CHARGE_FAULT    5
+#define CHARGE_SLEEPING 6
+#define CHARGE_STATES   7
+#define CHARGE_ANY      0xFF      //In the transition table, from any state
+
+typedef void (*ChargeAction)(byte state, void *context);
+
+class ChargeStateMachine {
+
+  public:
+        ChargeStateMachine (bool hysteresis);
+        void Setpoints (unsigned int bulkmV, unsigned int absorbmV, unsigned int floatmV, unsigned int gapmV, unsigned int absorbMinutes);
+        void Actions (ChargeAction entry, ChargeAction exit, void *context = 0);
+        void Begin (unsigned long seconds);
+        void Resume (byte state, unsigned long absorbed, unsigned long seconds);
+        byte Step (unsigned int batterymV, unsigned int solarmV, unsigned long seconds);
+        void Fault (bool fault);
+        byte State (void);
+        byte Previous (void);
+        unsigned long Dwell (unsigned long seconds);
+        unsigned long AbsorbSeconds (unsigned long seconds);
+        unsigned int Entries (byte state);
+        unsigned long Seconds (byte state, unsigned long seconds);
+        static const char *Name (byte state);
+        void Report (unsigned long seconds);
+
+  private:
+        bool Test (byte when, unsigned long seconds);
+        void Change (byte to, unsigned long seconds);
+        bool Hysteresis;
+        bool Faulted;
+        byte Current;
+        byte Last;
+        unsigned long Since;          //When Current was entered
+        unsigned long Absorbed;       //Absorption seconds before Since
+        unsigned int BatterymV;       //Readings for this Step()
+        unsigned int SolarmV;
+        unsigned int BulkmV;
+        unsigned int AbsorbmV;
+        unsigned int FloatmV;
+        unsigned int GapmV;
+        unsigned int AbsorbMinutes;
+        ChargeAction OnEntry;
+        ChargeAction OnExit;
+        void *Context;                //Given to the actions
+        unsigned int Count[CHARGE_STATES];
+        unsigned long Total[CHARGE_STATES];   //Seconds, up to the last exit
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class ChargeStateMachine
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,115 @@
+#include <Arduino.h>
+#include "EnergyMeter.h"
+
+/*  Energy Meter
+ *
+ *  mV x mA fits 32 bits, times the seconds since the last Update() is done in 64. On the AVR
+ *  that is a library multiply a control period. The only divides are Tenths(), once a day,
+ *  and taking out the time the switch was open, only in PWM_HARDON.
+ *
+ *  Like the SocEstimator, the reading at the end of a period stands for the whole of it, the
+ *  mode is the one the charge has been in since the last call.
+ */
+
+static const EnergyTotals Empty = {0, 0, 0, 0};
+
+EnergyMeter::EnergyMeter (void)
+{
+  for (byte m = 0; m < ENERGY_MODES; m++) Modes[m] = Empty;
+  Day = Empty;
+  LastDay = Empty;
+  DayCount = 0;
+  Last = 0;
+  DayStart = 0;
+}
+
+//Start counting, call once with the first readings
+void EnergyMeter::Begin (unsigned long seconds)
+{
+  Last = seconds;
+  DayStart = seconds;
+}
+
+//At the end of a pause, so the first reading after it doesn't
+//stand for the night as well
+void EnergyMeter::Wake (unsigned long seconds)
+{
+  Last = seconds;
+}
+
+void EnergyMeter::Add (EnergyTotals &t, unsigned long long delivered, unsigned long long available, unsigned long dt, unsigned int mA)
+{
+  t.DeliveredUj += delivered;
+  t.AvailableUj += available;
+  t.Seconds += dt;
+  if (mA > t.PeakmA) t.PeakmA = mA;
+}
+
+//////////////////////////////////////////////////////////////
+//Count the energy since the last Update(), call with each new
+//reading. mode is what the charge has been since the last call,
+//openMs how much of it the switch was open for the readings.
+//////////////////////////////////////////////////////////////
+
+void EnergyMeter::Update (byte mode, unsigned int batterymV, unsigned int chargemA, unsigned int openMs, unsigned int availablemA, unsigned long seconds)
+{
+  unsigned long dt = seconds - Last;
+  Last = seconds;
+  if (mode >= ENERGY_MODES) return;
+  unsigned long power = (unsigned long)batterymV * chargemA;
+  unsigned long long delivered = (unsigned long long)power * dt;
+  unsigned long long open = openMs ? (unsigned long long)power * openMs / 1000 : 0;
+  delivered = (open < delivered) ? delivered - open : 0;
+  unsigned long long available = (unsigned long long)((unsigned long)batterymV * availablemA) * dt;
+  Add(Modes[mode], delivered, available, dt, chargemA);
+  Add(Day, delivered, available, dt, chargemA);
+}
+
+//True when the day should be rolled up, dusk at the start of a pause
+bool EnergyMeter::DayDue (unsigned long seconds, bool dusk)
+{
+  return (seconds - DayStart >= (dusk ? ENERGY_DAY_MIN : ENERGY_DAY_MAX));
+}
+
+//Keep the day just gone for Yesterday() and start another
+void EnergyMeter::EndDay (unsigned long seconds)
+{
+  LastDay = Day;
+  Day = Empty;
+  DayStart = seconds;
+  DayCount++;
+}
+
+//Since reset, for a ChargePWM mode
+const EnergyTotals &EnergyMeter::Mode (byte mode)
+{
+  return (Modes[mode < ENERGY_MODES ? mode : 0]);
+}
+
+const EnergyTotals &EnergyMeter::Today (void)
+{
+  return (Day);
+}
+
+//The last day EndDay() closed, all zero before the first
+const EnergyTotals &EnergyMeter::Yesterday (void)
+{
+  return (LastDay);
+}
+
+//Days closed since reset
+unsigned int EnergyMeter::Days (void)
+{
+  return (DayCount);
+}
+
+//Tenths of a Wh, rounded, no more than most
+unsigned int EnergyMeter::Tenths (unsigned long long uj, unsigned int most)
+{
+  unsigned long long tenths = (uj + ENERGY_PER_WH / 20) / (ENERGY_PER_WH / 10);
+  return ((tenths > most) ? most : (unsigned int)tenths);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class EnergyMeter
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,78 @@
+#define EnergyMeterLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  EnergyMeter class, the energy a channel puts into its battery and what it could have
+//
+//  Each control period the measured charge current (CurrentSensor, PWMLibs.h) times the battery
+//  voltage is added up, under the ChargePWM mode (PWM_OFF to PWM_REGULATE) the charge was in.
+//  Alongside it, what the panel would have given at full on into the same battery voltage,
+//  from the SocEstimator's panel model. So:
+//
+//      delivered / available  in PWM_HARDON   how the panel is doing against its label, a
+//                                             dirty, shaded or failing one shows up low
+//      delivered / available  overall        how much of that the control law took, the
+//                                             figure to compare control strategies by
+//
+//  The time off and in hold counts towards available and not delivered, it is what the
+//  strategy left behind. Available is the ceiling for a PWM switch, not the panel's maximum
+//  power point.
+//
+//  Energy is 64 bit fixed point, mV x mA x s, microjoules: ENERGY_PER_WH to the Wh, good for
+//  5 billion Wh. That is a multiply and an add each period, no divide.
+//
+//  Days are rolled up for the telemetry log and the serial link (TelemetryLog.h, SerialLink.h).
+//  There is no clock, so a day ends at the first pause (dusk) ENERGY_DAY_MIN after the last
+//  one ended, or ENERGY_DAY_MAX with no pause, e.g. a channel latched in a fault. The end of
+//  a pause, from the last reading in it, isn't counted: the charge was off and it was dark.
+//
+//  The current is read after the switch closes again, so in PWM_HARDON the time it was open
+//  for the battery reading (the settle time, ChargeChannel's OpenMs) is given to Update() and
+//  left out of delivered. Nothing is delivered while the channel sleeps, the readings taken in
+//  a pause only count towards available. The battery voltage is the reading the control step
+//  has, in the off part of the waveform, so delivered is a little low while charging, by the
+//  battery's series resistance. On pwm_charge_sim's three_days profile delivered comes to
+//  within 1% of the simulated battery's. The seconds in a mode take in the pauses that began
+//  in it.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define ENERGY_MODES     4                //ChargePWM's PWM_OFF to PWM_REGULATE
+#define ENERGY_PER_WH    3600000000ULL    //Microjoules
+#define ENERGY_DAY_MIN   (12 * 3600UL)    //Seconds
+#define ENERGY_DAY_MAX   (36 * 3600UL)
+
+struct EnergyTotals {
+  unsigned long long DeliveredUj;   //Into the battery
+  unsigned long long AvailableUj;   //At full on, from the panel model
+  unsigned long Seconds;
+  unsigned int PeakmA;
+};
+
+class EnergyMeter {
+
+  public:
+        EnergyMeter (void);
+        void Begin (unsigned long seconds);
+        void Wake (unsigned long seconds);
+        void Update (byte mode, unsigned int batterymV, unsigned int chargemA, unsigned int openMs, unsigned int availablemA, unsigned long seconds);
+        bool DayDue (unsigned long seconds, bool dusk);
+        void EndDay (unsigned long seconds);
+        const EnergyTotals &Mode (byte mode);
+        const EnergyTotals &Today (void);
+        const EnergyTotals &Yesterday (void);
+        unsigned int Days (void);
+        static unsigned int Tenths (unsigned long long uj, unsigned int most);
+
+  private:
+        static void Add (EnergyTotals &t, unsigned long long delivered, unsigned long long available, unsigned long dt, unsigned int mA);
+        EnergyTotals Modes[ENERGY_MODES];   //Since reset
+        EnergyTotals Day;                   //So far today
+        EnergyTotals LastDay;
+        unsigned int DayCount;
+        unsigned long Last;                 //Seconds at the last Update()
+        unsigned long DayStart;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class EnergyMeter
+//////////////////////////////////////////////////////////////////////////////////////////////
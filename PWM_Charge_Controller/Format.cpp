@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include "Format.h"
+
+/*  Format
+ *
+ *  Digits come out of the divisions backwards, so they go into a small array on the stack
+ *  first and are copied into the buffer the right way round. Values are taken as unsigned
+ *  long once the sign is off so LONG_MIN doesn't overflow.
+ */
+
+//////////////////////////////////////////////////////////////
+//Write the digits of v, at least width of them, at p.
+//Returns the position after the last digit.
+//////////////////////////////////////////////////////////////
+
+static char *PutDigits (char *p, unsigned long v, byte width)
+{
+  char digits[FORMAT_DIGITS];
+  byte n = 0;
+  do
+  {
+    digits[n++] = '0' + (v % 10);
+    v /= 10;
+  } while (v && n < sizeof(digits));
+  while (width > n)
+  {
+    *p++ = '0';
+    width--;
+  }
+  while (n) *p++ = digits[--n];
+  return (p);
+}
+
+char *FormatInt (char *buf, long value, byte width)
+{
+  char *p = buf;
+  unsigned long v = (unsigned long)value;
+  if (value < 0)
+  {
+    *p++ = '-';
+    v = 0UL - v;
+  }
+  if (width > FORMAT_DIGITS) width = FORMAT_DIGITS;
+  p = PutDigits(p, v, width);
+  *p = 0;
+  return (buf);
+}
+
+//////////////////////////////////////////////////////////////
+//value has places digits after the point (e.g. 3 for mV as
+//volts). Shown with decimals digits after the point, which
+//must not be more than places.
+//////////////////////////////////////////////////////////////
+
+char *FormatFixed (char *buf, long value, byte places, byte decimals)
+{
+  if (decimals > places) decimals = places;
+  char *p = buf;
+  unsigned long v = (unsigned long)value;
+  if (value < 0) v = 0UL - v;
+
+  unsigned long drop = 1;         //Round off the places not shown
+  for (byte i = decimals; i < places; i++) drop *= 10;
+  v = (v + drop / 2) / drop;
+
+  unsigned long unit = 1;
+  for (byte i = 0; i < decimals; i++) unit *= 10;
+
+  if (value < 0 && v) *p++ = '-';
+  p = PutDigits(p, v / unit, 0);
+  if (decimals)
+  {
+    *p++ = '.';
+    p = PutDigits(p, v % unit, decimals);
+  }
+  *p = 0;
+  return (buf);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Format
+//////////////////////////////////////////////////////////////////////////////////////////////
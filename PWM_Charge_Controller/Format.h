@@ -0,0 +1,25 @@
+#define FormatLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Number formatting into a caller's buffer, in place of the Arduino String class.
+//
+//  String builds its text on the heap, and on a 2K part that runs for months the allocations
+//  fragment what little there is. These write into a char array the caller owns (usually a
+//  local of FORMAT_BUFFER bytes), never allocate, and return the buffer so the result can be
+//  passed straight on, e.g. Morse.SendString(FormatInt(buf, PulseWidth)).
+//
+//  FormatInt    - whole number, optionally padded with leading zeros to a minimum width.
+//  FormatFixed  - fixed point value, e.g. millivolts (3 places) shown as volts to 2 places,
+//                 rounded half away from zero. No float code is involved.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define FORMAT_DIGITS (3 * sizeof(long))      //Enough for any long, 12 on the AVR
+#define FORMAT_BUFFER (FORMAT_DIGITS + 3)     //With the sign, the point and the terminator
+
+char *FormatInt (char *buf, long value, byte width = 0);
+char *FormatFixed (char *buf, long value, byte places, byte decimals);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Format
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include "MorseSender.h"
 //#define DEBUG
+#include "SerialLink.h"   //Stops DEBUG being built with the serial link on
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 //  28 April 2018
@@ -16,38 +17,62 @@
 //  Increasing the speed above the defaults seems to lead to breakdown in accuracy, not sure if
 //  This is to do with the latency on the chip, Led hysterisis, code issues or something else. 
 //
+//  The optical frames get round that by not being read by eye. The interrupt clocks the half
+//  bits and does nothing else while one is going, Update() leaves the LED alone until it has
+//  finished, and the element then waits OPTICAL_GAP_MS and frees the frame for the next.
 //
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+#define MORSE_IDLE     0    //Element codes held in the queue
+#define MORSE_DOT      1
+#define MORSE_DASH     2
+#define MORSE_CHARGAP  3
+#define MORSE_WORDGAP  4
+#define MORSE_BLIP     5
+#define MORSE_FRAME    6    //The frame in frame[]
+
+MorseSender *MorseSender::senders = 0;
+MorseSender *volatile MorseSender::bursting = 0;
+
     MorseSender::MorseSender(void)  //Normal constructor, defaults to Arduino Pin 13.
     {
-      LEDPIN = 13;
-      tempo=100;                    //This variable is exposed so users can set speed if needed.
-      pinMode(LEDPIN, OUTPUT);
+      Init(13);
     }
 
     
     MorseSender::MorseSender(int ledpin)  //Specifies which pin to use for high/low signalling.
+    {
+      Init(ledpin);
+    }
+
+    void MorseSender::Init(int ledpin)
     {
       LEDPIN = ledpin;
-      tempo=100;
+      tempo=100;                    //This variable is exposed so users can set speed if needed.
+      head=0;
+      tail=0;
+      element=MORSE_IDLE;
+      frameLength=0;
+      next=senders;                 //Join the list Tick() services
+      senders=this;
       pinMode(LEDPIN, OUTPUT);
     }
     
 
-    void MorseSender::SendString(String text) //Send a String and it will be sent letter by letter.
+    void MorseSender::SendString(const char *text) //Send a string and it will be sent letter by letter.
+                                                   //Numbers can be put in a buffer with Format.h
     {
-      for (int i = 0; i < text.length(); i++) 
+      while (*text)
       {
-          SendLetter(text[i]);
+          SendLetter(*text++);
       }
       wordGap();  //Seems to make seperation between sentences make more sense this way.
     }
 
   void MorseSender::Flash (void)  //This is a wake-up to the operator to be ready for a transmission.
-                                  //Three bursts of flashes.
+                                  //Three bursts of flashes. Only used at start-up so it still blocks.
     {
-
+      Wait();
       for (int x = 0;x<3;x++)
       {
         for (int i = 0; i < 20; i++)
@@ -61,22 +86,39 @@
       }
     }
 
-  void MorseSender::Blip (void)  //This is a wake-up to the operator to be ready for a transmission.
-                                  //Three bursts of flashes.
+  void MorseSender::Blip (void)  //A single burst of flashes, queued like any other element.
     {
-        for (int i = 0; i < 20; i++)
-        { 
-          digitalWrite(LEDPIN, HIGH);
-          delay(25);
-          digitalWrite(LEDPIN, LOW);
-          delay(25);
-        }
-      delay(250);
+      Queue(MORSE_BLIP);
+    }
+
+//////////////////////////////////////////////////////////////
+//Queue a frame for a machine to read, see MorseSender.h. false
+//if the last one hasn't gone yet or the payload is too long.
+//////////////////////////////////////////////////////////////
+
+  bool MorseSender::SendFrame (const byte *payload, byte len)
+    {
+      if (frameLength || len > OPTICAL_MAX_PAYLOAD) return false;
+      byte n = 0;
+      frame[n++] = OPTICAL_PREAMBLE;
+      frame[n++] = OPTICAL_PREAMBLE;
+      frame[n++] = OPTICAL_START;
+      frame[n++] = len;
+      memcpy(frame + n, payload, len);
+      n += len;
+      unsigned int crc = LinkCRC(frame + 3, len + 1);
+      frame[n++] = crc & 0xFF;
+      frame[n++] = crc >> 8;
+      frameLength = n;
+      Queue(MORSE_FRAME);
+      return true;
     }
 
     void MorseSender::StartTX (void)  //This is radio-standard V's for start of TX. 
                                       //Found flashes were more useful, but left for the hell of it.
+                                      //The tempo is changed for the V's so this waits for them to go.
     {
+      Wait();
       int SaveTemp=tempo;
       tempo=tempo/3;
       for (int x = 0;x<2;x++)
@@ -85,84 +127,258 @@
         { 
          SendLetter('V');
         }
-       delay(6*tempo);
+       wordGap();
       }
+      Wait();
       tempo=SaveTemp;
     }
 
     void MorseSender::dot (void)    //Sends a dot, but with an extended pause after each one. 
                                     //May not be standard, but makes it more readable to my eye.
     {
-       digitalWrite(LEDPIN, HIGH);
-       delay(1 * tempo);
-       digitalWrite(LEDPIN, LOW);
-       delay(3 * tempo);
+       Queue(MORSE_DOT);
     }
     
     void MorseSender::dash (void) //Sends a dash - which is 5x longer than the dot. Again not standard
                                   //But seems to make the morse readable.
     {
-       digitalWrite(LEDPIN, HIGH);
-       delay(5 * tempo);
-       digitalWrite(LEDPIN, LOW);
-       delay(3 * tempo);
+       Queue(MORSE_DASH);
     }
 
     void MorseSender::charGap (void) //To be readable needs a longer gap after each character. This is then
                                      //Double the gap between each of the symbols within each letter.
     {
-       delay(3 * tempo);
+       Queue(MORSE_CHARGAP);
     }
 
     void MorseSender::wordGap (void)  //A Gap at the end of each word, which is longer than between letters
     {
-       delay(6 * tempo);
+       Queue(MORSE_WORDGAP);
+    }
+
+//////////////////////////////////////////////////////////////
+//Queue an element for sending. Returns straight away unless the
+//buffer is full, in which case it waits for space.
+//////////////////////////////////////////////////////////////
+
+    void MorseSender::Queue (byte e)
+    {
+      byte nexthead = (head + 1) & (MORSE_QUEUE_SIZE - 1);
+      while (nexthead == tail) Update();    //Drain it to make room
+      queue[head] = e;
+      head = nexthead;
+    }
+
+    bool MorseSender::isBusy (void)
+    {
+      return (head != tail || element != MORSE_IDLE);
+    }
+
+    void MorseSender::Wait (void) //Block until everything queued has been sent
+    {
+      while (isBusy()) Update();
+    }
+
+//////////////////////////////////////////////////////////////
+//Sets the LED for the given step of the current element.
+//Returns false once the element has no more steps.
+//Timings are the same as the original blocking version.
+//////////////////////////////////////////////////////////////
+
+    bool MorseSender::StartStep (unsigned long now)
+    {
+      byte level = LOW;
+      switch (element)
+      {
+        case MORSE_DOT:
+          if (step > 1) return false;
+          level = (step == 0) ? HIGH : LOW;
+          stepLength = (step == 0) ? 1 * tempo : 3 * tempo;
+        break;
+
+        case MORSE_DASH:
+          if (step > 1) return false;
+          level = (step == 0) ? HIGH : LOW;
+          stepLength = (step == 0) ? 5 * tempo : 3 * tempo;
+        break;
+
+        case MORSE_CHARGAP:
+          if (step > 0) return false;
+          stepLength = 3 * tempo;
+        break;
+
+        case MORSE_WORDGAP:
+          if (step > 0) return false;
+          stepLength = 6 * tempo;
+        break;
+
+        case MORSE_BLIP:    //20 flashes of 25ms on/off then a 250ms pause
+          if (step > 40) return false;
+          level = (step < 40 && (step & 1) == 0) ? HIGH : LOW;
+          stepLength = (step < 40) ? 25 : 250;
+        break;
+
+        case MORSE_FRAME:   //The burst, as long as the interrupt takes, then a gap
+          if (step > 1) {frameLength = 0; return false;}
+          stepLength = (step == 0) ? 0 : OPTICAL_GAP_MS;
+          if (step == 0) StartBurst();
+        break;
+
+        default:
+          return false;
+      }
+      digitalWrite(LEDPIN, level);
+      stepStart = now;
+      return true;
+    }
+
+//////////////////////////////////////////////////////////////
+//Advance the LED state machine. Cheap to call often, it only
+//does anything when the current step has run its time.
+//////////////////////////////////////////////////////////////
+
+    void MorseSender::Update (void)
+    {
+      unsigned long now = millis();
+      if (element != MORSE_IDLE)
+      {
+        if (bursting == this) return;    //The interrupt has the LED
+        if ((now - stepStart) < stepLength) return;
+        step++;
+      }
+      while (true)
+      {
+        if (element == MORSE_IDLE)
+        {
+          if (head == tail) return;   //Nothing waiting
+          element = queue[tail];
+          tail = (tail + 1) & (MORSE_QUEUE_SIZE - 1);
+          step = 0;
+        }
+        if (StartStep(now)) return;
+        element = MORSE_IDLE;
+      }
+    }
+
+//////////////////////////////////////////////////////////////
+//Moves the senders on, polled from the scheduler's indicator
+//task. Senders share the LED so only one is serviced at a time.
+//////////////////////////////////////////////////////////////
+
+    void MorseSender::Tick (void)
+    {
+      for (MorseSender *s = senders; s; s = s->next)
+      {
+        if (s->isBusy())
+        {
+          s->Update();
+          return;
+        }
+      }
+    }
+
+//////////////////////////////////////////////////////////////
+//Sending a frame. Compare A fires once every Timer0 period
+//wherever OCR0A is, so the burst doesn't move it, the second
+//charge channel uses it for the A-D trigger. A half bit is
+//OPTICAL_HALF_TICKS of them.
+//////////////////////////////////////////////////////////////
+
+    void MorseSender::StartBurst (void)
+    {
+      half = 0;
+      halfTicks = OPTICAL_HALF_TICKS - 1;     //The first half bit at the next tick
+      bursting = this;
+      TIMSK0 |= _BV(OCIE0A);
+    }
+
+    void MorseSender::BurstTick (void)
+    {
+      if (++halfTicks < OPTICAL_HALF_TICKS) return;
+      halfTicks = 0;
+      if (half >= frameLength * 16U)
+      {
+        digitalWrite(LEDPIN, LOW);
+        bursting = 0;
+        TIMSK0 &= ~_BV(OCIE0A);
+        return;
+      }
+      byte bit = (frame[half >> 4] >> ((half >> 1) & 7)) & 1;
+      digitalWrite(LEDPIN, ((half & 1) ? bit : !bit) ? HIGH : LOW);
+      half++;
+    }
+
+    void MorseSender::Interrupt (void)
+    {
+      if (bursting) bursting->BurstTick();
     }
 
+ISR(TIMER0_COMPA_vect)
+{
+  MorseSender::Interrupt();
+}
+
+//////////////////////////////////////////////////////////////
+//Morse table, one byte per character from ' ' to '_', lower
+//case letters are folded onto upper case. The elements are
+//read from the bit below the highest set bit downwards, 0 is a
+//dot and 1 a dash. The highest set bit marks the start, so a
+//byte holds up to 7 elements. 0 means there is no code, 1 (no
+//elements) is the space. MorseCode() builds them at compile
+//time from the dots and dashes so the table can be checked by eye.
+//////////////////////////////////////////////////////////////
+
+constexpr byte MorseCode (const char *p, byte code = 1)
+{
+  return (*p ? MorseCode(p + 1, (code << 1) | (*p == '-')) : code);
+}
+
+#define MORSE_FIRST ' '
+#define MORSE_LAST  '_'
+#define MORSE_NONE  0
+
+static const byte MorseTable[MORSE_LAST - MORSE_FIRST + 1] PROGMEM = {
+  MorseCode(""),        MorseCode("-.-.--"),  MorseCode(".-..-."),  MORSE_NONE,              //   ! " #
+  MorseCode("...-..-"), MORSE_NONE,           MorseCode(".-..."),   MorseCode(".----."),     // $ % & '
+  MorseCode("-.--."),   MorseCode("-.--.-"),  MORSE_NONE,           MorseCode(".-.-."),      // ( ) * +
+  MorseCode("--..--"),  MorseCode("-....-"),  MorseCode(".-.-.-"),  MorseCode("-..-."),      // , - . /
+  MorseCode("-----"),   MorseCode(".----"),   MorseCode("..---"),   MorseCode("...--"),      // 0 1 2 3
+  MorseCode("....-"),   MorseCode("....."),   MorseCode("-...."),   MorseCode("--..."),      // 4 5 6 7
+  MorseCode("---.."),   MorseCode("----."),   MorseCode("---..."),  MorseCode("-.-.-."),     // 8 9 : ;
+  MORSE_NONE,           MorseCode("-...-"),   MORSE_NONE,           MorseCode("..--.."),     // < = > ?
+  MorseCode(".--.-."),  MorseCode(".-"),      MorseCode("-..."),    MorseCode("-.-."),       // @ A B C
+  MorseCode("-.."),     MorseCode("."),       MorseCode("..-."),    MorseCode("--."),        // D E F G
+  MorseCode("...."),    MorseCode(".."),      MorseCode(".---"),    MorseCode("-.-"),        // H I J K
+  MorseCode(".-.."),    MorseCode("--"),      MorseCode("-."),      MorseCode("---"),        // L M N O
+  MorseCode(".--."),    MorseCode("--.-"),    MorseCode(".-."),     MorseCode("..."),        // P Q R S
+  MorseCode("-"),       MorseCode("..-"),     MorseCode("...-"),    MorseCode(".--"),        // T U V W
+  MorseCode("-..-"),    MorseCode("-.--"),    MorseCode("--.."),    MORSE_NONE,              // X Y Z [
+  MORSE_NONE,           MORSE_NONE,           MORSE_NONE,           MorseCode("..--.-"),     // \ ] ^ _
+};
+
     void MorseSender::SendLetter (byte letter)  //This is where the action happens.
     {
       
 #ifdef DEBUG
       Serial.println((char)letter);
 #endif
-        if (letter == 'a' or letter == 'A') {dot(); dash();charGap();}
-        if (letter == 'b' or letter == 'B') {dash(); dot(); dot(); dot();charGap();}
-        if (letter == 'c' or letter == 'C') {dash(); dot(); dash(); dot();charGap();}
-        if (letter == 'd' or letter == 'D') {dash(); dot(); dot();charGap();}
-        if (letter == 'e' or letter == 'E') {dot();charGap();}
-        if (letter == 'f' or letter == 'F') {dot(); dot(); dash(); dot();charGap();}
-        if (letter == 'g' or letter == 'G') {dash(); dash(); dot();charGap();}
-        if (letter == 'h' or letter == 'H') {dot(); dot(); dot(); dot();charGap();}
-        if (letter == 'i' or letter == 'I') {dot(); dot();charGap();}
-        if (letter == 'j' or letter == 'J') {dot(); dash(); dash(); dash();charGap();}
-        if (letter == 'k' or letter == 'K') {dash(); dot(); dash();charGap();}
-        if (letter == 'l' or letter == 'L') {dot(); dash(); dot(); dot();charGap();}
-        if (letter == 'm' or letter == 'M') {dash(); dash();charGap();}
-        if (letter == 'n' or letter == 'N') {dash(); dot();charGap();}
-        if (letter == 'o' or letter == 'O') {dash(); dash(); dash();charGap();}
-        if (letter == 'p' or letter == 'P') {dot(); dash(); dash(); dot();charGap();}
-        if (letter == 'q' or letter == 'Q') {dash(); dash(); dot(); dash();charGap();}
-        if (letter == 'r' or letter == 'R') {dot(); dash(); dot();charGap();}
-        if (letter == 's' or letter == 'S') {dot(); dot(); dot();charGap();}
-        if (letter == 't' or letter == 'T') {dash();charGap();}
-        if (letter == 'u' or letter == 'U') {dot(); dot(); dash();charGap();}
-        if (letter == 'v' or letter == 'V') {dot(); dot(); dot(); dash();charGap();}
-        if (letter == 'w' or letter == 'W') {dot(); dash(); dash();charGap();}
-        if (letter == 'x' or letter == 'X') {dash(); dot(); dot(); dash();charGap();}
-        if (letter == 'y' or letter == 'Y') {dash(); dot(); dash(); dash();charGap();}
-        if (letter == 'z' or letter == 'Z') {dash(); dash(); dot(); dot();charGap();}
-        if (letter == '1') {dot(); dash(); dash(); dash(); dash();charGap();}
-        if (letter == '2') {dot(); dot(); dash(); dash(); dash();charGap();}
-        if (letter == '3') {dot(); dot(); dot(); dash(); dash();charGap();}
-        if (letter == '4') {dot(); dot(); dot(); dot(); dash();charGap();}
-        if (letter == '5') {dot(); dot(); dot(); dot(); dot();charGap();}
-        if (letter == '6') {dash(); dot(); dot(); dot(); dot();charGap();}
-        if (letter == '7') {dash(); dash(); dot(); dot(); dot();charGap();}
-        if (letter == '8') {dash(); dash(); dash(); dot(); dot();charGap();}
-        if (letter == '9') {dash(); dash(); dash(); dash(); dot();charGap();}
-        if (letter == '0') {dash(); dash(); dash(); dash(); dash();charGap();}
-        if (letter == '.') {charGap();dot(); dash(); dot(); dash(); dot();dash();charGap();charGap();}  //Extra Gap in the front, seems to make it easier to read
-        if (letter == '?') {charGap();dot(); dot(); dash(); dash(); dot();dot();charGap();charGap();}   //Extra Gap in the front, seems to make it easier to read
-        if (letter == ' ') {wordGap();}                        
- }
+      if (letter >= 'a' && letter <= 'z') letter -= 'a' - 'A';
+      if (letter < MORSE_FIRST || letter > MORSE_LAST) return;
+      byte code = pgm_read_byte(&MorseTable[letter - MORSE_FIRST]);
+      if (code == MORSE_NONE) return;
+      if (code == 1) {wordGap(); return;}   //Space
+
+      //Punctuation gets an extra gap either side, seems to make it easier to read
+      bool punctuation = (letter < '0' || (letter > '9' && letter < 'A') || letter > 'Z');
+      if (punctuation) charGap();
 
+      byte bit = 0x80;
+      while (!(code & bit)) bit >>= 1;    //Find the start marker
+      for (bit >>= 1; bit; bit >>= 1)
+      {
+        if (code & bit) dash();
+        else dot();
+      }
+      charGap();
+      if (punctuation) charGap();
+    }
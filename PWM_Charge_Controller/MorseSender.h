@@ -3,28 +3,82 @@
 //  28 APRIL 2018, GARETH DAVIES
 //  Morse Sender Class implements a way to send a single letter using an LED Pin
 //  Assignment.
+//
+//  Letters are broken down into elements (dot, dash, gaps) and queued in a small ring
+//  buffer, the LED is then driven by Tick(), which the sketch's indicator task calls every
+//  INDICATOR_PERIOD, or Update() for one sender. Sending no longer holds up the caller.
+//  Characters are looked up in a bit-packed table in flash (see MorseSender.cpp), letters,
+//  digits and the ITU punctuation. Anything without a code is skipped.
+//
+//  SendFrame() queues a burst for a machine instead, a frame of bytes Manchester coded on the
+//  same LED at a few hundred bits a second, read with a photodiode or a high speed camera
+//  (host/OpticalDecode.cpp). It waits its turn in the queue like a letter. The bits are too
+//  short for the millis() steps, so they are clocked by the Timer0 compare A interrupt, which
+//  is only enabled for the length of the burst.
+//
+//  A frame is OPTICAL_PREAMBLE twice, OPTICAL_START, the payload length, the payload and the
+//  LinkCRC (SerialLink.h) of the length and payload, low byte first. Bytes go least
+//  significant bit first, a 1 is LED off then on, a 0 on then off (IEEE 802.3). The preamble
+//  is a square wave to lock on to, the LED is off either side of the frame.
+//  Timer0 stops while the board is powered down, so a frame going then is cut in two and
+//  fails its CRC.
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 //#ifndef MorseSenderLib
 
+#define MORSE_QUEUE_SIZE 64   //Number of queued elements, must be a power of 2
+
+#define OPTICAL_HALF_TICKS   2    //Timer0 ticks (1.024ms) a half bit, 244 bits a second. 8 for a 240fps camera
+#define OPTICAL_MAX_PAYLOAD 16
+#define OPTICAL_PREAMBLE  0x55    //Sent twice
+#define OPTICAL_START     0x7E
+#define OPTICAL_GAP_MS      50    //LED off after a frame, before whatever is next
+#define OPTICAL_FRAME (OPTICAL_MAX_PAYLOAD + 6)
+
 class MorseSender {
   public:
    int tempo;
     MorseSender(void);
     MorseSender(int ledpin);
-    void SendString(String);
+    void SendString(const char *);
     void SendLetter(byte letter);
     void StartTX(void);
     void Flash(void);
     void Blip(void);
+    bool SendFrame(const byte *payload, byte len);
+    void Update(void);
+    bool isBusy(void);
+    void Wait(void);
+    static void Tick(void);
+    static void Interrupt(void);
 
   private:
     int LEDPIN;
+    volatile byte queue[MORSE_QUEUE_SIZE];
+    volatile byte head;           //Written by the sender
+    volatile byte tail;           //Written by Update()
+    volatile byte element;        //Element currently on the LED
+    byte step;                    //Position within the current element
+    unsigned long stepStart;
+    unsigned int stepLength;
+    MorseSender *next;            //All senders are chained so Tick() can service them
+    static MorseSender *senders;
+    byte frame[OPTICAL_FRAME];    //The frame being sent, one at a time
+    volatile byte frameLength;    //Bytes in it, 0 once it has gone
+    volatile unsigned int half;   //Half bits of it sent
+    volatile byte halfTicks;
+    static MorseSender *volatile bursting;    //Has the interrupt sending its frame
+
+    void Init(int ledpin);
+    void Queue(byte);
+    bool StartStep(unsigned long now);
+    void StartBurst(void);
+    void BurstTick(void);
     void dot (void);
     void dash (void);
     void charGap(void);
     void wordGap(void);
-    
+
 };
 
 //#endif
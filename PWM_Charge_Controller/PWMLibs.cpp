@@ -3,18 +3,25 @@
 #include <Arduino.h>
 #include "PWMLibs.h"
 #include "MorseSender.h"
-MorseSender CC_Morse(13); //This is a cludge because I cannot figure out how to pass the global Morse either in a constructor or just use the global
+#include "ADCSampler.h"
+#include "Format.h"
+#include "SerialLink.h"   //Stops DEBUG being built with the serial link on
+#include "Probe.h"
 
 /*  28th April 2018
  *  Gareth Davies
  *  
- *  Library implements three classes 
+ *  Library implements four classes 
  *  
  *  ChargePumpPWM sets up the anti-phase PWM for the on-board charge pump, required to get high
  *  side MOSFET firing.
  *  
  *  VoltageSensor includes the logic for voltage dividers so it reports converted voltage
  *  Also makes raw A->D reading and voltage on the low-side of the POT if needed
+ *
+ *  TemperatureSensor reads an NTC thermistor on the battery for the setpoint compensation
+ *
+ *  CurrentSensor reads the charge current from a shunt and sense amplifier, for the EnergyMeter
  */
 
 
@@ -22,28 +29,30 @@ MorseSender CC_Morse(13); //This is a cludge because I cannot figure out how to
 // Class ChargePumpPWM
 //////////////////////////////////////////////////////////////////////////////////////////////
 
-  ChargePumpPWM::ChargePumpPWM (int OutputA, int OutputB)
+//The original hand set registers, 117/137 at prescale 1, must still come out of the sums
+#if F_CPU == 16000000UL
+static_assert(ChargePumpStep(31372) == 0, "31.4kHz should be Timer2 prescale 1");
+static_assert(ChargePumpOCRA(0, 1250) == 117 && ChargePumpOCRB(0, 1250) == 137,
+              "1.25us dead time at prescale 1 should give the original 117/137");
+#endif
+
+  ChargePumpPWM::ChargePumpPWM (int OutputA, int OutputB, unsigned long hz, unsigned int deadNs)
     {
       /////////////////////////////////////////////////
       //  Set up the PWM inverting pins and frequency
       //  Based on tutorial from Julian Ilett 
       //  https://www.youtube.com/watch?v=D826h-YQun4
       /////////////////////////////////////////////////
-      OutA = OutputA;
+      OutA = OutputA;   //Timer2 OC2A and OC2B, see ChargePumpPins()
       OutB = OutputB;
+      Step = ChargePumpStep(hz);
+      DeadNs = deadNs;
+      Running = false;
 
-      //
-      //This bit of code is hardcoded to pins 11 and 3 across the timer.
-      //So it  means that passing the pins as parameters doesn't make a lot of sense
-      //
-      
-      TCCR2A = TCCR2A | 0x30; //This sets bits 4&5 to 1 which puts the time 2 
-                          //Into inverting mode.
-                          //Timer 2 controls pins 11 and 3. 11 Being on A, and 3 on B
-      TCCR2B = TCCR2B & 0xF8 | 0x1; // Max frequency, of about 30Khz.
-         
       pinMode(OutA,OUTPUT);
       pinMode(OutB,OUTPUT);  
+      digitalWrite(OutA,LOW);
+      digitalWrite(OutB,LOW);
       #ifdef DEBUG
         Serial.print("Pump Charge PWM Signal Establised on Pins");
         Serial.print(OutA);
@@ -52,23 +61,70 @@ MorseSender CC_Morse(13); //This is a cludge because I cannot figure out how to
       #endif
     };
 
+    //Program Timer2 from Step and DeadNs. The compare registers are
+    //buffered to TOP so a change while running doesn't glitch.
+    void ChargePumpPWM::Load (void)
+    {
+       OCR2A = ChargePumpOCRA(Step, DeadNs);   //Less than 50% duty cycle for non overlapping
+       OCR2B = ChargePumpOCRB(Step, DeadNs);
+       TCCR2A = _BV(COM2A1) | _BV(COM2B1) | _BV(COM2B0) | _BV(WGM20);  //A normal, B inverting, phase correct
+       TCCR2B = Step + 1;                      //CS2 bits, prescale from the step
+    }
+
     void ChargePumpPWM::On (void)
     {
-       analogWrite(OutA,117);  //Less than (127) 50% duty cycle for non overlapping
-       analogWrite(OutB,137);
+       Running = true;
+       Load();
         #ifdef DEBUG
-          Serial.println("ON: Pump Charge PWM Signal turned on");
+          Serial.print("ON: Pump Charge PWM Signal turned on ");
+          Serial.print(Frequency());
+          Serial.println("Hz");
         #endif
     }
 
      void  ChargePumpPWM::Off (void)
     {
-       analogWrite(OutA,0);  //Sets output low
-       analogWrite(OutB,255);  //Sets output low (NB It's inverting)
+       Running = false;
+       TCCR2A = _BV(WGM20);     //Disconnect both outputs, the pins go back to the port
+       TCCR2B = 0;              //and stop the timer
+       digitalWrite(OutA,LOW);
+       digitalWrite(OutB,LOW);
        #ifdef DEBUG
           Serial.println("OFF: Pump Charge PWM Signal turned OFF");
        #endif
     }
+
+    bool ChargePumpPWM::isOn (void)
+    {
+       return (Running);
+    }
+
+    //Nearest available frequency to hz
+    void ChargePumpPWM::SetFrequency (unsigned long hz)
+    {
+       Step = ChargePumpStep(hz);
+       if (Running) Load();
+    }
+
+    //Move up (direction > 0) or down a prescaler step, returns the new frequency
+    unsigned long ChargePumpPWM::StepFrequency (int direction)
+    {
+       if (direction > 0 && Step > 0) Step--;
+       if (direction < 0 && Step < CHARGEPUMP_STEPS - 1) Step++;
+       if (Running) Load();
+       return (Frequency());
+    }
+
+    unsigned long ChargePumpPWM::Frequency (void)
+    {
+       return (ChargePumpStepHz(Step));
+    }
+
+    void ChargePumpPWM::SetDeadTime (unsigned int deadNs)
+    {
+       DeadNs = deadNs;
+       if (Running) Load();
+    }
 ///////////////////////////////////////////////////////////////////////////////////////////////
 //END Class ChargePumpPWM
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -87,11 +143,13 @@ VoltageSensor::VoltageSensor (int Pin, int HighR, int LowR)
   Highside = HighR;
   Lowside = LowR;
 
-  //This determines calculates the voltage seen across the Potential Divider
-  AcrossLowR =   (float)Lowside / ((float)Lowside+(float)Highside);
-
-  LowRangeConvRatio = 1023 / 5.0;    //This is the ratio that will be needed to convert back to volts from a 0-1023 A-D scale
-  FullRangeConvRatio = 1023 / ( 5.0 / AcrossLowR) ;     //This is the ratio for the full voltage
+  //This is the fixed point ratio that converts from a 0-1023 A-D reading to millivolts
+  //at the top of the Potential Divider
+  FullScaleQ16 = VoltageScaleQ16(Highside, Lowside);
+  FullScaledmV = 0;
+  LowmV = 0;
+  ADReading = 0;
+  Sampler = 0;
 
    #ifdef DEBUG
     Report();
@@ -105,6 +163,14 @@ VoltageSensor::VoltageSensor (int Pin, int HighR, int LowR)
 //Method for reporting on the Serial port the parameters of this instance
 //useful for debugging or when developing hardware
 //////////////////////////////////////////////////////////////
+//For a divider that isn't known until the charge profile is read
+void VoltageSensor::SetDivider (int HighR, int LowR)
+{
+  Highside = HighR;
+  Lowside = LowR;
+  FullScaleQ16 = VoltageScaleQ16(Highside, Lowside);
+}
+
 void VoltageSensor::Report()
 {
     Serial.print("\n****Voltage Sensor Initialised : Pin ");
@@ -113,10 +179,10 @@ void VoltageSensor::Report()
     Serial.print(Highside);
     Serial.print(" L:");
     Serial.print(Lowside);
-    Serial.print(" Lowside Conversion:");
-    Serial.print(LowRangeConvRatio);
-    Serial.print(" FullS Conversion:");
-    Serial.println(FullRangeConvRatio);
+    Serial.print(" Lowside Q16:");
+    Serial.print(LOWRANGE_SCALE_Q16);
+    Serial.print(" FullS Q16:");
+    Serial.println(FullScaleQ16);
 }
 
 //////////////////////////////////////////////////////////////
@@ -125,39 +191,67 @@ void VoltageSensor::Report()
 //of the class. Especially if reading in the presence of a PWM
 //Waveform that is halted prior to taking the reading.
 //Saves too many interuptions
+//Scaling is a 32 bit multiply and shift, rounded to nearest mV
+//
+//When a sampler is attached the reading is the result of its
+//last scan, the caller is expected to have run ADCSampler::Acquire
+//That result has 6 fractional bits, so the scale factors are
+//cut down by the same to stay inside 32 bits.
 //////////////////////////////////////////////////////////////
 
 void VoltageSensor::takeReading (void)
 {
-  ADReading = analogRead(Readpin);
-  LowR = ADReading / LowRangeConvRatio; 
-  FullScaledReading = ADReading / FullRangeConvRatio;
+  PROBE(PROBE_READING);
+  if (Sampler)
+  {
+    unsigned int Q6 = Sampler->Result(SamplerChannel);
+    ADReading = Q6 >> 6;
+    LowmV = ((unsigned long)Q6 * (LOWRANGE_SCALE_Q16 >> 6) + 0x8000) >> 16;
+    FullScaledmV = ((unsigned long)Q6 * (FullScaleQ16 >> 6) + 0x8000) >> 16;
+  }
+  else
+  {
+    ADReading = analogRead(Readpin);
+    LowmV = ((unsigned long)ADReading * LOWRANGE_SCALE_Q16 + 0x8000) >> 16;
+    FullScaledmV = ((unsigned long)ADReading * FullScaleQ16 + 0x8000) >> 16;
+  }
   
   #ifdef DEBUG
     Serial.print("Voltage Reading Taken: Pin ");
     Serial.print(Readpin);
     Serial.print(" AD Value ");
     Serial.print(ADReading);
-    Serial.print(" Full V ");
-    Serial.print(FullScaledReading);
-    Serial.print("V across divider ");
-    Serial.print(LowR);
-    Serial.println("V");
+    Serial.print(" Full ");
+    Serial.print(FullScaledmV);
+    Serial.print("mV across divider ");
+    Serial.print(LowmV);
+    Serial.println("mV");
   #endif
 }
 
 
+//////////////////////////////////////////////////////////////
+//Take readings from a sampler channel rather than analogRead,
+//scanned with the rest of the group
+//////////////////////////////////////////////////////////////
+
+void VoltageSensor::UseSampler (ADCSampler *S, byte oversampleBits, byte filterShift, byte group)
+{
+  SamplerChannel = S->AddChannel(Readpin, oversampleBits, filterShift, group);
+  if (SamplerChannel != SAMPLER_NONE) Sampler = S;     //Else analogRead(), as without one
+}
+
 float VoltageSensor::volts (void)
 {
   takeReading();
-  return (FullScaledReading);
+  return (FullScaledmV * 0.001);
 }
 
 float VoltageSensor::LowReading (void)
 
 {
   takeReading();
-  return (LowR); 
+  return (LowmV * 0.001); 
 }
 
 int VoltageSensor::ADValue (void)
@@ -166,16 +260,174 @@ int VoltageSensor::ADValue (void)
   return (ADReading);
 }
 
+unsigned int VoltageSensor::milliVolts (void)
+{
+  takeReading();
+  return (FullScaledmV);
+}
+
+unsigned int VoltageSensor::LowMilliVolts (void)
+{
+  takeReading();
+  return (LowmV);
+}
+
+unsigned int VoltageSensor::LastMilliVolts (void)  //No new reading, just what was seen last time
+{
+  return (FullScaledmV);
+}
+
+//The last sampler scan without the filter, for when the conditions have just changed
+//(the panel going from loaded to open). The same as LastMilliVolts() without a sampler.
+unsigned int VoltageSensor::SpotMilliVolts (void)
+{
+  if (!Sampler) return (FullScaledmV);
+  return (((unsigned long)Sampler->Latest(SamplerChannel) * (FullScaleQ16 >> 6) + 0x8000) >> 16);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 //END Class VoltageSensor
 //////////////////////////////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  TemperatureSensor Class
+//  NTC thermistor in a divider, see PWMLibs.h
+//
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#define KELVIN_25 298.15
+
+TemperatureSensor::TemperatureSensor (int Pin, unsigned int fixedR, unsigned int r25, unsigned int beta)
+{
+  Readpin = Pin;
+  FixedR = fixedR;
+  R25 = r25;
+  Beta = beta;
+  Tenths = TEMP_NONE;
+  Sampler = 0;
+}
+
+void TemperatureSensor::UseSampler (ADCSampler *S, byte oversampleBits, byte filterShift, byte group)
+{
+  SamplerChannel = S->AddChannel(Readpin, oversampleBits, filterShift, group);
+  if (SamplerChannel != SAMPLER_NONE) Sampler = S;     //Else analogRead(), as without one
+}
+
+//////////////////////////////////////////////////////////////
+//The thermistor's resistance from the divider ratio, then the
+//Beta equation. Q6 is the A-D reading with 6 fractional bits,
+//out of 1024 x 64 as the top of the divider is the reference.
+//////////////////////////////////////////////////////////////
+
+void TemperatureSensor::takeReading (void)
+{
+  unsigned int Q6 = Sampler ? Sampler->Result(SamplerChannel) : analogRead(Readpin) << 6;
+  if (Q6 > NTC_OPEN_Q6 || Q6 < NTC_SHORT_Q6)
+  {
+    Tenths = TEMP_NONE;
+    return;
+  }
+  float r = (float)FixedR * Q6 / (65536UL - Q6);
+  float kelvin = 1.0 / (1.0 / KELVIN_25 + log(r / R25) / Beta);
+  Tenths = (int)floor((kelvin - 273.15) * 10 + 0.5);
+
+  #ifdef DEBUG
+    Serial.print("Temperature Reading Taken: Pin ");
+    Serial.print(Readpin);
+    Serial.print(" AD Value ");
+    Serial.print(Q6 >> 6);
+    Serial.print(" Tenths C ");
+    Serial.println(Tenths);
+  #endif
+}
+
+int TemperatureSensor::Celsius10 (void)
+{
+  takeReading();
+  return (Tenths);
+}
+
+int TemperatureSensor::LastCelsius10 (void)  //No new reading, just what was seen last time
+{
+  return (Tenths);
+}
+
+bool TemperatureSensor::isPresent (void)
+{
+  return (Tenths != TEMP_NONE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class TemperatureSensor
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  CurrentSensor Class
+//  Shunt and sense amplifier, see PWMLibs.h
+//
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CurrentSensor::CurrentSensor (int Pin, unsigned int shuntmOhm, unsigned int gain, unsigned int offsetmV)
+{
+  Readpin = Pin;
+  ScaleQ16 = CurrentScaleQ16(shuntmOhm, gain);
+  OffsetQ6 = ((unsigned long)offsetmV * 1023 * 64 + ADC_REF_MV / 2) / ADC_REF_MV;
+  MilliAmps = 0;
+  Sampler = 0;
+}
+
+void CurrentSensor::UseSampler (ADCSampler *S, byte oversampleBits, byte filterShift, byte group)
+{
+  SamplerChannel = S->AddChannel(Readpin, oversampleBits, filterShift, group);
+  if (SamplerChannel != SAMPLER_NONE) Sampler = S;     //Else analogRead(), as without one
+}
+
+//////////////////////////////////////////////////////////////
+//As VoltageSensor::takeReading(), less the amplifier's offset
+//first. Without a sampler a single analogRead lands anywhere
+//in the waveform, it is only right with the charge off or full on.
+//////////////////////////////////////////////////////////////
+
+void CurrentSensor::takeReading (void)
+{
+  PROBE(PROBE_CURRENT);
+  unsigned int Q6 = Sampler ? Sampler->Result(SamplerChannel) : analogRead(Readpin) << 6;
+  Q6 = (Q6 > OffsetQ6) ? Q6 - OffsetQ6 : 0;
+  MilliAmps = ((unsigned long)Q6 * (ScaleQ16 >> 6) + 0x8000) >> 16;
+
+  #ifdef DEBUG
+    Serial.print("Current Reading Taken: Pin ");
+    Serial.print(Readpin);
+    Serial.print(" AD Value ");
+    Serial.print(Q6 >> 6);
+    Serial.print(" mA ");
+    Serial.println(MilliAmps);
+  #endif
+}
+
+unsigned int CurrentSensor::milliAmps (void)
+{
+  takeReading();
+  return (MilliAmps);
+}
+
+unsigned int CurrentSensor::LastMilliAmps (void)  //No new reading, just what was seen last time
+{
+  return (MilliAmps);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class CurrentSensor
+//////////////////////////////////////////////////////////////////////////////////////////////
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 //
 //  ChargePWM Class
 //  This is for generating the PWM waveform to control the charger.
-//  It has three modes of operation, including a built in Hysterisis mode 
-//  In the standard PWM generator.
+//  It has four modes of operation, including a built in Hysterisis mode 
+//  In the standard PWM generator, and a Regulate mode where the duty is set by the caller.
 //
 //
 //  This class can be modified to make the most rapid charge possible in HardOn mode here it
@@ -184,45 +436,47 @@ int VoltageSensor::ADValue (void)
 //
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-        ChargePWM::ChargePWM (int InPin)
+        ChargePWM::ChargePWM (PWMOutput &output, int InPin, unsigned long hz) : Driver(output)
+        {
+          PWMPin = InPin;   //Must be the output's pin, kept so the sketch says which pin it is using
+          Frequency = hz;
+          if (PWMPin >= 0)
+          {
+            pinMode(PWMPin,OUTPUT);
+            digitalWrite(PWMPin,LOW);
+          }
+          state = PWM_OFF;    //Charge is off in initial state
+          PulseWidth = 0;
+          Indicator = 0;      //Silent until given one
+        }
+
+        //Call from setup(), the core's init() takes the timers over after the constructors have run
+        void ChargePWM::Begin (void)
         {
-          PWMPin = InPin;
-          pinMode(PWMPin,OUTPUT);
-          state = 0;    //Charge is off in initial state
-          analogWrite (PWMPin,0);    
+          Driver.Begin(Frequency);
+          ImplementWaveForm(state);
+  #ifdef DEBUG
+    Serial.print("Charge PWM ");
+    Serial.print(Driver.Frequency());
+    Serial.print("Hz, duty 0-");
+    Serial.println(Driver.Top());
+  #endif
         }
         
         void ChargePWM::ImplementWaveForm (int desiredState)
         {
+          PROBE(PROBE_WAVEFORM);
           switch (desiredState)
           {
-              case 0: // Turn off
+              case PWM_OFF:
                   PulseWidth =0;
-                  analogWrite (PWMPin,PulseWidth);
-                  state=0;
-        
-  #ifdef DEBUG
-    Serial.print("Charger Mode: ");
-    Serial.print(state);
-    Serial.print(" Selected PWM Value ");
-    Serial.println(PulseWidth);
-  #endif
               break;
 
-              case 2: // Do Hard On
-                PulseWidth=255;
-                analogWrite (PWMPin,PulseWidth);
-                state=2;
-                
-   #ifdef DEBUG
-    Serial.print("Charger Mode: ");
-    Serial.print(state);
-    Serial.print(" Selected PWM Value ");
-    Serial.println(PulseWidth);
-  #endif
+              case PWM_HARDON:
+                PulseWidth=Driver.Top();
               break;
               
-              case 1: 
+              case PWM_TRICKLE: 
                  /*
                   * This is smart trickle
                   * Tune the VoltageGap divisor value to modify the dynamic range of the PWM signal.
@@ -235,35 +489,45 @@ int VoltageSensor::ADValue (void)
                   * 
                   */
                   //PulseWidth= (int) (255 * (VoltageGap/1.2) ); 
-                  PulseWidth= (int) (255 * VoltageGap );
-                  
-                  if (PulseWidth < 0) PulseWidth=0;     //Limit the PWM bottom end
-                  if (PulseWidth > 255) PulseWidth=255; //Limit the PWM top end
-                  state=1;
-                  analogWrite(PWMPin,PulseWidth);
-                  
-   #ifdef DEBUG
+                  if (VoltageGap < 0) VoltageGap=0;     //Limit the PWM bottom end
+                  if (VoltageGap > 1) VoltageGap=1;     //Limit the PWM top end
+                  PulseWidth= (unsigned int) (Driver.Top() * VoltageGap );
+              break;     
+
+              case PWM_REGULATE: // Regulate, the duty has been worked out by the caller (e.g. the PI controller)
+                  if (PulseWidth > Driver.Top()) PulseWidth=Driver.Top();
+              break;
+          }
+          state=desiredState;
+          if (PulseWidth == Driver.Read()) return;    //Same as it is, leave the timer alone
+          Driver.Write(PulseWidth);
+
+  #ifdef DEBUG
     Serial.print("Charger Mode: ");
     Serial.print(state);
-    Serial.print(" Voltage Difference ");
-    Serial.print(VoltageGap);
     Serial.print(" Selected PWM Value ");
     Serial.println(PulseWidth);
   #endif
-              break;     
-          }
         }
 
+        //Status reports are dropped while the LED is still busy with the last one,
+        //so the indicator never holds up the charge loop.
+
+        void ChargePWM::UseIndicator (MorseSender *indicator)
+        {
+          Indicator = indicator;
+        }
+        
         void ChargePWM::chargeHardOn (void)
         {
-          ImplementWaveForm (2);
-          CC_Morse.SendString("n");
+          ImplementWaveForm (PWM_HARDON);
+          if (Indicator && !Indicator->isBusy()) Indicator->SendString("n");
         }
         
         void ChargePWM::chargeOff (void)
         {
-         ImplementWaveForm(0);
-         CC_Morse.SendString("f");
+         ImplementWaveForm(PWM_OFF);
+         if (Indicator && !Indicator->isBusy()) Indicator->SendString("f");
         }
 
         void ChargePWM::chargeOff (bool reporter)
@@ -273,47 +537,159 @@ int VoltageSensor::ADValue (void)
           chargeOff();
           return;
          }
-          ImplementWaveForm(0);
+          ImplementWaveForm(PWM_OFF);
         }
         
         void ChargePWM::chargeTrickle (float VG)
         {
           VoltageGap=VG;
-          ImplementWaveForm(1);
-          CC_Morse.Blip();
-          CC_Morse.SendString((String)PulseWidth);
+          ImplementWaveForm(PWM_TRICKLE);
+          ReportDuty();
         }
         
+        void ChargePWM::chargeRegulate (int duty)
+        {
+          PulseWidth = (duty < 0) ? 0 : duty;
+          ImplementWaveForm(PWM_REGULATE);
+          ReportDuty();
+        }
+        
+        //Duty on the LED, as 0-255 whatever the timer's resolution
+        void ChargePWM::ReportDuty (void)
+        {
+          if (!Indicator || Indicator->isBusy()) return;
+          Indicator->Blip();
+          char text[FORMAT_BUFFER];
+          Indicator->SendString(FormatInt(text, ((unsigned long)PulseWidth * 255 + Driver.Top() / 2) / Driver.Top()));
+        }
+
+        //Output off, the mode and duty are kept for Resume(). For readings at full on,
+        //and through a pause so charging carries on from where it was.
         void ChargePWM::Suspend (void)
         {
-          statestore=state;
-          chargeOff(false);
+          Driver.Write(0);
         }
         
         void ChargePWM::Resume (void)
         {
-          ImplementWaveForm(statestore);
+          Driver.Write(PulseWidth);
+        }
+        
+        //Mode and duty from before a reset, put on the output by the next Resume()
+        void ChargePWM::Restore (int mode, unsigned int pulse)
+        {
+          state = (mode >= PWM_OFF && mode <= PWM_REGULATE) ? mode : PWM_OFF;
+          PulseWidth = (pulse > Driver.Top()) ? Driver.Top() : pulse;
         }
         
         bool ChargePWM::isTrickle(void)
         {
-          if ( state == 1) return true;
+          if ( state == PWM_TRICKLE) return true;
+          return false;
+        }
+        
+        bool ChargePWM::isRegulating(void)
+        {
+          if (state == PWM_REGULATE) return true;
           return false;
         }
         
         bool ChargePWM::isOff(void)
         {
-          if (state == 0) return true;
+          if (state == PWM_OFF) return true;
           return false;
         }
         
         bool ChargePWM::isHardOn(void)
         {
-          if (state == 2) return true;
+          if (state == PWM_HARDON) return true;
           return false;
         }
+
+        //PWM_OFF, PWM_TRICKLE, PWM_HARDON or PWM_REGULATE
+        int ChargePWM::State(void)
+        {
+          return state;
+        }
+
+        //What is on the output, 0 while suspended
+        unsigned int ChargePWM::Duty(void)
+        {
+          return Driver.Read();
+        }
+
+        //The duty it is set to, the same as Duty() unless suspended
+        unsigned int ChargePWM::Pulse(void)
+        {
+          return PulseWidth;
+        }
+
+        unsigned int ChargePWM::DutyMax(void)
+        {
+          return Driver.Top();
+        }
+
+        //True if the waveform is switching with a long enough low period for the
+        //ADCSampler to take in-phase readings. Off needs no suspending anyway,
+        //Hard On has no low period so must be suspended to read the battery.
+        bool ChargePWM::canSampleInPhase(void)
+        {
+          return ((state == PWM_TRICKLE || state == PWM_REGULATE) && Driver.CanTrigger());
+        }
+
+        //ADC auto-trigger source for the ADCSampler, in phase if it can be, 0 free runs
+        byte ChargePWM::SampleTrigger(void)
+        {
+          return (canSampleInPhase() ? Driver.Trigger() : 0);
+        }
         
 ///////////////////////////////////////////////////////////////////////////////////////////////
 //END Class ChargePWM
 //////////////////////////////////////////////////////////////////////////////////////////////
 
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  PIController Class
+//  Proportional + Integral control in fixed point, used for the absorption stage to hold the
+//  battery at TARGET. Gains are Q8 (256 = 1 duty count per mV of error), Ki is per update so
+//  it depends on how often Update() is called.
+//
+//  Anti-windup is by clamping: the integral is held inside the output range, and isn't added
+//  to while the output is saturated in the direction the error is pushing it.
+//
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+PIController::PIController (int kp, int ki, int outMax)
+{
+  Kp = kp;
+  Ki = ki;
+  OutMax = outMax;
+  Integral = 0;
+}
+
+int PIController::Update (int error)
+{
+  long out = ((long)Kp * error + Integral) >> 8;
+  bool saturated = (out >= OutMax && error > 0) || (out <= 0 && error < 0);
+  if (!saturated)
+  {
+    Integral += (long)Ki * error;
+    if (Integral < 0) Integral = 0;
+    if (Integral > ((long)OutMax << 8)) Integral = (long)OutMax << 8;
+    out = ((long)Kp * error + Integral) >> 8;
+  }
+  if (out < 0) out = 0;
+  if (out > OutMax) out = OutMax;
+  return ((int)out);
+}
+
+//Preload the integral so control picks up from the given output without a jump
+void PIController::Reset (int output)
+{
+  Integral = (long)output << 8;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class PIController
+//////////////////////////////////////////////////////////////////////////////////////////////
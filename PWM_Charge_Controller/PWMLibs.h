@@ -7,17 +7,94 @@
 //  Based on tutorial from Julian Ilett 
 //  https://www.youtube.com/watch?v=D826h-YQun4
 //
+//  Two anti-phase square waves from Timer2 in 8 bit phase correct mode: OC2A (pin 11) high
+//  around BOTTOM, OC2B (pin 3) inverted so it is high around TOP. Both are set either side of
+//  the midpoint, the gap between them is the dead time, so the two never drive at once.
+//  In phase correct mode each count is prescale/F_CPU, so the register values come from the
+//  frequency and dead time asked for, worked out by the compiler when they are constants.
+//  Only the seven Timer2 prescaler frequencies are available (31.4kHz, 3.9kHz, 980Hz ...),
+//  the nearest is used. StepFrequency() moves between them at run time.
+//
+//  Timer2 is set up in On(), the core's init() runs after the constructors and would
+//  otherwise change the prescaler.
+//
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+#include "Timer1PWM.h"
+
+#define CHARGEPUMP_STEPS 7      //Timer2 prescalers 1, 8, 32, 64, 128, 256, 1024
+#define CHARGEPUMP_MID   127    //Duty midpoint the two outputs are set either side of
+
+constexpr unsigned int ChargePumpDivider (byte step)
+{
+  return (step == 0) ? 1 : (step == 1) ? 8 : (step == 2) ? 32 : (step == 3) ? 64 :
+         (step == 4) ? 128 : (step == 5) ? 256 : 1024;
+}
+
+constexpr unsigned long ChargePumpStepHz (byte step)
+{
+  return (F_CPU / (510UL * ChargePumpDivider(step)));
+}
+
+//Step nearest hz on a log scale, i.e. above the geometric mean of it and the next one down
+constexpr byte ChargePumpStep (unsigned long hz, byte step = 0)
+{
+  return (step + 1 >= CHARGEPUMP_STEPS ||
+          (float)hz * hz >= (float)ChargePumpStepHz(step) * ChargePumpStepHz(step + 1)) ? step :
+          ChargePumpStep(hz, step + 1);
+}
+
+//Dead time in counts at a step, rounded, at least 1 and no more than the midpoint allows
+constexpr unsigned long ChargePumpRoundCounts (unsigned long cycles, unsigned int divider)
+{
+  return ((cycles + divider / 2) / divider);
+}
+
+constexpr byte ChargePumpClampCounts (unsigned long counts)
+{
+  return (counts < 1) ? 1 : (counts > 2 * CHARGEPUMP_MID - 2) ? 2 * CHARGEPUMP_MID - 2 : (byte)counts;
+}
+
+constexpr byte ChargePumpDeadCounts (byte step, unsigned int deadNs)
+{
+  return ChargePumpClampCounts(ChargePumpRoundCounts((unsigned long)deadNs * (F_CPU / 1000000UL) / 1000UL,
+                                                     ChargePumpDivider(step)));
+}
+
+constexpr byte ChargePumpOCRA (byte step, unsigned int deadNs)
+{
+  return (CHARGEPUMP_MID - ChargePumpDeadCounts(step, deadNs) / 2);
+}
+
+constexpr byte ChargePumpOCRB (byte step, unsigned int deadNs)
+{
+  return (CHARGEPUMP_MID + ChargePumpDeadCounts(step, deadNs) - ChargePumpDeadCounts(step, deadNs) / 2);
+}
+
+//The pump relies on Timer2's outputs, use in a static_assert where the pins are chosen
+constexpr bool ChargePumpPins (int a, int b)
+{
+  return (a == 11 && b == 3);
+}
+
 class ChargePumpPWM {
 
   public:
-        ChargePumpPWM (int, int);
+        ChargePumpPWM (int, int, unsigned long hz, unsigned int deadNs);
         void On (void);
         void Off (void);
+        bool isOn (void);
+        void SetFrequency (unsigned long hz);
+        unsigned long StepFrequency (int direction);
+        unsigned long Frequency (void);
+        void SetDeadTime (unsigned int deadNs);
   private:
         int OutA;
         int OutB;
+        byte Step;
+        unsigned int DeadNs;
+        bool Running;
+        void Load (void);
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -31,41 +108,109 @@ class ChargePumpPWM {
 //  The theory of Lead-Acid charging is from here: 
 //  http://batteryuniversity.com/learn/article/charging_the_lead_acid_battery
 //
+//  The waveform comes from a PWMOutput, Timer1PWM phase correct on pin 9 at a set frequency
+//  or Timer0PWM on pin 5 for a second channel, so the duty runs from 0 to DutyMax() (the
+//  timer's TOP) rather than 0-255. Status reports are still scaled to 0-255 so they read the
+//  same as before.
+//
+//  Which mode to be in is up to the ChargeStateMachine, this only makes the waveform. The
+//  timer is only written when the duty changes.
+//
+//  Mode changes and the duty are reported on the MorseSender given to UseIndicator(), if any.
+//  Without one it is silent, as the host's sweep runs them. A pin below 0 isn't set up, for
+//  an output that isn't a pin.
+//
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+//Waveform modes
+#define PWM_OFF      0
+#define PWM_TRICKLE  1
+#define PWM_HARDON   2
+#define PWM_REGULATE 3
+
+class MorseSender;
+
 class ChargePWM {
   private:
-        int state;  //This provides a record of it's current charge configuration
-        int statestore;
+        int state;  //This provides a record of it's current charge configuration, PWM_xxx
         int PWMPin;
-        int PulseWidth;
+        unsigned long Frequency;
+        unsigned int PulseWidth;
         float VoltageGap;      
+        PWMOutput &Driver;
+        MorseSender *Indicator;
         void ImplementWaveForm (int desiredState);
+        void ReportDuty (void);
 
   public:
-        ChargePWM (int);
+        ChargePWM (PWMOutput &, int, unsigned long);
+        void Begin (void);
+        void UseIndicator (MorseSender *indicator);
         void chargeHardOn (void);
         void chargeOff (void);
         void chargeOff (bool);
         void chargeTrickle (float);
+        void chargeRegulate (int);
         void Suspend (void);
         void Resume (void);
+        void Restore (int mode, unsigned int pulse);
         bool isTrickle(void);
+        bool isRegulating(void);
         bool isOff(void);
         bool isHardOn(void);
+        int State(void);
+        unsigned int Duty(void);
+        unsigned int Pulse(void);
+        unsigned int DutyMax(void);
+        bool canSampleInPhase(void);
+        byte SampleTrigger(void);
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 //END Class ChargePWM
 //////////////////////////////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  PI controller for the absorption stage, fixed point, with anti-windup
+//
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+class PIController {
+  public:
+        PIController (int kp, int ki, int outMax);
+        int Update (int error);
+        void Reset (int output);
+  private:
+        int Kp;         //Q8 gains
+        int Ki;
+        int OutMax;
+        long Integral;  //Q8
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 //
 //  Class for sensing voltages from Arduino
 //  Understands the voltage divider resistors to give a scaled output
-//  Note yet implemented is a read under PWM conditions for the battery
+//  Readings can come straight from analogRead, or from an ADCSampler scan (see UseSampler)
+//  which allows oversampled, filtered readings to be taken without stopping the charge PWM.
+//
+//  Conversions are done in fixed point, millivolts = (AD * scale) >> 16, so there is no
+//  floating point divide per reading. volts() and LowReading() are kept as float wrappers.
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+#define ADC_REF_MV 5000                                       //A-D reference in millivolts
+#define LOWRANGE_SCALE_Q16 ((ADC_REF_MV * 65536UL + 511) / 1023) //A-D count to mV at the pin
+
+//Q16 factor to go from an A-D count to millivolts at the top of a divider.
+//With constant resistor values the compiler works this out, no float code at run time.
+//Keep the full scale below about 64V or AD * scale will overflow 32 bits.
+constexpr unsigned long VoltageScaleQ16 (int HighR, int LowR)
+{
+  return (unsigned long)(ADC_REF_MV * 65536.0 * ((float)HighR + (float)LowR) / (float)LowR / 1023.0 + 0.5);
+}
+
+class ADCSampler;
 
 class VoltageSensor {
 
@@ -73,20 +218,100 @@ class VoltageSensor {
           int Highside;
           int Lowside;
           int Readpin;
-          float FullScale;
-          float AcrossLowR;
-          float LowRangeConvRatio;
-          float FullRangeConvRatio;
-          float LowR;
-          float FullScaledReading;
+          unsigned long FullScaleQ16;
+          unsigned int LowmV;
+          unsigned int FullScaledmV;
           int ADReading;
+          ADCSampler *Sampler;
+          byte SamplerChannel;
 
           void takeReading(void);
    public:
           float volts (void);
           float LowReading (void);
           int ADValue (void);
+          unsigned int milliVolts (void);
+          unsigned int LowMilliVolts (void);
+          unsigned int LastMilliVolts (void);
+          unsigned int SpotMilliVolts (void);
           VoltageSensor (int ,int , int );
+          void SetDivider (int, int);
+          void UseSampler (ADCSampler *, byte oversampleBits, byte filterShift, byte group = 0);
           void Report();
 };
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Class for sensing the battery temperature with an NTC thermistor
+//  The thermistor is the low side of a divider with a fixed resistor up to the A-D reference,
+//  so the reading is a ratio and the supply drops out. Read through the same ADCSampler scan
+//  as the voltages (see UseSampler), or analogRead without one.
+//
+//  Temperature is from the Beta equation, 1/T = 1/T25 + ln(R / R25) / Beta, in tenths of a
+//  degree C. That is a float log() per reading, one every SAMPLE_PERIOD is nothing.
+//  A reading at either end of the A-D range is a thermistor open (not plugged in, the fixed
+//  resistor pulls the pin up) or shorted, and gives TEMP_NONE.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#define TEMP_NONE      -32768     //No thermistor, or a bad one
+#define NTC_OPEN_Q6  (1013 * 64)  //A-D readings, 10.6, beyond which it isn't believed
+#define NTC_SHORT_Q6   (10 * 64)
+
+class TemperatureSensor {
+
+   private:
+          int Readpin;
+          unsigned int FixedR;
+          unsigned int R25;
+          unsigned int Beta;
+          int Tenths;
+          ADCSampler *Sampler;
+          byte SamplerChannel;
+
+          void takeReading(void);
+   public:
+          TemperatureSensor (int Pin, unsigned int fixedR, unsigned int r25, unsigned int beta);
+          int Celsius10 (void);
+          int LastCelsius10 (void);
+          bool isPresent (void);
+          void UseSampler (ADCSampler *, byte oversampleBits, byte filterShift, byte group = 0);
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Class for sensing the charge current
+//  A shunt in the charge path with a current sense amplifier (INA180, INA138 or the like)
+//  taking it up to the A-D range, one way only, charge into the battery. offsetmV is the
+//  amplifier's output with no current, anything at or below it reads 0.
+//
+//  The current comes and goes with the charge waveform, so the readings have to be free
+//  running, averaged across many periods by the oversampling, not in the off part of it as
+//  the voltages are. Give it a sampler group of its own, see ChargeChannel.h.
+//
+//  Fixed point as VoltageSensor, mA = (AD * scale) >> 16.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+//Q16 factor from an A-D count to mA through a shunt of shuntmOhm and an amplifier of gain.
+//Keep shuntmOhm x gain at 100 or more (50A full scale) or AD * scale will overflow 32 bits.
+constexpr unsigned long CurrentScaleQ16 (unsigned int shuntmOhm, unsigned int gain)
+{
+  return (unsigned long)(ADC_REF_MV * 65536.0 * 1000.0 / ((float)shuntmOhm * gain) / 1023.0 + 0.5);
+}
+
+class CurrentSensor {
+
+   private:
+          int Readpin;
+          unsigned long ScaleQ16;
+          unsigned int OffsetQ6;      //offsetmV as an A-D reading, 10.6
+          unsigned int MilliAmps;
+          ADCSampler *Sampler;
+          byte SamplerChannel;
+
+          void takeReading(void);
+   public:
+          CurrentSensor (int Pin, unsigned int shuntmOhm, unsigned int gain, unsigned int offsetmV);
+          unsigned int milliAmps (void);
+          unsigned int LastMilliAmps (void);
+          void UseSampler (ADCSampler *, byte oversampleBits, byte filterShift, byte group = 0);
+};
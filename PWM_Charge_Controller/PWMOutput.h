@@ -0,0 +1,35 @@
+#ifndef PWMOutputLib
+#define PWMOutputLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  PWMOutput, what ChargePWM needs from the timer making its waveform
+//
+//  Timer1PWM on pin 9 for the first charge channel, Timer0PWM on pin 5 for a second, see
+//  ChargeChannel.h. The duty runs from 0 (off) to Top() (full on). Trigger() is the ADC
+//  auto-trigger source (ADCSRB ADTS bits) that lands in the off part of the waveform, for the
+//  ADCSampler, while CanTrigger() says there is an off part long enough to sample in.
+//
+//  Virtual, one call per duty change, so the charge code is in flash once for both timers.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define PWM_TRIGGER_TIMER0 3      //ADTS, Timer0 compare A
+#define PWM_TRIGGER_TIMER1 5      //ADTS, Timer1 compare B
+
+class PWMOutput {
+
+  public:
+        virtual void Begin (unsigned long hz) = 0;
+        virtual void Write (unsigned int duty) = 0;
+        virtual unsigned int Read (void) = 0;
+        virtual unsigned int Top (void) = 0;
+        virtual unsigned long Frequency (void) = 0;
+        virtual bool CanTrigger (void) = 0;
+        virtual byte Trigger (void) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class PWMOutput
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
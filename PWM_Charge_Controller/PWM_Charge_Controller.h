@@ -1,17 +1,83 @@
 //28th April 2018, Gareth Davies
 
 
-#define WAIT_TIME 2000 //Used in testing PWM waveform generation
+#define WAIT_TIME 2000 //Control period, the default profile's
+#define SETTLE_TIME 100 //Time for the battery to settle when the charger has to be suspended to read it
 
-#define TARGET  14.00
+//Task timings for the scheduler, all in ms. WAIT_TIME above is the control period.
+#define SAMPLE_PERIOD     500   //Voltage readings and control steps, WAIT_TIME should be a multiple of this
+#define INDICATOR_PERIOD    5   //Morse LED updates
+#define SAMPLE_DEADLINE   250   //For every channel's readings and control steps in a run
+#define SLEEP_DEADLINE   9000   //millis() stops while powered down, so only the awake part counts
+#define LINK_PERIOD       100   //Serial link commands, see SerialLink.h
+#define SUPERVISE_PERIOD 1000   //Watchdog feeding, see Supervisor.h
+#define SUPERVISE_MARGIN 2000   //Past WaitTime the control loop can be late before the watchdog is left to run out
+
+//The LED on pin 13. 1 sends a channel's readings as an optical frame (MorseSender.h) after its
+//control steps, for a photodiode or high speed camera and host/OpticalDecode.cpp. 0 is the
+//Morse a person can read: the voltages at start up, fault letters and duty reports.
+#ifndef INDICATOR_OPTICAL
+#define INDICATOR_OPTICAL 1
+#endif
+#define OPTICAL_STATUS_LENGTH 10  //Battery and solar mV, charge state, waveform (PWM_xxx), duty, faults, SoC %, channel
+
+//The charge profile used when the EEPROM doesn't hold one, see ChargeProfile.h. A different
+//one can be set and saved over the serial link, WAIT_TIME has to stay a multiple of SAMPLE_PERIOD.
+#define TARGET  14.00           //Absorption
+#define FLOAT_VOLTAGE 13.50
+#define BULK_VOLTAGE  12.50     //At or below, charge full on
 #define HYSTGAP  0.50
+#define ABSORB_MINUTES 240      //At TARGET before dropping to float, 0 never floats
+#define TEMP_COEFF_MV  -30      //Per degree C for the battery
+#define TEMP_REF_C      25
+
+//Battery temperature, an NTC thermistor to ground on A2 with NTC_FIXED_R up to 5V, see
+//TemperatureSensor in PWMLibs.h. Absorption and float move by the profile's TempCoeffmV per
+//degree away from TempRefC. Without the thermistor the pin reads open and they don't move.
+#define TEMP_SENSOR_PIN A2
+#define NTC_FIXED_R  10000
+#define NTC_R25      10000      //Thermistor at 25C
+#define NTC_BETA      3950
+#define TEMP_COMP_MIN_C  -20    //Compensation goes no further than this, so a thermistor
+#define TEMP_COMP_MAX_C   50    //that has come off the battery can't take it far
+
+//Control law once the battery is above BULK_VOLTAGE.
+//1 holds TARGET with a PI controller (absorption) then FLOAT_VOLTAGE, 0 is the original
+//proportional trickle with hysteresis, which stops at TARGET and waits for the battery to
+//drop by HYSTGAP.
+#ifndef CONTROL_PI
+#define CONTROL_PI 1
+#endif
+#define ABSORB_KP 128   //Q8, half an 8 bit duty step per mV below TARGET, scaled to each timer's TOP
+#define ABSORB_KI  32   //Q8, added each control period
+
+//The battery and panel, for the state of charge estimate, see SocEstimator.h
+#define BATTERY_AH      45
+#define PANEL_ISC_MA   620      //Short circuit current at 1000W/m2, off the panel's label
+#define PANEL_VOC_MV 21600      //Open circuit voltage at 1000W/m2
+#define PANEL_VT_MV   1202      //Cells x diode ideality x 25.7mV, 36 x 1.3 for a 12V panel
+#define SOC_DRAIN_MA     0      //Anything else on the battery, the board's own current is added
 
 //These define the resistor values used in the voltage sensing potentiameters, this will be scaled to 1-5V
+//They go in the default profile, a saved profile can have others
 #define SOLARPOT_HIGHSIDE 680
 #define SOLARPOT_LOWSIDE  101
 #define BATTPOT_HIHGSIDE  680
 #define BATTPOT_LOWSIDE   230
 
+//Charge current, a shunt and sense amplifier on each channel, see CurrentSensor in PWMLibs.h.
+//It feeds the EnergyMeter (EnergyMeter.h). 10mOhm and a gain of 50 (INA180A2) is 0.5V/A, 10A
+//full scale. On a board without one ground the pin and the energy delivered reads 0.
+#define CURRENT_SENSE_PIN    A5
+#define CURRENT_SHUNT_MOHM   10
+#define CURRENT_GAIN         50
+#define CURRENT_OFFSET_MV     0     //Amplifier output with no current
+
+//Voltage acquisition, see ADCSampler. 2 bits of oversampling is 16 conversions per block
+#define SAMPLE_OVERSAMPLE_BITS 2
+#define SAMPLE_FILTER_SHIFT    1   //IIR smoothing between scans, 0 turns it off
+#define SAMPLE_TIMEOUT       250   //ms to wait for a scan before falling back to analogRead
+
 /*
 The frequency of the PWM signal on most pins is approximately 490 Hz. On the Uno and similar boards, pins 5 and 6
 have a frequency of approximately 980 Hz.
@@ -23,12 +89,28 @@ Older Arduino boards with an ATmega8 only support analogWrite() on pins 9, 10, a
 //The charge pump come from timer 2 on the Arduino
 #define CHARGEPUMP_PWM_A 11 //Pin generating the charge pump PWM
 #define CHARGEPUMP_PWM_B 3  //Pin generating the inverse charge pump PWM
-#define CHARGEWAVEFORM 5    //This is the pin generating the charge waveform   
+#define CHARGEPUMP_HZ 31372         //Nearest Timer2 frequency is used, see ChargePumpPWM
+#define CHARGEPUMP_DEADTIME_NS 1250 //Gap between one output going low and the other going high
+#define CHARGEWAVEFORM 9    //This is the pin generating the charge waveform, Timer1 OC1A, see Timer1PWM.h
+
+//Charge waveform frequency. TOP is 2000 at 16MHz, so about 11 bits of duty. Higher cuts the
+//ripple current but shortens the gap the battery is sampled in: the gap has to be 20us, so
+//in-phase sampling works up to 84% duty here, above that readings free-run across the pulse.
+#define CHARGE_PWM_HZ 4000
+#define CHARGE_DUTY_MAX Timer1Top(CHARGE_PWM_HZ)
+
+//Charge channels, each a battery and panel with its own switch, see ChargeChannel.h. A second
+//one runs from Timer0 on pin 5 at 976Hz (millis()' own setting, Timer0PWM.h), with its battery
+//and solar dividers on A3 and A4 and its current sense on A6 (a Nano or Pro Mini, the DIP
+//328P has no A6). The channels share the charge pump, the thermistor and the charge profile.
+//The comparator check at night only sees A1, so with two channels every wake from a pause
+//does an A-D scan.
+#ifndef CHARGE_CHANNELS
+#define CHARGE_CHANNELS 1
+#endif
+#define CHARGE2_BATTERY_PIN A3
+#define CHARGE2_SOLAR_PIN   A4   
+#define CHARGE2_CURRENT_PIN A6
 
-//These are constants used to configure the algorithm
-#define CHARGE_LOW  0     //Returned when max charge is required
-#define CHARGE_LOW_VOLTAGE 12.5
-#define CHARGE_HIGH 1  //This is the voltage at fully charged
-#define CHARGE_HIGH_VOLTAGE 14.0
 
 
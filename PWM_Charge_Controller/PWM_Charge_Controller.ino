@@ -4,7 +4,23 @@
 #include <LowPower.h> //Available from https://github.com/rocketscream/Low-Power
 #include "PWM_Charge_Controller.h"
 #include "PWMLibs.h"
+#include "Timer0PWM.h"
 #include "MorseSender.h"
+#include "ADCSampler.h"
+#include "Scheduler.h"
+#include "SleepManager.h"
+#include "Format.h"
+#include "TelemetryLog.h"
+#include "SerialLink.h"
+#include "ChargeProfile.h"
+#include "ChargeStateMachine.h"
+#include "SocEstimator.h"
+#include "EnergyMeter.h"
+#include "ChargeProtection.h"
+#include "ChargeController.h"
+#include "ChargeChannel.h"
+#include "Supervisor.h"
+#include "Probe.h"
 
 /* PWM Charge Controller Sketch.
  *  
@@ -29,205 +45,436 @@
  * In the run up to full charge ggo to a PWM waveform that tapers off as the battery charges
  * Once fully charged then hold off re-starting the charge until the battery has gone down a bit then charge up again
  * The last form is called Hysterisis mode.
+ *
+ * Which of these it is doing is kept by a ChargeStateMachine, see ChargeStateMachine.h, and the
+ * charge waveform is switched by its entry actions. Those and the control laws are in a
+ * ChargeController, see ChargeController.h, this sketch wires them to the board.
  * 
  * CONSTANTS SUCH AS TARGET VOLTAGE, RESISTOR POTENTIAL DIVIDERS
  * ETC ARE DEFINED IN PWM_Charge_Controller.h
+ *
+ * The work is split into tasks (sampling and control, Morse indicator, the pause/sleep check and
+ * feeding the watchdog) run by a small cooperative scheduler from loop(), see Scheduler.h.
+ *
+ * It can charge more than one battery, each from its own panel, see CHARGE_CHANNELS. Each has
+ * a ChargeChannel in Bank[] and the same code is run over them in turn.
+ *
+ * After a reset other than a power on it carries on charging where it left off, from the
+ * record the Supervisor keeps, see Supervisor.h.
+ *
+ * Build with PROBES 1 to time the hot paths, see Probe.h.
+ *
+ * The LED sends the readings as optical frames for a photodiode to read, or Morse with
+ * INDICATOR_OPTICAL 0, see PWM_Charge_Controller.h.
+ *
+ * Each channel measures its charge current and meters the energy it delivers against what
+ * the panel could have given, rolled up a day at a time into the log, see EnergyMeter.h.
  */
 
 ///GLOBALS
-ChargePumpPWM Mosfet_Gate_Driver (CHARGEPUMP_PWM_A,CHARGEPUMP_PWM_B); //Definitions of pins are found in PWM_Charge_Controller.h
-VoltageSensor VBat (A0,BATTPOT_HIHGSIDE,BATTPOT_LOWSIDE);
-VoltageSensor VSolar(A1,SOLARPOT_HIGHSIDE,SOLARPOT_LOWSIDE);
+static_assert(ChargePumpPins(CHARGEPUMP_PWM_A, CHARGEPUMP_PWM_B), "The charge pump needs Timer2's outputs, pins 11 and 3");
+static_assert(CHARGE_CHANNELS >= 1 && CHARGE_CHANNELS <= 2, "Timer0 and Timer1 are the only timers free for a charge waveform");
+static_assert(CHARGE_CHANNELS <= TELEMETRY_CHANNELS && CHARGE_CHANNELS <= SUPERVISE_CHANNELS, "Each channel needs its telemetry and recovery record");
+static_assert(CHARGE_CHANNELS * CHANNEL_SAMPLER_PINS + 1 <= SAMPLER_CHANNELS, "The sampler has a channel for each pin and the battery temperature");
+static_assert(CURRENT_SHUNT_MOHM * CURRENT_GAIN >= 100, "The current scaling would overflow, see CurrentScaleQ16()");
+static_assert(ENERGY_MODES == PWM_REGULATE + 1 && LINK_METER_TODAY == ENERGY_MODES, "A meter for each ChargePWM mode, then the days");
+ChargePumpPWM Mosfet_Gate_Driver (CHARGEPUMP_PWM_A,CHARGEPUMP_PWM_B,CHARGEPUMP_HZ,CHARGEPUMP_DEADTIME_NS); //Definitions of pins are found in PWM_Charge_Controller.h
+TemperatureSensor BattTemp(TEMP_SENSOR_PIN, NTC_FIXED_R, NTC_R25, NTC_BETA);
 MorseSender Morse(13);
-ChargePWM Charger(CHARGEWAVEFORM);
+ADCSampler Sampler;
+SleepManager Sleeper(A1,SOLARPOT_HIGHSIDE,SOLARPOT_LOWSIDE);
+TelemetryLog Telemetry(CHARGE_CHANNELS);
+SerialLink Link;
+Supervisor Minder;
 
-float BatVoltage;
-float SolarVoltage;
+//The charge channels, see ChargeChannel.h. The PI law floats, the original holds with hysteresis.
+Timer1PWM Waveform1;
+#if CHARGE_CHANNELS > 1
+Timer0PWM Waveform0;
+#endif
+const SocEstimator BatteryModel(BATTERY_AH, PANEL_ISC_MA, PANEL_VOC_MV, PANEL_VT_MV);
+ChargeChannel Bank[CHARGE_CHANNELS] = {
+  ChargeChannel(0, Waveform1, CHARGEWAVEFORM, CHARGE_PWM_HZ, CHARGE_DUTY_MAX, A0, A1,
+                CurrentSensor(CURRENT_SENSE_PIN, CURRENT_SHUNT_MOHM, CURRENT_GAIN, CURRENT_OFFSET_MV),
+                ABSORB_KP, ABSORB_KI, BatteryModel, !CONTROL_PI),
+#if CHARGE_CHANNELS > 1
+  ChargeChannel(1, Waveform0, TIMER0_PWM_PIN, 0, TIMER0_TOP, CHARGE2_BATTERY_PIN, CHARGE2_SOLAR_PIN,
+                CurrentSensor(CHARGE2_CURRENT_PIN, CURRENT_SHUNT_MOHM, CURRENT_GAIN, CURRENT_OFFSET_MV),
+                ABSORB_KP, ABSORB_KI, BatteryModel, !CONTROL_PI),
+#endif
+};
+
+Scheduler Tasks;
+
+unsigned int DrainmA = SOC_DRAIN_MA;
+bool Pausing = false;     //Every channel asleep, the pause task is running
+
+//The charge profile, from EEPROM or PWM_Charge_Controller.h, see ChargeProfile.h. The control
+//code uses the figures below, worked out from it by ApplyProfile(). The channels' absorption and
+//float are temperature compensated, by CompensateSetpoints() only when the temperature changes.
+ChargeProfile Profile;
+int CompensatedC = TEMP_NONE;   //Whole degrees the setpoints are for, TEMP_NONE before the first
+unsigned int WaitTime;
+unsigned int ProfileKey;  //ProfileId() of it, for the recovery record
+
+byte SampleTask;
+byte IndicatorTask;
+byte SleepTask;
+byte LinkTask;
+byte SuperviseTask;
+
+//The Arduino IDE generates these, they are here so the sketch also builds on the host (see host/)
+void SampleVoltages();
+void ChargeControl(ChargeChannel &c);
+void IndicatorUpdate();
+void PauseCheck();
+void Supervise();
+void StartPause();
+void EndPause();
+bool AllChannels(byte state);
+void ChargeEntry(ChargeController &controller, byte state);
+void ChargeExit(ChargeController &controller, byte state);
+void doChargeSleep();
+void doChargeWake();
+void RecordStatus(ChargeChannel &c, byte state);
+void CheckFaults(ChargeChannel &c);
+bool ResumeCharge(ChargeChannel &c);
+void KeepRecord(ChargeChannel &c);
+void ServiceLink();
+void DefaultProfile(ChargeProfile &p);
+void ApplyProfile();
+void CompensateSetpoints(bool force);
+unsigned int CompensatedmV(unsigned int mV, long offset);
+unsigned int *ProfileSetting(ChargeProfile &p, byte setting);
+void SendProfile();
+void SendOptical(ChargeChannel &c);
+void EndDay(ChargeChannel &c, unsigned long now);
 
 void setup() {
 
+  Minder.Begin();     //Why it reset, before anything else
 #ifdef DEBUG
       Serial.begin(57600);     //Enable serial monitor line
       Serial.println("Debug Enabled");
 #endif
+  DefaultProfile(Profile);
+  ProfileLoad(Profile);     //Leaves the default if the EEPROM hasn't a good one
+  ApplyProfile();
+#if SERIAL_LINK
+  Link.Begin();
+  SendProfile();
+#endif
+
+  Telemetry.Begin(Sleeper.Uptime(), Minder.ResetFlags(), Minder.Resets(RESET_WATCHDOG), Minder.Resets(RESET_BROWNOUT));
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    Bank[i].Begin(&Sampler, SAMPLE_OVERSAMPLE_BITS, SAMPLE_FILTER_SHIFT);    //Timers after the core has set them up
+    Bank[i].Hooks(ChargeEntry, ChargeExit);
+#if !INDICATOR_OPTICAL
+    Bank[i].UseIndicator(&Morse);     //The frames carry the faults and duty otherwise
+#endif
+  }
+  BattTemp.UseSampler(&Sampler, SAMPLE_OVERSAMPLE_BITS, SAMPLE_FILTER_SHIFT);     //Read with the first channel
 
 //On Startup/Reset report the voltages on input and output.
-   BatVoltage = VBat.volts();
-   SolarVoltage = VSolar.volts();
-   Morse.Flash();
-   Morse.SendString("BAT");
-   Morse.SendString((String)BatVoltage);
-   Morse.SendString("SOL");
-   Morse.SendString((String)SolarVoltage);
+   byte resumed = 0;
+   for (byte i = 0; i < CHARGE_CHANNELS; i++)
+   {
+     ChargeChannel &c = Bank[i];
+     Sampler.Acquire(i, SAMPLER_FREE, SAMPLE_TIMEOUT);
+     c.Reading(true);
+     c.ReadCurrent(Sampler, SAMPLE_TIMEOUT);
+     c.Energy.Begin(Sleeper.Uptime());   //Not kept through a reset
+     if (!i)
+     {
+       BattTemp.Celsius10();
+       CompensateSetpoints(false);
+     }
+     if (ResumeCharge(c)) resumed |= _BV(i);
+     else c.Soc.Begin(c.Battery.LastMilliVolts(), Sleeper.Uptime());    //Nothing charging yet, so at rest
+   }
+   if (!(resumed & 1))
+   {
+#if INDICATOR_OPTICAL
+     SendOptical(Bank[0]);
+#else
+     char text[FORMAT_BUFFER];
+     Morse.Flash();
+     Morse.SendString("BAT");
+     Morse.SendString(FormatFixed(text, Bank[0].Battery.LastMilliVolts(), 3, 2));
+     Morse.SendString("SOL");
+     Morse.SendString(FormatFixed(text, Bank[0].Solar.LastMilliVolts(), 3, 2));
+#endif
+   }
 //
 
+  //Everything runs from here on as tasks, see Scheduler.h. The sample task does the control
+  //steps as well, each straight after that channel's readings.
+  SampleTask = Tasks.Add(SampleVoltages, SAMPLE_PERIOD, SAMPLE_DEADLINE);
+  IndicatorTask = Tasks.Add(IndicatorUpdate, INDICATOR_PERIOD, INDICATOR_PERIOD);
+  SleepTask = Tasks.Add(PauseCheck, 0, SLEEP_DEADLINE);
+  Tasks.Enable(SleepTask, false);
+#if SERIAL_LINK
+  LinkTask = Tasks.Add(ServiceLink, LINK_PERIOD, LINK_PERIOD);
+#endif
+  SuperviseTask = Tasks.Add(Supervise, SUPERVISE_PERIOD, SUPERVISE_PERIOD);
+
   doChargeWake(); //StartUp the PWM Waveforms
+  //Once the tasks are there, the entry action of a resumed state may need them
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    const RecoveryRecord &r = Minder.Record(i);
+    if (resumed & _BV(i)) Bank[i].State.Resume(r.State, r.AbsorbSeconds, Sleeper.Uptime());
+    else Bank[i].State.Begin(Sleeper.Uptime());
+  }
+  Minder.Arm();
 }
 
 void loop()
 {
-  ChargeLoop();
-  // If we've returned then we're undervoltage detected between Solar and Battery.
-  PauseLoop();
+  Tasks.Run();
 }
 
 ////////////////////////////////////////////////////////////////
-//The Pause loop is called when the solar voltage is too low
-//This puts a longer delay between sampling
-//And makes calls to reduce power consumption of the board
-///////////////////////////////////////////////////////////////
+// Sample task, takes the battery and solar readings and runs the control
+// step for each channel that is due one, see ChargeChannel.h.
+// When trickle charging the readings are taken in the off part of
+// each PWM cycle so the charge carries on. At full on there is no off part, so
+// the PWM has to be suspended and the battery left to settle, that is only done
+// once per control period. The channels that need it are suspended together
+// so they share the one settle time.
+//
+// Each channel's scan is started before the one before it is controlled, so
+// the A-D is reading one while the other's sums are done. A channel's control
+// step is done by ServiceMicros into the run, the last channel's sets how long
+// the task takes, a scan and a control step more for each channel.
+////////////////////////////////////////////////////////////////
 
-void PauseLoop()
+void SampleVoltages()
 {
-  doChargeSleep();
-
-  while (true) // loop until break.
+  PROBE(PROBE_SAMPLE);
+  unsigned long began = micros();
+  bool settle = false;
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+    if (Bank[i].Prepare(WaitTime / SAMPLE_PERIOD)) settle = true;
+  if (settle)
   {
-    BatVoltage = VBat.volts();
-    SolarVoltage = VSolar.volts();
-    
+    PROBE(PROBE_SETTLE);
+    delay(SETTLE_TIME);
+  }
+
 #ifdef DEBUG   
-      Serial.print(" Pause Loop: Battery ");
-      Serial.print(BatVoltage);
-      Serial.print("V Solar ");
-      Serial.print(SolarVoltage);
-      Serial.println("V");
+      Serial.print("\nSample: ");
  #endif
-    if (SolarVoltage < BatVoltage)
-    {
-#ifdef DEBUG
-      Serial.println("Solar Voltage Low - Sleeping");
-#endif
-      doChargeSleep();
-    }
-    else
-    {
-      doChargeWake();
-      return;
-    }
+  Bank[0].StartScan(Sampler);
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    ChargeChannel &c = Bank[i];
+    if (c.FinishScan(Sampler, SAMPLE_TIMEOUT) && !i) BattTemp.Celsius10();    //In the first channel's group
+    if (i + 1 < CHARGE_CHANNELS) Bank[i + 1].StartScan(Sampler);
+    if (!c.Control || Pausing) continue;
+    ChargeControl(c);
+    c.ServiceMicros = micros() - began;
+    if (c.ServiceMicros > c.WorstServiceMicros) c.WorstServiceMicros = c.ServiceMicros;
   }
 }
 
 ////////////////////////////////////////////////////////////////
-// The Charge Loop implements the various charging strategies. The program
-// Stays in this loop until the solar voltage drops then it returns to the main
-// Program control.
-// This function takes voltage readings from both solar and battery
-// And depending on voltage vs. target (with hysterisis control) it decides
-// What instruction to give the PWM waveform controller
+// The control step implements the various charging strategies. It runs every
+// WaitTime for each channel until the solar voltage drops, then hands over to
+// the pause task once they all have.
+// The channel's ChargeController does the deciding and the control laws, see
+// ChargeController.h. Here it is given the readings, and the logs are kept.
 /////////////////////////////////////////////////////////////////////////
 
-void ChargeLoop() 
+void ChargeControl(ChargeChannel &c) 
 {  
- 
- bool Hysteresis = false;
- while (true) // Loop forever.
- {
-  
-  //Suspend PWM Activity and take a voltage reading, then turn on again
+   PROBE(PROBE_CONTROL);
 #ifdef DEBUG   
-      Serial.print("\nCharge Loop: Prep for Voltage Reading: ");
- #endif
-   Charger.Suspend();;
-   delay(100);
-   BatVoltage = VBat.volts();
-   SolarVoltage = VSolar.volts(); 
-   Charger.Resume();
-   
-#ifdef DEBUG   
-      Serial.print("Battery ");
-      Serial.print(BatVoltage);
+      Serial.print("\nCharge Control ");
+      Serial.print(c.Number);
+      Serial.print(": Battery ");
+      Serial.print(c.BatVoltage);
       Serial.print("V Solar ");
-      Serial.print(SolarVoltage);
+      Serial.print(c.SolarVoltage);
       Serial.print("V");
  #endif
-   
-   if (SolarVoltage < BatVoltage) return; //No Charging is possible;
- 
-    //Decide mode of charge based on battery voltage;
+   RecordStatus(c, c.State.State());
+   CompensateSetpoints(false);
+   CheckFaults(c);
+   c.Step(c.Battery.LastMilliVolts(), c.Solar.LastMilliVolts(), Sleeper.Uptime());
+   KeepRecord(c);
+#if INDICATOR_OPTICAL
+   SendOptical(c);
+#endif
+}
 
-    //If the battery is more than 1.5V below target voltage then give it the beans.
-    if (BatVoltage <= (TARGET -1.5)) 
-    {
-#ifdef DEBUG   
-      Serial.print(" Battery low voltage full charge :");
- #endif
-        Charger.chargeHardOn();
-    } else {
-        //If the battery is at max voltage then stop charge and set Hysteresis mode on
-         if (BatVoltage >= TARGET) {
- #ifdef DEBUG   
-      Serial.print(" Battery above target voltage ");
-      Serial.print(TARGET);
-      Serial.print ("V charge off :");
- #endif
-             Charger.chargeOff();
-             Hysteresis = true;
-         } else {
-           Hysteresis=doPWMwithHysteresis(Hysteresis);
-         }
-     }
-    //This governs the time of the charge cycle.
-    delay(WAIT_TIME);  //Do that for a while before trying again.
-  }
+////////////////////////////////////////////////////////////////
+// Indicator task, moves the Morse output on. The LED timings are
+// multiples of 25ms so a few ms of jitter doesn't show. An optical
+// frame's bits are clocked by Timer0's interrupt, not this.
+////////////////////////////////////////////////////////////////
+
+void IndicatorUpdate()
+{
+  PROBE(PROBE_INDICATOR);
+  MorseSender::Tick();
 }
 
 ////////////////////////////////////////////////////////////////
-// This is called from the main charge loop
-// Seperating this way makes the operation clearer
-//
-//This calls the PWM waveform to handle charging on the final bit
-//
-//Implements a Hysteresis so it backs off for a bit once the battery is fully charged
-//Helps to prevent oscillations.The difference re-trigger voltage is set as an
-//offset from TARGET with the constant HYSTGAP
-//
-/////////////////////////////////////////////////////////////////////////
+// Supervise task, feeds the watchdog while the control loop (or
+// the pause task at night) is still checking in, see Supervisor.h.
+// It gets a control period and SUPERVISE_MARGIN to do it in.
+////////////////////////////////////////////////////////////////
 
-bool doPWMwithHysteresis(bool H)
+void Supervise()
 {
-  bool Hysteresis = H;
-  if (Hysteresis == false)
+  Minder.Feed(WaitTime + SUPERVISE_MARGIN);
+}
+
+////////////////////////////////////////////////////////////////
+//The Pause task runs when the solar voltage is too low, in place
+//of sampling and control. Each run sleeps for a while to reduce
+//power consumption of the board, then checks whether to wake.
+//How long it sleeps is up to the SleepManager, see SleepManager.h
+///////////////////////////////////////////////////////////////
+
+void StartPause()
+{
+#ifdef DEBUG
+  Tasks.Report();
+  Sleeper.Report();
+  for (byte i = 0; i < CHARGE_CHANNELS; i++) Bank[i].State.Report(Sleeper.Uptime());
+#endif
+  Pausing = true;
+  Sleeper.Paused();
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+    if (Bank[i].Energy.DayDue(Sleeper.Uptime(), true)) EndDay(Bank[i], Sleeper.Uptime());
+  Telemetry.Commit();     //Write out while awake, the night may end in a brown out
+  Tasks.Enable(SampleTask, false);
+  Tasks.Enable(SleepTask, true);
+}
+
+void EndPause()
+{
+  Pausing = false;
+  Sleeper.Woke();
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    Bank[i].Wake();
+    Bank[i].Energy.Wake(Sleeper.Uptime());
+  }
+  doChargeWake();
+  Tasks.Enable(SleepTask, false);
+  Tasks.Enable(SampleTask, true);
+}
+
+void PauseCheck()
+{
+  doChargeSleep();
+  for (byte i = 0; i < CHARGE_CHANNELS; i++) KeepRecord(Bank[i]);
+
+  //Too dark to charge, don't spend time on an A-D scan. The comparator only
+  //sees the first channel's panel, so with more than one they are all read.
+  if (CHARGE_CHANNELS == 1 && !Sleeper.SolarPresent())
   {
+    Sleeper.Update(0);
+    if (Telemetry.Due(Sleeper.Uptime()))
+    {
+      Sampler.Acquire(0, SAMPLER_FREE, SAMPLE_TIMEOUT);   //Only for the log, the comparator said dark
+      Bank[0].Reading(true);
+      Bank[0].ReadCurrent(Sampler, SAMPLE_TIMEOUT);
+      RecordStatus(Bank[0], Bank[0].State.State());
+    }
+#ifdef DEBUG
+      Serial.print(" Pause: Dark, sleeping ");
+      Serial.print(Sleeper.Interval() * SLEEP_PERIOD_S);
+      Serial.println("s");
+#endif
+    return;
+  }
 
+  unsigned int solarmV = 0;
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    ChargeChannel &c = Bank[i];
+    Sampler.Acquire(i, SAMPLER_FREE, SAMPLE_TIMEOUT);
+    c.Reading(true);
+    c.ReadCurrent(Sampler, SAMPLE_TIMEOUT);
+    if (!i) BattTemp.Celsius10();
+    if (c.Solar.LastMilliVolts() > solarmV) solarmV = c.Solar.LastMilliVolts();
+  }
+  Sleeper.Update(solarmV);      //The brightest panel says how long to sleep
+  CompensateSetpoints(false);     //It may have been a cold night
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    RecordStatus(Bank[i], Bank[i].State.State());
+    CheckFaults(Bank[i]);
+  }
+    
 #ifdef DEBUG   
-      Serial.print(" No Hysteresis and below target voltage so do PWM ");
+      Serial.print(" Pause: Battery ");
+      Serial.print(Bank[0].BatVoltage);
+      Serial.print("V Solar ");
+      Serial.print(Bank[0].SolarVoltage);
+      Serial.print("V sleeping ");
+      Serial.print(Sleeper.Interval() * SLEEP_PERIOD_S);
+      Serial.println("s");
  #endif
-      Charger.chargeTrickle(TARGET-BatVoltage+0.5); //The 0.5 is here to make sure the PWM doesn't fade away before reaching voltage
-                                                    //The algorithm goes into Hysterisis mode at target so this is safe.
-      return (Hysteresis); //bail back to calling function
+  //Any channel leaving CHARGE_SLEEPING calls EndPause() and picks the stage to charge in,
+  //the others stay asleep until the sample task finds light for them too
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    ChargeChannel &c = Bank[i];
+    if (c.Step(c.Battery.LastMilliVolts(), c.Solar.LastMilliVolts(), Sleeper.Uptime(), false) == CHARGE_SLEEPING)
+    {
+#ifdef DEBUG
+      Serial.println("Solar Voltage Low - Sleeping");
+#endif
+    }
   }
-    ///ONLY GETS HERE IF THERE IS HYSTERESIS SET
-    //If Hystersis then we've gone up to voltage so
-    //turn off until there's a bit of a drop.
-    //Then raise up to voltage again.
-    #ifdef DEBUG
-      Serial.print(" Hysteresis Mode");
-    #endif
-     if (BatVoltage < (TARGET-HYSTGAP))
-     {
-      Hysteresis = false;
- #ifdef DEBUG  
-      Serial.print(" Battery Voltage Below ");
-      Serial.print(TARGET-HYSTGAP);
-      Serial.print("V Hysteresis has been reset :");
- #endif
-       Charger.chargeTrickle(TARGET-BatVoltage);
-     }
-     else
-     {
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Called after a ChargeController's own entry and exit actions, which set
+// its waveform. The charge pump and the pause are shared, so they only go
+// off once every channel has faulted or gone to sleep.
+/////////////////////////////////////////////////////////////////////////
+
+bool AllChannels(byte state)
+{
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+    if (Bank[i].State.State() != state) return false;
+  return true;
+}
+
+
+void ChargeEntry(ChargeController &controller, byte state)
+{
 #ifdef DEBUG
-      Serial.print(" Hysteresis means Charge off ");
+      Serial.print(" Charge state ");
+      Serial.print(static_cast<ChargeChannel &>(controller).Number);
+      Serial.print(" ");
+      Serial.print(ChargeStateMachine::Name(state));
+      Serial.print(" :");
+#else
+  (void)controller;
 #endif
-          Charger.chargeOff();
-          Morse.SendString("Y");
+  //The gate drive too, in case it is the switch that has failed
+  if (state == CHARGE_FAULT && AllChannels(CHARGE_FAULT)) Mosfet_Gate_Driver.Off();
+  if (state == CHARGE_SLEEPING && AllChannels(CHARGE_SLEEPING)) StartPause();
+}
 
-     }
-     return (Hysteresis);
+void ChargeExit(ChargeController &controller, byte state)
+{
+  (void)controller;
+  if (state == CHARGE_SLEEPING && Pausing) EndPause();
+  if (state == CHARGE_FAULT) Mosfet_Gate_Driver.On();
 }
 
 /////////////////////////////////////////////////////////////////////////
 //This puts the contoller into a low power mode, shuts of the charging circuit.
+//The sleep is one or more 8s power downs, see SleepManager.
 /////////////////////////////////////////////////////////////////////////
 
 void doChargeSleep()
@@ -245,9 +492,12 @@ void doChargeSleep()
       delay(250);
 #endif
     digitalWrite(LED_BUILTIN, LOW); //Turnoff the Board LED, it can remain high and increase current consumption.
-    Mosfet_Gate_Driver.Off(); //Turn off the charge Pump signals
-    Charger.Suspend();        //stop the output PWM signal and save state
-    LowPower.powerDown(SLEEP_8S, ADC_OFF, BOD_OFF);  //From the LowPower library included.
+#if SERIAL_LINK
+    Link.Flush();             //Powering down would cut the frame being sent short
+#endif
+    Mosfet_Gate_Driver.Off(); //Turn off the charge Pump signals, the charge is already off
+    Sleeper.Sleep();          //Power down for as long as the SleepManager says
+    Minder.Arm();             //The Low-Power library leaves the watchdog off
 
 }
 
@@ -259,15 +509,335 @@ void doChargeWake()
 //This starts up the controller ready to work.
 {
     
-    Mosfet_Gate_Driver.On(); //Startup the Charge Pump PWM signal
-    Charger.Resume();        //Go back to whatever it was doing before
+    Mosfet_Gate_Driver.On(); //Startup the Charge Pump PWM signal, the ChargeStateMachine sets the charge
 #ifdef DEBUG
       Serial.println("\nWaking Up Charger ");
 #endif
 }
 
+/////////////////////////////////////////////////////////////////////////
+//Counts the charge since the last readings into the state of charge, see
+//SocEstimator.h, and the energy, see EnergyMeter.h, then sends the
+//readings just taken over the serial link and adds a record to the EEPROM
+//log when one is due, see TelemetryLog.h. Times are from the SleepManager
+//so they carry on through the nights.
+/////////////////////////////////////////////////////////////////////////
+
+void RecordStatus(ChargeChannel &c, byte state)
+{
+  unsigned long now = Sleeper.Uptime();
+  unsigned int bat = c.Battery.LastMilliVolts();
+  unsigned int sol = c.Solar.LastMilliVolts();
+  byte duty = c.Duty();
+  //The board runs off the first channel's battery
+  unsigned int drain = DrainmA + (c.Number ? 0 : Sleeper.AverageMicroAmps() / 1000);
+  //Unfiltered solar, the filter would blend the open panel with the loaded readings before it
+  c.Count(bat, c.Solar.SpotMilliVolts(), c.SolarOpen, c.ChargemA, c.OpenMs, drain, now);
+#if SERIAL_LINK
+  Link.SendStatus(now, bat, sol, state, duty, c.Soc.Percent(), c.Number);
+#endif
+  if (Telemetry.Due(now, c.Number)) Telemetry.Add(now, bat, sol, state, duty, c.Soc.Percent(), c.Number);
+  if (c.Energy.DayDue(now, false)) EndDay(c, now);     //No pause for too long
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Rolls up a channel's day of energy into the log and sends it over the
+//serial link, see EnergyMeter.h. Normally at the first pause of the night.
+/////////////////////////////////////////////////////////////////////////
+
+void EndDay(ChargeChannel &c, unsigned long now)
+{
+  const EnergyTotals &d = c.Energy.Today();
+  unsigned int peak = (d.PeakmA + TELEMETRY_PEAK_MA / 2) / TELEMETRY_PEAK_MA;
+  Telemetry.Add(now, EnergyMeter::Tenths(d.DeliveredUj, TELEMETRY_TENTHS_MAX), EnergyMeter::Tenths(d.AvailableUj, TELEMETRY_TENTHS_MAX),
+                TELEMETRY_DAY, (peak > 255) ? 255 : peak, 0, c.Number);
+  c.Energy.EndDay(now);
+#if SERIAL_LINK
+  Link.SendEnergy(c.Number, LINK_METER_DAY, c.Energy.Days(), c.Energy.Yesterday());
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Sends a channel's readings as an optical frame on the LED, see
+//MorseSender.h and OPTICAL_STATUS_LENGTH. A frame takes about half a
+//second, so the channels take turns, and a turn waits while the LED is
+//still busy with the last one.
+/////////////////////////////////////////////////////////////////////////
+
+void SendOptical(ChargeChannel &c)
+{
+  static byte turn = 0;
+  if (c.Number != turn || Morse.isBusy()) return;
+  unsigned int bat = c.Battery.LastMilliVolts();
+  unsigned int sol = c.Solar.LastMilliVolts();
+  byte p[OPTICAL_STATUS_LENGTH];
+  p[0] = bat & 0xFF;
+  p[1] = bat >> 8;
+  p[2] = sol & 0xFF;
+  p[3] = sol >> 8;
+  p[4] = c.State.State();
+  p[5] = c.Charger.State();
+  p[6] = c.Duty();
+  p[7] = c.Protect.Faults();
+  p[8] = c.Soc.Percent();
+  p[9] = c.Number;
+  Morse.SendFrame(p, sizeof(p));
+  turn = (turn + 1) % CHARGE_CHANNELS;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Runs the protection checks on a channel's readings and tells its
+//ChargeStateMachine, which goes to CHARGE_FAULT at its next Step().
+//The battery is the scan without the filter, which would spread a
+//jump over several readings each too small to fail the check.
+/////////////////////////////////////////////////////////////////////////
+
+void CheckFaults(ChargeChannel &c)
+{
+  c.Check(c.Battery.SpotMilliVolts(), c.Solar.LastMilliVolts(), c.SolarOpen, Sleeper.Uptime());
+#ifdef DEBUG
+  if (c.Protect.Faults())
+  {
+    Serial.print(" Faults ");
+    Serial.println(c.Protect.Faults(), HEX);
+  }
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////
+//After a reset that wasn't a power on, picks up a channel from the
+//Supervisor's record: the waveform and its duty, latched faults and the
+//state of charge. Only if it was for this profile and control law,
+//otherwise false and the channel starts afresh. setup() resumes the
+//charge state once the tasks are there.
+/////////////////////////////////////////////////////////////////////////
+
+bool ResumeCharge(ChargeChannel &c)
+{
+  const RecoveryRecord &r = Minder.Record(c.Number);
+  if (!Minder.Recovered(c.Number) || r.ProfileId != ProfileKey || r.Hysteresis != !CONTROL_PI) return false;
+  unsigned long now = Sleeper.Uptime();
+  c.Charger.Restore(r.Mode, r.Pulse);
+  c.Absorption.Reset(r.Pulse);      //So the PI law carries on from the same duty
+  c.Protect.Restore(r.Faults, now);
+  c.State.Fault(c.Protect.Faults());
+  c.Soc.Resume(r.SocPermille, now);
+#ifdef DEBUG
+  Serial.print("Resuming ");
+  Serial.print(c.Number);
+  Serial.print(" ");
+  Serial.println(ChargeStateMachine::Name(r.State));
+#endif
+  return true;
+}
+
+//What ResumeCharge() needs, kept each control period
+void KeepRecord(ChargeChannel &c)
+{
+  RecoveryRecord r;
+  r.State = c.State.State();
+  r.Mode = c.Charger.State();
+  r.Pulse = c.Charger.Pulse();
+  r.AbsorbSeconds = c.State.AbsorbSeconds(Sleeper.Uptime());
+  r.Faults = c.Protect.Faults();
+  r.Hysteresis = !CONTROL_PI;
+  r.ProfileId = ProfileKey;
+  r.SocPermille = c.Soc.Permille();
+  Minder.Tick(c.Number, r);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//The profile used when there isn't one saved, from PWM_Charge_Controller.h
+/////////////////////////////////////////////////////////////////////////
+
+void DefaultProfile(ChargeProfile &p)
+{
+  p.Version = PROFILE_VERSION;
+  p.Chemistry = PROFILE_CUSTOM;
+  p.BulkmV = BULK_VOLTAGE * 1000 + 0.5;
+  p.AbsorbmV = TARGET * 1000 + 0.5;
+  p.FloatmV = FLOAT_VOLTAGE * 1000 + 0.5;
+  p.HystGapmV = HYSTGAP * 1000 + 0.5;
+  p.AbsorbMinutes = ABSORB_MINUTES;
+  p.TempCoeffmV = TEMP_COEFF_MV;
+  p.TempRefC = TEMP_REF_C;
+  p.WaitTime = WAIT_TIME;
+  p.BattHighR = BATTPOT_HIHGSIDE;
+  p.BattLowR = BATTPOT_LOWSIDE;
+  p.SolarHighR = SOLARPOT_HIGHSIDE;
+  p.SolarLowR = SOLARPOT_LOWSIDE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Works out what the control code uses from the profile. Called at start
+//up and when the profile changes, not from the control loop.
+/////////////////////////////////////////////////////////////////////////
 
+void ApplyProfile()
+{
+  WaitTime = Profile.WaitTime;
+  ProfileKey = ProfileId(Profile);
+  CompensateSetpoints(true);
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    Bank[i].Battery.SetDivider(Profile.BattHighR, Profile.BattLowR);
+    Bank[i].Solar.SetDivider(Profile.SolarHighR, Profile.SolarLowR);
+  }
+  Sleeper.SetDivider(Profile.SolarHighR, Profile.SolarLowR);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//Moves absorption and float by the profile's TempCoeffmV for each degree
+//the battery is away from TempRefC. The control task calls this every
+//period but the sums are only done when the temperature has changed by a
+//degree, or force after a new profile. Without a thermistor the profile's
+//figures are used as they are. Float is kept above bulk, a hot battery
+//with a low float setting would otherwise go straight back to bulk, and
+//both within the limits a profile is held to, a cold one would otherwise
+//be taken over PROFILE_MAX_MV.
+/////////////////////////////////////////////////////////////////////////
+
+unsigned int CompensatedmV(unsigned int mV, long offset)
+{
+  long compensated = mV + offset;
+  if (compensated < PROFILE_MIN_MV) return PROFILE_MIN_MV;
+  if (compensated > PROFILE_MAX_MV) return PROFILE_MAX_MV;
+  return (unsigned int)compensated;
+}
+
+void CompensateSetpoints(bool force)
+{
+  int tenths = BattTemp.LastCelsius10();
+  int c = (tenths == TEMP_NONE) ? Profile.TempRefC : (tenths + ((tenths < 0) ? -5 : 5)) / 10;
+  if (c < TEMP_COMP_MIN_C) c = TEMP_COMP_MIN_C;
+  if (c > TEMP_COMP_MAX_C) c = TEMP_COMP_MAX_C;
+  if (c == CompensatedC && !force) return;
+  CompensatedC = c;
+
+  long offset = (long)Profile.TempCoeffmV * (c - Profile.TempRefC);
+  unsigned int absorbmV = CompensatedmV(Profile.AbsorbmV, offset);
+  unsigned int floatmV = CompensatedmV(Profile.FloatmV, offset);
+  if (floatmV < Profile.BulkmV + PROFILE_GAP_MIN_MV) floatmV = Profile.BulkmV + PROFILE_GAP_MIN_MV;
+  if (absorbmV < floatmV) absorbmV = floatmV;
+  for (byte i = 0; i < CHARGE_CHANNELS; i++)
+    Bank[i].Setpoints(Profile.BulkmV, absorbmV, floatmV, Profile.HystGapmV, Profile.AbsorbMinutes);
+#ifdef DEBUG
+  Serial.print(" Setpoints for ");
+  Serial.print(c);
+  Serial.print("C absorb ");
+  Serial.print(absorbmV);
+  Serial.print("mV float ");
+  Serial.println(floatmV);
+#endif
+}
+
+//The profile field a LINK_SET setting changes, 0 if there isn't one
+unsigned int *ProfileSetting(ChargeProfile &p, byte setting)
+{
+  switch (setting)
+  {
+    case LINK_TARGET:     return &p.AbsorbmV;
+    case LINK_HYSTGAP:    return &p.HystGapmV;
+    case LINK_WAITTIME:   return &p.WaitTime;
+    case LINK_FLOAT:      return &p.FloatmV;
+    case LINK_BULK:       return &p.BulkmV;
+    case LINK_ABSORBTIME: return &p.AbsorbMinutes;
+    case LINK_BATT_HIGH:  return &p.BattHighR;
+    case LINK_BATT_LOW:   return &p.BattLowR;
+    case LINK_SOLAR_HIGH: return &p.SolarHighR;
+    case LINK_SOLAR_LOW:  return &p.SolarLowR;
+  }
+  return 0;
+}
 
+void SendProfile()
+{
+#if SERIAL_LINK
+  unsigned int values[LINK_SETTING_COUNT];
+  for (byte i = 0; i < LINK_SETTING_COUNT; i++) values[i] = *ProfileSetting(Profile, i + 1);
+  Link.SendSettings(values, Profile.Chemistry);
+#endif
+}
 
+/////////////////////////////////////////////////////////////////////////
+//Link task, carries out commands from the serial link, see SerialLink.h.
+//Each is answered with the settings as they now are, or a NAK, apart from
+//LINK_PROBES which gets the probe's figures and LINK_METER the energy.
+/////////////////////////////////////////////////////////////////////////
 
+void ServiceLink()
+{
+#if SERIAL_LINK
+  while (Link.Poll())
+  {
+    const byte *c = Link.Command();
+    byte len = Link.CommandLength();
+    ChargeProfile p = Profile;
+    byte reason = 0;
+    bool save = false;
+    if (c[0] == LINK_SET)
+    {
+      unsigned int *field = (len == 4) ? ProfileSetting(p, c[1]) : 0;
+      if (len != 4) reason = LINK_BAD_LENGTH;
+      else if (!field) reason = LINK_BAD_VALUE;
+      else
+      {
+        *field = c[2] | (c[3] << 8);
+        if (c[1] < LINK_BATT_HIGH) p.Chemistry = PROFILE_CUSTOM;
+      }
+    }
+    else if (c[0] == LINK_PRESET)
+    {
+      if (len != 2) reason = LINK_BAD_LENGTH;
+      else if (!ProfilePreset(p, c[1])) reason = LINK_BAD_VALUE;
+    }
+    else if (c[0] == LINK_SAVE) save = true;
+    else if (c[0] == LINK_CLEAR)
+    {
+      for (byte i = 0; i < CHARGE_CHANNELS; i++)
+      {
+        Bank[i].Protect.Clear();
+        Bank[i].State.Fault(false);
+      }
+    }
+    else if (c[0] == LINK_PROBES)     //Answered with the figures, not the settings
+    {
+#if PROBES
+      if (len != 2) reason = LINK_BAD_LENGTH;
+      else if (c[1] >= PROBE_COUNT) reason = LINK_BAD_VALUE;
+      else
+      {
+        Link.SendProbe(c[1], ProbeRead(c[1]));
+        continue;
+      }
+#else
+      reason = LINK_BAD_COMMAND;      //Built without them, see Probe.h
+#endif
+    }
+    else if (c[0] == LINK_METER)      //Answered with the totals, not the settings
+    {
+      if (len != 3) reason = LINK_BAD_LENGTH;
+      else if (c[1] >= CHARGE_CHANNELS || c[2] >= LINK_METER_WHICH) reason = LINK_BAD_VALUE;
+      else
+      {
+        EnergyMeter &m = Bank[c[1]].Energy;
+        Link.SendEnergy(c[1], c[2], m.Days(), (c[2] == LINK_METER_TODAY) ? m.Today() :
+                                              (c[2] == LINK_METER_DAY) ? m.Yesterday() : m.Mode(c[2]));
+        continue;
+      }
+    }
+    else if (c[0] != LINK_GET) reason = LINK_BAD_COMMAND;
 
+    if (!reason && (!ProfileValid(p) || p.WaitTime % SAMPLE_PERIOD)) reason = LINK_BAD_VALUE;
+    if (reason)
+    {
+      Link.SendNak(c[0], reason);
+      continue;
+    }
+    Profile = p;
+    if (save) ProfileSave(Profile);
+    ApplyProfile();     //A new WaitTime is picked up by the channels' next Prepare()
+    SendProfile();
+  }
+#endif
+}
@@ -0,0 +1,71 @@
+#include <Arduino.h>
+#include "Probe.h"
+#ifndef __AVR__
+#include <chrono>
+#endif
+
+/*  Probes
+ *
+ *  The table is zeroed static storage, a probe with no runs has Min at 0 and is filled in by
+ *  its first. The total is 64 bits, 32 would run out after about four minutes of cycles.
+ *
+ *  The names are there with the probes off as well, so the host tools can print a board's.
+ */
+
+static const char *const Names[PROBE_COUNT] = {"reading", "waveform", "control", "sample", "settle", "indicator", "current"};
+
+const char *ProbeName (byte probe)
+{
+  return ((probe < PROBE_COUNT) ? Names[probe] : "?");
+}
+
+#if PROBES
+
+static ProbeStats Table[PROBE_COUNT];
+
+unsigned long ProbeTicks (void)
+{
+#ifdef __AVR__
+  return (micros() * PROBE_TICKS_PER_US);
+#else
+  return ((unsigned long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+void ProbeRecord (byte probe, unsigned long ticks)
+{
+  if (probe >= PROBE_COUNT) return;
+  ProbeStats &s = Table[probe];
+  if (!s.Count || ticks < s.Min) s.Min = ticks;
+  if (ticks > s.Max) s.Max = ticks;
+  s.Count++;
+  s.Total += ticks;
+  byte b = 0;
+  for (unsigned long edge = PROBE_BUCKET0; ticks >= edge && b < PROBE_BUCKETS - 1; edge <<= 2) b++;
+  if (s.Buckets[b] == 0xFFFF)
+    for (byte i = 0; i < PROBE_BUCKETS; i++) s.Buckets[i] >>= 1;
+  s.Buckets[b]++;
+}
+
+const ProbeStats &ProbeRead (byte probe)
+{
+  return (Table[probe < PROBE_COUNT ? probe : 0]);
+}
+
+unsigned long ProbeMean (byte probe)
+{
+  const ProbeStats &s = ProbeRead(probe);
+  return (s.Count ? (unsigned long)(s.Total / s.Count) : 0);
+}
+
+void ProbeClear (void)
+{
+  memset(Table, 0, sizeof(Table));
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Probes
+//////////////////////////////////////////////////////////////////////////////////////////////
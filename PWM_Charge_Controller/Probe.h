@@ -0,0 +1,89 @@
+#define ProbeLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Probes, how long the hot paths take
+//
+//  PROBE(which) at the top of a block times it to the end of the block, and adds the time to
+//  that probe's figures: runs, shortest, longest, total (for the mean) and a histogram. All
+//  kept in a fixed table, no allocation. Built with PROBES 0, the default, PROBE() is nothing
+//  and there is no table, so a normal build is as it was.
+//
+//  Times are in ticks, PROBE_TICKS_PER_US to the microsecond. On the board a tick is a CPU
+//  cycle, from micros() so in steps of 64 (4us): Timer1 is the charge waveform, phase correct
+//  so its count goes down as well as up, and Timer0 may be the second channel's, so neither
+//  can be left free running as a cycle counter. On the host it is a nanosecond of
+//  std::chrono::steady_clock, real time not the emulated clock.
+//
+//  Histogram bucket 0 is under PROBE_BUCKET0 ticks, each after it 4 times wider, the last
+//  takes everything longer. On the board that is under 16us, 64us, 256us, 1ms, 4ms, 16ms,
+//  65ms and more. The buckets are 16 bits, so once there are a lot of runs they give the
+//  shares rather than the number.
+//
+//  Probes are only run from loop(), not interrupts, so nothing here is atomic.
+//
+//  Read over the serial link with LINK_PROBES (link_decode --probes), and on the host with
+//  pwm_charge_bench, which builds them in.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROBES
+#define PROBES 0              //1 builds the probes in, RAM for the table and a few us a probe
+#endif
+
+#define PROBE_READING   0     //VoltageSensor::takeReading()
+#define PROBE_WAVEFORM  1     //ChargePWM::ImplementWaveForm()
+#define PROBE_CONTROL   2     //One channel's control step, the sketch's ChargeControl()
+#define PROBE_SAMPLE    3     //The whole sample task, readings and control for every channel
+#define PROBE_SETTLE    4     //Waiting for the battery to settle with full on suspended
+#define PROBE_INDICATOR 5     //Moving the Morse LED on
+#define PROBE_CURRENT   6     //CurrentSensor::takeReading()
+#define PROBE_COUNT     7
+
+#define PROBE_BUCKETS   8
+#define PROBE_BUCKET0 256     //Ticks
+
+#ifdef __AVR__
+#define PROBE_TICKS_PER_US (F_CPU / 1000000UL)
+#else
+#define PROBE_TICKS_PER_US 1000UL
+#endif
+
+struct ProbeStats {
+  unsigned long Count;
+  unsigned long Min;          //Ticks
+  unsigned long Max;
+  unsigned long long Total;
+  unsigned int Buckets[PROBE_BUCKETS];    //Runs in each, all halved when one fills
+};
+
+const char *ProbeName (byte probe);
+
+#if PROBES
+unsigned long ProbeTicks (void);
+void ProbeRecord (byte probe, unsigned long ticks);
+const ProbeStats &ProbeRead (byte probe);
+unsigned long ProbeMean (byte probe);
+void ProbeClear (void);
+
+//Times from where it is made to where it goes out of scope
+class ProbeTimer {
+
+  public:
+        ProbeTimer (byte probe) : Probe(probe), Start(ProbeTicks()) {}
+        ~ProbeTimer () { ProbeRecord(Probe, ProbeTicks() - Start); }
+
+  private:
+        byte Probe;
+        unsigned long Start;
+};
+
+#define PROBE_JOIN2(a, b) a##b
+#define PROBE_JOIN(a, b) PROBE_JOIN2(a, b)
+#define PROBE(probe) ProbeTimer PROBE_JOIN(ProbeScope, __LINE__)(probe)
+#else
+#define PROBE(probe)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Probes
+//////////////////////////////////////////////////////////////////////////////////////////////
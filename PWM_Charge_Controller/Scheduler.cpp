@@ -0,0 +1,123 @@
+#include <Arduino.h>
+#include "Scheduler.h"
+
+/*  Scheduler
+ *
+ *  Runs are kept on a fixed rate, the next due time steps on by Period from the last due time
+ *  rather than from when the task actually ran, so a late run doesn't push every later one back.
+ *  If a task has fallen more than a whole period behind (e.g. after sleeping) it is brought back
+ *  into step rather than run repeatedly to catch up.
+ */
+
+Scheduler::Scheduler (void)
+{
+  Count = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Add a task, returns its number. Tasks are run in the order
+//they are added when more than one is due. New tasks start
+//enabled and due straight away.
+//////////////////////////////////////////////////////////////
+
+byte Scheduler::Add (TaskFunction f, unsigned long period, unsigned long deadline)
+{
+  if (Count >= SCHEDULER_TASKS) return (SCHEDULER_TASKS - 1);   //No room, don't run off the end
+  Task &t = Tasks[Count];
+  t.Run = f;
+  t.Period = period;
+  t.Deadline = deadline;
+  t.NextRun = millis();
+  t.LastTime = 0;
+  t.WorstCase = 0;
+  t.Runs = 0;
+  t.Overruns = 0;
+  t.Enabled = true;
+  return (Count++);
+}
+
+void Scheduler::Enable (byte task, bool on)
+{
+  if (on && !Tasks[task].Enabled) Tasks[task].NextRun = millis();
+  Tasks[task].Enabled = on;
+}
+
+void Scheduler::SetPeriod (byte task, unsigned long period)
+{
+  Tasks[task].Period = period;
+}
+
+void Scheduler::RunNow (byte task)
+{
+  Tasks[task].NextRun = millis();
+}
+
+//////////////////////////////////////////////////////////////
+//Run everything that is due, call this from loop()
+//If nothing was due it waits until the next task is, rather
+//than going round loop() polling millis().
+//////////////////////////////////////////////////////////////
+
+void Scheduler::Run (void)
+{
+  bool ran = false;
+  long wait = 0x7FFFFFFFL;
+  for (byte i = 0; i < Count; i++)
+  {
+    Task &t = Tasks[i];
+    if (!t.Enabled) continue;
+    long due = (long)(t.NextRun - millis());
+    if (due > 0)
+    {
+      if (due < wait) wait = due;
+      continue;
+    }
+    ran = true;
+
+    unsigned long start = micros();
+    t.Run();
+    t.LastTime = micros() - start;
+    t.Runs++;
+    if (t.LastTime > t.WorstCase) t.WorstCase = t.LastTime;
+    if (millis() - t.NextRun > t.Deadline) t.Overruns++;
+
+    t.NextRun += t.Period;
+    if ((long)(millis() - t.NextRun) > (long)t.Period) t.NextRun = millis() + t.Period;
+  }
+  if (!ran && wait != 0x7FFFFFFFL) delay(wait);
+}
+
+unsigned long Scheduler::WorstCase (byte task)
+{
+  return (Tasks[task].WorstCase);
+}
+
+unsigned int Scheduler::Overruns (byte task)
+{
+  return (Tasks[task].Overruns);
+}
+
+//////////////////////////////////////////////////////////////
+//Print the task figures, for debugging on the Serial port
+//////////////////////////////////////////////////////////////
+
+void Scheduler::Report (void)
+{
+  for (byte i = 0; i < Count; i++)
+  {
+    Serial.print("Task ");
+    Serial.print(i);
+    Serial.print(" runs ");
+    Serial.print(Tasks[i].Runs);
+    Serial.print(" last ");
+    Serial.print(Tasks[i].LastTime);
+    Serial.print("us worst ");
+    Serial.print(Tasks[i].WorstCase);
+    Serial.print("us overruns ");
+    Serial.println(Tasks[i].Overruns);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Scheduler
+//////////////////////////////////////////////////////////////////////////////////////////////
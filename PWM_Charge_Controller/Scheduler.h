@@ -0,0 +1,49 @@
+#define SchedulerLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Scheduler class, a small cooperative task scheduler run from loop()
+//
+//  Tasks are plain functions run every Period milliseconds from millis(). Each run is timed,
+//  the longest run is kept as the worst case execution time, and a run that finishes more than
+//  Deadline ms after it was due counts as an overrun. Tasks must not block for long, anything
+//  that does (e.g. sleeping) holds every other task up and will show in the figures.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SCHEDULER_TASKS 6     //Fixed number of task slots
+
+typedef void (*TaskFunction)(void);
+
+struct Task {
+  TaskFunction Run;
+  unsigned long Period;       //ms between runs, 0 runs it every pass
+  unsigned long Deadline;     //ms after due time it must have finished by
+  unsigned long NextRun;      //millis() when next due
+  unsigned long LastTime;     //us the last run took
+  unsigned long WorstCase;    //us the longest run took
+  unsigned long Runs;
+  unsigned int Overruns;      //Runs that missed the deadline
+  bool Enabled;
+};
+
+class Scheduler {
+
+  public:
+        Scheduler (void);
+        byte Add (TaskFunction, unsigned long period, unsigned long deadline);
+        void Enable (byte task, bool on);
+        void SetPeriod (byte task, unsigned long period);
+        void RunNow (byte task);
+        void Run (void);
+        unsigned long WorstCase (byte task);
+        unsigned int Overruns (byte task);
+        void Report (void);
+
+  private:
+        Task Tasks[SCHEDULER_TASKS];
+        byte Count;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Scheduler
+//////////////////////////////////////////////////////////////////////////////////////////////
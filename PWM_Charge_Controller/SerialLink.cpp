@@ -0,0 +1,281 @@
+#include <Arduino.h>
+#include "SerialLink.h"
+#include "Probe.h"
+#include "EnergyMeter.h"
+
+/*  Serial Link
+ *
+ *  COBS: the frame is cut at each zero in the data, each piece is sent as a code byte (its
+ *  length + 1) then the piece without the zero. The decoder puts a zero back after every piece
+ *  but the last. Frames here are far below the 254 byte block limit, so there is never a code
+ *  of 0xFF and the overhead is always the one byte.
+ *
+ *  Decoding is done in place in the receive buffer, the decoded bytes are never ahead of the
+ *  encoded ones.
+ */
+
+unsigned int LinkCRC (const byte *data, byte len, unsigned int crc)
+{
+  while (len--)
+  {
+    crc ^= (unsigned int)(*data++) << 8;
+    for (byte i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return (crc & 0xFFFF);
+}
+
+//////////////////////////////////////////////////////////////
+//Build a frame, payload + CRC, COBS encoded and ending in 0.
+//frame needs len + 4 bytes. Returns the frame length.
+//////////////////////////////////////////////////////////////
+
+byte LinkEncode (const byte *payload, byte len, byte *frame)
+{
+  unsigned int crc = LinkCRC(payload, len);
+  byte code = 0;              //Where the current piece's code byte goes
+  byte n = 1;
+  for (byte i = 0; i < len + 2; i++)
+  {
+    byte c = (i < len) ? payload[i] : (i == len) ? (crc & 0xFF) : (crc >> 8);
+    if (c == 0)
+    {
+      frame[code] = n - code;
+      code = n++;
+    }
+    else frame[n++] = c;
+  }
+  frame[code] = n - code;
+  frame[n++] = 0;
+  return (n);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//Class LinkReader
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+LinkReader::LinkReader (void)
+{
+  Count = 0;
+  Size = 0;
+  Overrun = false;
+  Bad = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Feed a received byte in. True when it completes a good
+//frame, which stays in Payload() until the next byte.
+//////////////////////////////////////////////////////////////
+
+bool LinkReader::Receive (byte c)
+{
+  Size = 0;
+  if (c != 0)
+  {
+    if (Count < sizeof(Buffer)) Buffer[Count++] = c;
+    else Overrun = true;
+    return (false);
+  }
+
+  byte n = Count;
+  bool over = Overrun;
+  Count = 0;
+  Overrun = false;
+  if (n == 0) return (false);           //Zeros between frames
+  if (over)
+  {
+    Bad++;
+    return (false);
+  }
+
+  byte in = 0, out = 0;
+  while (in < n)
+  {
+    byte code = Buffer[in++];
+    if (in + code - 1 > n)
+    {
+      Bad++;
+      return (false);
+    }
+    for (byte i = 1; i < code; i++) Buffer[out++] = Buffer[in++];
+    if (in < n) Buffer[out++] = 0;
+  }
+
+  if (out < 3 || LinkCRC(Buffer, out - 2) != (unsigned int)(Buffer[out - 2] | (Buffer[out - 1] << 8)))
+  {
+    Bad++;
+    return (false);
+  }
+  Size = out - 2;
+  return (true);
+}
+
+const byte *LinkReader::Payload (void)
+{
+  return (Buffer);
+}
+
+byte LinkReader::Length (void)
+{
+  return (Size);
+}
+
+//Frames thrown away for a bad CRC, bad COBS or being too long
+unsigned int LinkReader::Errors (void)
+{
+  return (Bad);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//Class SerialLink
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+static byte *Put16 (byte *p, unsigned int v)
+{
+  *p++ = v & 0xFF;
+  *p++ = v >> 8;
+  return (p);
+}
+
+SerialLink::SerialLink (void)
+{
+  Seq = 0;
+  Drops = 0;
+}
+
+void SerialLink::Begin (void)
+{
+  Serial.begin(LINK_BAUD);
+}
+
+//////////////////////////////////////////////////////////////
+//Queue a frame for the UART interrupt to send. If the TX
+//buffer can't take all of it now it is dropped, not waited for.
+//////////////////////////////////////////////////////////////
+
+bool SerialLink::Send (const byte *payload, byte len)
+{
+  byte frame[LINK_MAX_FRAME];
+  if (len > LINK_MAX_PAYLOAD) len = LINK_MAX_PAYLOAD;
+  byte n = LinkEncode(payload, len, frame);
+  if (Serial.availableForWrite() < n)
+  {
+    Drops++;
+    return (false);
+  }
+  Serial.write(frame, n);
+  return (true);
+}
+
+void SerialLink::SendStatus (unsigned long seconds, unsigned int batterymV, unsigned int solarmV, byte state, byte duty, byte soc, byte channel)
+{
+  byte p[14];
+  p[0] = LINK_STATUS;
+  p[1] = Seq++;
+  Put16(p + 2, seconds & 0xFFFF);
+  Put16(p + 4, seconds >> 16);
+  Put16(p + 6, batterymV);
+  Put16(p + 8, solarmV);
+  p[10] = state;
+  p[11] = duty;
+  p[12] = soc;
+  p[13] = channel;
+  Send(p, sizeof(p));
+}
+
+//values are LINK_SETTING_COUNT settings, in LINK_SET order
+void SerialLink::SendSettings (const unsigned int *values, byte chemistry)
+{
+  byte p[2 + 2 * LINK_SETTING_COUNT];
+  byte *q = p + 1;
+  p[0] = LINK_SETTINGS;
+  for (byte i = 0; i < LINK_SETTING_COUNT; i++) q = Put16(q, values[i]);
+  *q = chemistry;
+  Send(p, sizeof(p));
+}
+
+void SerialLink::SendNak (byte command, byte reason)
+{
+  byte p[3] = {LINK_NAK, command, reason};
+  Send(p, 3);
+}
+
+//One probe's figures, the histogram scaled to shares of the runs so it fits a byte a bucket
+void SerialLink::SendProbe (byte probe, const ProbeStats &stats)
+{
+  byte p[4 + 16 + PROBE_BUCKETS];
+  unsigned long mean = stats.Count ? (unsigned long)(stats.Total / stats.Count) : 0;
+  unsigned long figures[4] = {stats.Count, stats.Min, stats.Max, mean};
+  p[0] = LINK_PROBE;
+  p[1] = probe;
+  byte *q = Put16(p + 2, PROBE_TICKS_PER_US);
+  for (byte i = 0; i < 4; i++)
+  {
+    q = Put16(q, figures[i] & 0xFFFF);
+    q = Put16(q, figures[i] >> 16);
+  }
+  unsigned long runs = 0;
+  for (byte b = 0; b < PROBE_BUCKETS; b++) runs += stats.Buckets[b];
+  for (byte b = 0; b < PROBE_BUCKETS; b++) *q++ = runs ? ((unsigned long)stats.Buckets[b] * 255 + runs / 2) / runs : 0;
+  Send(p, sizeof(p));
+}
+
+//An EnergyMeter's totals, see LINK_ENERGY
+void SerialLink::SendEnergy (byte channel, byte which, unsigned int days, const EnergyTotals &totals)
+{
+  byte p[27];
+  p[0] = LINK_ENERGY;
+  p[1] = channel;
+  p[2] = which;
+  byte *q = Put16(p + 3, days);
+  q = Put16(q, totals.Seconds & 0xFFFF);
+  q = Put16(q, totals.Seconds >> 16);
+  for (byte i = 0; i < 4; i++) q = Put16(q, (totals.DeliveredUj >> (16 * i)) & 0xFFFF);
+  for (byte i = 0; i < 4; i++) q = Put16(q, (totals.AvailableUj >> (16 * i)) & 0xFFFF);
+  Put16(q, totals.PeakmA);
+  Send(p, sizeof(p));
+}
+
+//////////////////////////////////////////////////////////////
+//Read what has arrived. True when a whole command has, it is
+//in Command() until Poll() is called again.
+//////////////////////////////////////////////////////////////
+
+bool SerialLink::Poll (void)
+{
+  while (Serial.available() > 0)
+  {
+    if (Reader.Receive(Serial.read())) return (true);
+  }
+  return (false);
+}
+
+const byte *SerialLink::Command (void)
+{
+  return (Reader.Payload());
+}
+
+byte SerialLink::CommandLength (void)
+{
+  return (Reader.Length());
+}
+
+//Wait for the TX buffer to empty, before powering down stops the UART mid frame
+void SerialLink::Flush (void)
+{
+  Serial.flush();
+}
+
+unsigned int SerialLink::Dropped (void)
+{
+  return (Drops);
+}
+
+unsigned int SerialLink::Errors (void)
+{
+  return (Reader.Errors());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class SerialLink
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,145 @@
+#define SerialLinkLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  SerialLink class, a framed binary protocol on the serial port
+//
+//  Takes the place of the DEBUG text for units in the field: it is on in a normal build, sends
+//  a short status record each control period and takes commands to change the charge settings
+//  without a rebuild. The DEBUG text uses the same UART, so it is one or the other.
+//
+//  Each frame is a payload, a CRC16 (CCITT, 0x1021 from 0xFFFF, low byte first) over it, COBS
+//  encoded so the only zero is the 0x00 that ends the frame. A receiver that starts mid-frame
+//  or sees a bad byte loses just that frame. Numbers are little endian, voltages in mV.
+//
+//  Board to host:
+//    LINK_STATUS    seq, seconds (4), battery (2), solar (2), state, duty 0-255, state of charge %,
+//                   charge channel. state as TelemetryLog's, seq counts up so lost frames show,
+//                   one frame per channel each control period
+//    LINK_SETTINGS  the charge profile in use, the LINK_SET values 1-10 in order (2 each)
+//                   then the chemistry
+//    LINK_NAK       command, reason
+//    LINK_PROBE     probe, ticks per us (2), runs (4), shortest (4), longest (4), mean (4) in ticks,
+//                   then the histogram, each bucket's share of the runs 0-255, see Probe.h
+//    LINK_ENERGY    channel, which, days (2), seconds (4), delivered (8), available (8) in uJ,
+//                   peak charge mA (2). which is a ChargePWM mode (PWM_xxx, since reset),
+//                   LINK_METER_TODAY or LINK_METER_DAY, see EnergyMeter.h. days is the roll-ups
+//                   since reset
+//  Host to board, each answered with LINK_SETTINGS or LINK_NAK:
+//    LINK_SET       setting, value (2)      changes the profile in use, not the saved one
+//    LINK_GET
+//    LINK_PRESET    chemistry               the charge figures for a battery type
+//    LINK_SAVE                              saves the profile in use to EEPROM
+//    LINK_CLEAR                             clears latched faults, see ChargeProtection.h
+//    LINK_PROBES    probe                   answered with LINK_PROBE, or LINK_NAK in a build
+//                                           without the probes
+//    LINK_METER     channel, which          answered with LINK_ENERGY
+//
+//  The Arduino core's Serial is already interrupt driven both ways (64 byte buffers), frames
+//  are only queued when the whole frame fits, otherwise dropped and counted, so sending never
+//  waits on the UART. Nothing is received while powered down, a command sent during a pause
+//  may need repeating.
+//
+//  Host side: link_decode (host/LinkDecode.cpp) reads and writes frames on a serial port.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SERIAL_LINK
+#define SERIAL_LINK 1         //0 leaves the serial port to the DEBUG text
+#endif
+
+#if defined(DEBUG) && SERIAL_LINK
+#error "DEBUG text and the serial link share the UART, build with SERIAL_LINK 0 to debug"
+#endif
+
+#define LINK_BAUD        57600
+#define LINK_MAX_PAYLOAD 28
+#define LINK_MAX_FRAME   (LINK_MAX_PAYLOAD + 2 + 2)   //With the CRC, COBS code byte and the zero
+
+//Frame types, the first byte of the payload
+#define LINK_STATUS   0x01
+#define LINK_SETTINGS 0x02
+#define LINK_NAK      0x03
+#define LINK_PROBE    0x04
+#define LINK_ENERGY   0x05
+#define LINK_SET      0x10
+#define LINK_GET      0x11
+#define LINK_PRESET   0x12
+#define LINK_SAVE     0x13
+#define LINK_CLEAR    0x14
+#define LINK_PROBES   0x15
+#define LINK_METER    0x16
+
+//LINK_METER, after the ChargePWM modes
+#define LINK_METER_TODAY 4      //So far today
+#define LINK_METER_DAY   5      //The last day rolled up
+#define LINK_METER_WHICH 6
+
+//Settings for LINK_SET, see ChargeProfile.h
+#define LINK_TARGET      1      //Absorption mV
+#define LINK_HYSTGAP     2
+#define LINK_WAITTIME    3
+#define LINK_FLOAT       4
+#define LINK_BULK        5
+#define LINK_ABSORBTIME  6      //Minutes
+#define LINK_BATT_HIGH   7      //Divider resistors
+#define LINK_BATT_LOW    8
+#define LINK_SOLAR_HIGH  9
+#define LINK_SOLAR_LOW  10
+#define LINK_SETTING_COUNT 10
+
+//LINK_NAK reasons
+#define LINK_BAD_COMMAND 1
+#define LINK_BAD_LENGTH  2
+#define LINK_BAD_VALUE   3
+
+struct ProbeStats;
+struct EnergyTotals;
+
+unsigned int LinkCRC (const byte *data, byte len, unsigned int crc = 0xFFFF);
+byte LinkEncode (const byte *payload, byte len, byte *frame);
+
+//Collects bytes into frames, COBS decodes them and checks the CRC
+class LinkReader {
+
+  public:
+        LinkReader (void);
+        bool Receive (byte c);
+        const byte *Payload (void);
+        byte Length (void);
+        unsigned int Errors (void);
+
+  private:
+        byte Buffer[LINK_MAX_FRAME];
+        byte Count;
+        byte Size;
+        bool Overrun;
+        unsigned int Bad;
+};
+
+class SerialLink {
+
+  public:
+        SerialLink (void);
+        void Begin (void);
+        bool Send (const byte *payload, byte len);
+        void SendStatus (unsigned long seconds, unsigned int batterymV, unsigned int solarmV, byte state, byte duty, byte soc, byte channel = 0);
+        void SendSettings (const unsigned int *values, byte chemistry);
+        void SendNak (byte command, byte reason);
+        void SendProbe (byte probe, const ProbeStats &stats);
+        void SendEnergy (byte channel, byte which, unsigned int days, const EnergyTotals &totals);
+        bool Poll (void);
+        const byte *Command (void);
+        byte CommandLength (void);
+        void Flush (void);
+        unsigned int Dropped (void);
+        unsigned int Errors (void);
+
+  private:
+        LinkReader Reader;
+        byte Seq;
+        unsigned int Drops;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class SerialLink
+//////////////////////////////////////////////////////////////////////////////////////////////
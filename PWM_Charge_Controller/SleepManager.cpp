@@ -0,0 +1,205 @@
+#include <Arduino.h>
+#include <LowPower.h>
+#include "SleepManager.h"
+
+/*  Sleep Manager
+ *
+ *  millis() stops while the chip is powered down, so the uptime clock adds the awake time
+ *  from millis() (a difference each call, so the 49 day wrap doesn't matter) to a count of
+ *  the sleeps.
+ *
+ *  Comparator check: with ACME set and the ADC off, the comparator's negative input comes
+ *  from the ADC multiplexer, and ACBG puts the 1.1V bandgap on the positive input. ACO is set
+ *  while the solar divider is below the bandgap. That is about 8.5V of panel with the standard
+ *  divider, too little to charge from, and takes ~100us against ~10ms for a scan of both
+ *  channels. The comparator is left disabled (ACD) the rest of the time, it is on from reset
+ *  and would otherwise draw current all night.
+ */
+
+#define BANDGAP_MV 1100
+
+SleepManager::SleepManager (int solarPin, int highSide, int lowSide)
+{
+  Channel = (solarPin >= A0) ? solarPin - A0 : solarPin;
+  SetDivider(highSide, lowSide);
+  Periods = 1;
+  LastmV = 0;
+  Dark = false;
+  DarkSince = 0;
+  Night = 0;
+  LastMillis = 0;
+  AwakeMillis = 0;
+  AwakeSeconds = 0;
+  SleptSeconds = 0;
+  ACSR = _BV(ACD);
+}
+
+//Panel voltage the comparator trips at, from the solar divider
+void SleepManager::SetDivider (int highSide, int lowSide)
+{
+  ThresholdmV = (unsigned int)((unsigned long)BANDGAP_MV * (highSide + lowSide) / lowSide);
+}
+
+//////////////////////////////////////////////////////////////
+//Start of a pause, charging has stopped so start checking
+//often in case it was just a cloud
+//////////////////////////////////////////////////////////////
+
+void SleepManager::Paused (void)
+{
+  Periods = 1;
+  LastmV = 0xFFFF;
+}
+
+void SleepManager::Sleep (void)
+{
+  Uptime();      //Bank the awake time first
+  for (byte i = 0; i < Periods; i++)
+  {
+    LowPower.powerDown(SLEEP_8S, ADC_OFF, BOD_OFF);  //From the LowPower library included.
+    SleptSeconds += SLEEP_PERIOD_S;
+  }
+  LastMillis = millis();
+}
+
+//////////////////////////////////////////////////////////////
+//True if the panel is above DarkmV(), see top of file
+//////////////////////////////////////////////////////////////
+
+bool SleepManager::SolarPresent (void)
+{
+  byte adcsra = ADCSRA;
+  ADCSRA = adcsra & ~(_BV(ADEN) | _BV(ADIF));
+  ADCSRB |= _BV(ACME);
+  ADMUX = (ADMUX & 0xF0) | Channel;
+  ACSR = _BV(ACBG);
+  delayMicroseconds(SLEEP_BANDGAP_US);
+  bool present = !(ACSR & _BV(ACO));
+  ACSR = _BV(ACD);
+  ADCSRB &= ~_BV(ACME);
+  ADCSRA = adcsra & ~_BV(ADIF);
+  return (present);
+}
+
+//////////////////////////////////////////////////////////////
+//Set the next sleep from a solar reading taken during a pause,
+//pass 0 when SolarPresent() said it was dark.
+//////////////////////////////////////////////////////////////
+
+void SleepManager::Update (unsigned int solarmV)
+{
+  unsigned long now = Uptime();
+  if (solarmV < ThresholdmV)
+  {
+    if (!Dark)
+    {
+      Dark = true;
+      DarkSince = now;
+    }
+    Periods = (Periods > SLEEP_MAX_PERIODS / 2) ? SLEEP_MAX_PERIODS : Periods * 2;
+  }
+  else
+  {
+    Dark = false;
+    //Getting lighter, look often. Fading or steady, back off a little.
+    if (solarmV > LastmV) Periods = 1;
+    else if (Periods < SLEEP_DIM_PERIODS) Periods++;
+    else Periods = SLEEP_DIM_PERIODS;
+  }
+  LastmV = solarmV;
+
+  //Don't sleep through the expected dawn, and wake every period close to it.
+  //If dawn is well overdue (a dark morning) the backoff carries on.
+  if (Dark && Night)
+  {
+    long left = (long)(Night - (now - DarkSince)) - SLEEP_DAWN_MARGIN;
+    if (left > -SLEEP_DAWN_MARGIN)
+    {
+      long most = (left > 0) ? left / SLEEP_PERIOD_S : 1;
+      if (most < 1) most = 1;
+      if (Periods > most) Periods = (byte)most;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////
+//Charging has started again. If it was dark for long enough to
+//be the night, remember how long for the next one.
+//////////////////////////////////////////////////////////////
+
+void SleepManager::Woke (void)
+{
+  if (DarkSince)
+  {
+    unsigned long night = Uptime() - DarkSince;
+    if (night >= SLEEP_MIN_NIGHT) Night = night;
+  }
+  Dark = false;
+  DarkSince = 0;
+  Periods = 1;
+}
+
+byte SleepManager::Interval (void)
+{
+  return (Periods);
+}
+
+unsigned int SleepManager::DarkmV (void)
+{
+  return (ThresholdmV);
+}
+
+//////////////////////////////////////////////////////////////
+//Seconds since reset, including time powered down
+//////////////////////////////////////////////////////////////
+
+unsigned long SleepManager::Uptime (void)
+{
+  unsigned long now = millis();
+  AwakeMillis += now - LastMillis;
+  LastMillis = now;
+  AwakeSeconds += AwakeMillis / 1000;
+  AwakeMillis %= 1000;
+  return (AwakeSeconds + SleptSeconds);
+}
+
+unsigned long SleepManager::NightSeconds (void)
+{
+  return (Night);
+}
+
+//////////////////////////////////////////////////////////////
+//Average board current since reset, in uA
+//////////////////////////////////////////////////////////////
+
+unsigned long SleepManager::AverageMicroAmps (void)
+{
+  unsigned long total = Uptime();
+  if (total == 0) return (SLEEP_AWAKE_UA);
+  //In float, the products run past 32 bits within days
+  return ((unsigned long)(((float)AwakeSeconds * SLEEP_AWAKE_UA + (float)SleptSeconds * SLEEP_ASLEEP_UA) / total));
+}
+
+//////////////////////////////////////////////////////////////
+//Print the sleep figures, for debugging on the Serial port
+//////////////////////////////////////////////////////////////
+
+void SleepManager::Report (void)
+{
+  unsigned long average = AverageMicroAmps();
+  Serial.print("Sleep: up ");
+  Serial.print(AwakeSeconds + SleptSeconds);
+  Serial.print("s awake ");
+  Serial.print(AwakeSeconds);
+  Serial.print("s next ");
+  Serial.print(Periods * SLEEP_PERIOD_S);
+  Serial.print("s night ");
+  Serial.print(Night);
+  Serial.print("s average ");
+  Serial.print(average);
+  Serial.println("uA");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class SleepManager
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,66 @@
+#define SleepManagerLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  SleepManager class, sets how long the controller powers down for while the solar panel
+//  can't charge, and keeps the figures for what that costs the battery.
+//
+//  The chip can only power down for 8s at a time (the watchdog's longest period), so the sleep
+//  is a number of 8s periods. After each sleep a cheap comparator check, solar divider against
+//  the 1.1V bandgap, says whether there is enough light to be worth a full A-D scan. Once it is
+//  dark the sleep doubles each check up to SLEEP_MAX_PERIODS. The length of the last night is
+//  learnt, and the sleep is cut back to a single period near the time dawn is expected.
+//
+//  The comparator can't wake the chip from power down (only from idle, which costs milliamps
+//  with the timers running), so it is polled on each watchdog wake instead.
+//
+//  Average current is estimated from the time spent awake and asleep, with the board's
+//  currents set by SLEEP_AWAKE_UA and SLEEP_ASLEEP_UA.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SLEEP_PERIOD_S      8     //One watchdog power down
+#define SLEEP_MAX_PERIODS  75     //Longest sleep once dark, 10 minutes
+#define SLEEP_DIM_PERIODS   4     //Longest sleep while there is some light
+#define SLEEP_DAWN_MARGIN 1800    //Seconds either side of expected dawn to wake every period
+#define SLEEP_MIN_NIGHT  14400    //Darkness shorter than this is weather, not night
+#define SLEEP_BANDGAP_US  100     //Bandgap start up before the comparator can be read
+
+//Board currents for the estimate, in uA. Measure these for your board, the defaults are
+//a bare ATmega328P with the charge pump and LED off, and awake at 16MHz.
+#define SLEEP_AWAKE_UA   15000
+#define SLEEP_ASLEEP_UA     30
+
+class SleepManager {
+
+  public:
+        SleepManager (int solarPin, int highSide, int lowSide);
+        void SetDivider (int highSide, int lowSide);
+        void Paused (void);
+        void Sleep (void);
+        bool SolarPresent (void);
+        void Update (unsigned int solarmV);
+        void Woke (void);
+        byte Interval (void);
+        unsigned int DarkmV (void);
+        unsigned long Uptime (void);
+        unsigned long NightSeconds (void);
+        unsigned long AverageMicroAmps (void);
+        void Report (void);
+
+  private:
+        byte Channel;                 //ADC multiplexer channel of the solar divider
+        unsigned int ThresholdmV;     //Solar voltage at which the divider reaches the bandgap
+        byte Periods;                 //Watchdog periods to sleep next time
+        unsigned int LastmV;
+        bool Dark;
+        unsigned long DarkSince;      //Uptime() when it went dark
+        unsigned long Night;          //Length of the last night, seconds, 0 until learnt
+        unsigned long LastMillis;
+        unsigned long AwakeMillis;    //Part second of awake time
+        unsigned long AwakeSeconds;
+        unsigned long SleptSeconds;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class SleepManager
+//////////////////////////////////////////////////////////////////////////////////////////////
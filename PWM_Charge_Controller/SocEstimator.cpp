@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <math.h>
+#include "SocEstimator.h"
+
+/*  State of Charge
+ *
+ *  The panel formula comes from the single diode model, I = IL - I0 x (exp(V / Vt) - 1), with
+ *  IL proportional to the light. At open circuit I = 0, so IL = I0 x exp(Voc / Vt) near enough,
+ *  and I0 is fixed by the panel's STC figures, Isc = I0 x exp(VocSTC / Vt). Putting those
+ *  together gets rid of both unknowns, leaving the formula at the top of SocEstimator.h. With
+ *  the panel near open circuit (Voc close to Vbattery) the two terms nearly cancel, which is
+ *  right, there is hardly any current to be had.
+ *
+ *  Rounding: the current is worked out in mA once per Update(), the average over the period
+ *  is what goes into the count, so nothing is lost by the interval being long.
+ */
+
+#define MAS_PER_AH 3600000L
+
+SocEstimator::SocEstimator (unsigned int capacityAh, unsigned int iscmA, unsigned int vocmV, unsigned int vtmV)
+{
+  Capacity = capacityAh * MAS_PER_AH;
+  Charge = Capacity / 2;
+  IscmA = iscmA;
+  VocmV = vocmV;
+  VtmV = vtmV;
+  OpenmV = 0;
+  LastmA = 0;
+  Last = 0;
+  Charged = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Start from a reading of the battery at rest, call once the
+//first reading is in
+//////////////////////////////////////////////////////////////
+
+void SocEstimator::Begin (unsigned int restmV, unsigned long seconds)
+{
+  Charge = RestCharge(restmV);
+  Last = seconds;
+  Charged = seconds;
+}
+
+//Carry on from a figure kept through a reset, in place of Begin()
+void SocEstimator::Resume (unsigned int permille, unsigned long seconds)
+{
+  if (permille > 1000) permille = 1000;
+  Charge = (Capacity / 1000) * (long)permille;
+  Last = seconds;
+  Charged = seconds;
+}
+
+//mA into the battery at full on, from the panel model, see top of file
+unsigned int SocEstimator::PanelmA (unsigned int panelmV, unsigned int batterymV)
+{
+  if (panelmV <= batterymV) return (0);
+  float i = IscmA * (exp(((float)panelmV - VocmV) / VtmV) - exp(((float)batterymV - VocmV) / VtmV));
+  if (i > IscmA * 2.0) i = IscmA * 2.0;     //Panel reading well over VocSTC, a bad reading
+  return ((unsigned int)i);
+}
+
+//Full on into the battery now, from the last open circuit panel reading, for the EnergyMeter
+unsigned int SocEstimator::AvailablemA (unsigned int batterymV)
+{
+  return (PanelmA(OpenmV, batterymV));
+}
+
+//////////////////////////////////////////////////////////////
+//Count the charge since the last Update(), call with each new
+//reading. duty is 0-255 of full on, what the charge has been
+//since the last call.
+//////////////////////////////////////////////////////////////
+
+void SocEstimator::Update (unsigned int batterymV, unsigned int solarmV, bool openCircuit, byte duty, unsigned int drainmA, unsigned long seconds)
+{
+  if (openCircuit) OpenmV = solarmV;
+  unsigned long dt = seconds - Last;
+  Last = seconds;
+
+  LastmA = (unsigned long)PanelmA(OpenmV, batterymV) * duty * SOC_EFFICIENCY / (255UL * 100);
+  if (duty) Charged = seconds;
+  Charge += ((long)LastmA - drainmA) * (long)dt;
+  if (Charge > Capacity) Charge = Capacity;
+  if (Charge < 0) Charge = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//A reading with no charge going in, moves the count part way
+//to what the voltage says once the battery has rested
+//////////////////////////////////////////////////////////////
+
+void SocEstimator::Rest (unsigned int batterymV, unsigned long seconds)
+{
+  if (seconds - Charged < SOC_REST_SECONDS) return;
+  Charge += (RestCharge(batterymV) - Charge) >> SOC_CORRECT_SHIFT;
+}
+
+//The end of absorption, the battery has taken all it will
+void SocEstimator::Full (void)
+{
+  Charge = Capacity;
+}
+
+long SocEstimator::RestCharge (unsigned int batterymV)
+{
+  if (batterymV <= SOC_EMPTY_MV) return (0);
+  if (batterymV >= SOC_FULL_MV) return (Capacity);
+  return ((Capacity / (SOC_FULL_MV - SOC_EMPTY_MV)) * (long)(batterymV - SOC_EMPTY_MV));
+}
+
+byte SocEstimator::Percent (void)
+{
+  return ((Permille() + 5) / 10);
+}
+
+unsigned int SocEstimator::Permille (void)
+{
+  return ((unsigned int)((Charge + Capacity / 2000) / (Capacity / 1000)));
+}
+
+//Average charge current over the last Update(), after SOC_EFFICIENCY
+unsigned int SocEstimator::ChargemA (void)
+{
+  return (LastmA);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class SocEstimator
+//////////////////////////////////////////////////////////////////////////////////////////////
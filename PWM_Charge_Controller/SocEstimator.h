@@ -0,0 +1,71 @@
+#define SocEstimatorLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  SocEstimator class, state of charge by counting the charge in and out
+//
+//  The battery voltage on its own says little while charging, surface charge holds it up for
+//  an hour or more after the current stops. This keeps a running count instead:
+//
+//  In, worked out from the panel model, not the CurrentSensor, on purpose: on pwm_charge_sim's
+//  three_days profile the model is out by 0.5% on average, the measured current 0.6%, and it
+//  keeps the EnergyMeter's available (this model) apart from its delivered (the sensor), so a
+//  panel or sensor going wrong shows up between them. The open circuit panel voltage gives
+//  the light level, and with the switch closed the panel sits at the battery voltage, so the
+//  diode equation for a panel of the configured Isc and Voc gives
+//
+//      I = Isc x (exp((Voc - VocSTC) / Vt) - exp((Vbattery - VocSTC) / Vt))
+//
+//  times the duty, less SOC_EFFICIENCY for what goes into gassing and heat.
+//  Out, the drain given to Update(), the board's own current and any load.
+//
+//  Corrected towards the rest voltage (SOC_EMPTY_MV to SOC_FULL_MV, straight line, near
+//  enough for lead acid) in steps once the battery has had SOC_REST_SECONDS without charge,
+//  so it settles overnight, and set to full at the end of absorption.
+//
+//  Open circuit panel readings are those taken with the switch open: in-phase samples, a
+//  suspended full on, or with the charge off. The last one is kept for when there isn't one.
+//
+//  Charge is held in mA seconds in a long, good for batteries to about 590Ah. The exp()s are
+//  float, once a control period.
+//
+//  Host side: pwm_charge_sim compares the estimate with its battery model as it runs.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SOC_EMPTY_MV      11900     //Rest voltage of a 12V battery, flat
+#define SOC_FULL_MV       12700     //and full
+#define SOC_EFFICIENCY       95     //Percent of the charge current that ends up stored
+#define SOC_REST_SECONDS   3600     //Without charge before the rest voltage is believed
+#define SOC_CORRECT_SHIFT     2     //Each correction takes 1/4 of the way to the rest voltage figure
+
+class SocEstimator {
+
+  public:
+        SocEstimator (unsigned int capacityAh, unsigned int iscmA, unsigned int vocmV, unsigned int vtmV);
+        void Begin (unsigned int restmV, unsigned long seconds);
+        void Resume (unsigned int permille, unsigned long seconds);
+        void Update (unsigned int batterymV, unsigned int solarmV, bool openCircuit, byte duty, unsigned int drainmA, unsigned long seconds);
+        void Rest (unsigned int batterymV, unsigned long seconds);
+        void Full (void);
+        byte Percent (void);
+        unsigned int Permille (void);
+        unsigned int ChargemA (void);
+        unsigned int PanelmA (unsigned int panelmV, unsigned int batterymV);
+        unsigned int AvailablemA (unsigned int batterymV);
+
+  private:
+        long RestCharge (unsigned int batterymV);
+        long Capacity;              //mA seconds
+        long Charge;
+        unsigned int IscmA;         //Panel at 1000W/m2
+        unsigned int VocmV;
+        unsigned int VtmV;          //Cells x ideality x kT/q
+        unsigned int OpenmV;        //Last open circuit panel reading
+        unsigned int LastmA;        //Average charge current over the last Update()
+        unsigned long Last;         //Seconds at the last Update()
+        unsigned long Charged;      //Last time there was charge
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class SocEstimator
+//////////////////////////////////////////////////////////////////////////////////////////////
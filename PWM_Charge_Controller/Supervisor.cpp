@@ -0,0 +1,144 @@
+#include <Arduino.h>
+#include <avr/wdt.h>
+#include <string.h>
+#include "Supervisor.h"
+#include "SerialLink.h"
+
+/*  Supervisor
+ *
+ *  The record and the reset counts are kept together, so one CRC (the serial link's) covers
+ *  both. Nothing clears .noinit, so after a power on it holds whatever the RAM came up as;
+ *  the magic number and CRC are what tell it from a record, PORF is only a quicker way out.
+ *
+ *  A channel's Saved bit is clear until its first Tick() after a power on, a reset before
+ *  then has the counts to keep but no record to carry on from.
+ */
+
+#define KEPT_MAGIC 0x5A17
+
+struct KeptMemory {
+  unsigned int Magic;
+  RecoveryRecord Charge[SUPERVISE_CHANNELS];
+  byte Saved;                       //Bit per channel
+  unsigned int Resets[RESET_CAUSES];
+  unsigned int CRC;                 //Over everything above
+};
+
+#ifdef __AVR__
+static byte ResetCause __attribute__((section(".noinit")));
+static KeptMemory Kept __attribute__((section(".noinit")));
+
+//Before the C runtime, see Supervisor.h. Naked, there is no stack frame yet.
+void SuperviseEarly (void) __attribute__((naked, used, section(".init3")));
+void SuperviseEarly (void)
+{
+  byte passed;
+  __asm__ __volatile__ ("mov %0, r2" : "=r" (passed));
+  ResetCause = MCUSR;
+  if (!ResetCause && !(passed & 0xF0)) ResetCause = passed;
+  MCUSR = 0;
+  wdt_disable();
+}
+#else
+static byte ResetCause;
+static KeptMemory Kept;
+#endif
+
+static unsigned int KeptCRC (void)
+{
+  return (LinkCRC((const byte *)&Kept, sizeof(Kept) - sizeof(Kept.CRC)));
+}
+
+Supervisor::Supervisor (void)
+{
+  Valid = false;
+  Flags = 0;
+  LastTick = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Find out why the chip reset and whether the record survived
+//it, then count the reset. Call first thing in setup().
+//////////////////////////////////////////////////////////////
+
+void Supervisor::Begin (void)
+{
+#ifndef __AVR__
+  ResetCause = MCUSR;
+  MCUSR = 0;
+#endif
+  Flags = ResetCause;
+  Valid = !(Flags & _BV(PORF)) && Kept.Magic == KEPT_MAGIC && Kept.CRC == KeptCRC();
+  if (!Valid)
+  {
+    memset(&Kept, 0, sizeof(Kept));
+    Kept.Magic = KEPT_MAGIC;
+  }
+  else
+  {
+    static const byte Causes[RESET_CAUSES] = {_BV(EXTRF), _BV(BORF), _BV(WDRF)};
+    for (byte c = 0; c < RESET_CAUSES; c++)
+      if ((Flags & Causes[c]) && Kept.Resets[c] < 0xFFFF) Kept.Resets[c]++;
+  }
+  Seal();
+}
+
+//True if there is a record from before the reset to carry on from
+bool Supervisor::Recovered (byte channel)
+{
+  return (Valid && channel < SUPERVISE_CHANNELS && (Kept.Saved & _BV(channel)));
+}
+
+const RecoveryRecord &Supervisor::Record (byte channel)
+{
+  return (Kept.Charge[channel < SUPERVISE_CHANNELS ? channel : 0]);
+}
+
+//MCUSR as it was at the reset, PORF, EXTRF, BORF and WDRF
+byte Supervisor::ResetFlags (void)
+{
+  return (Flags);
+}
+
+//Resets of a cause since the last power on
+unsigned int Supervisor::Resets (byte cause)
+{
+  return ((cause < RESET_CAUSES) ? Kept.Resets[cause] : 0);
+}
+
+//Watchdog on, at the end of setup() and after each sleep
+void Supervisor::Arm (void)
+{
+  LastTick = millis();
+  wdt_enable(SUPERVISE_TIMEOUT);
+}
+
+//The control loop checking in, with where a channel has got to
+void Supervisor::Tick (byte channel, const RecoveryRecord &r)
+{
+  if (channel >= SUPERVISE_CHANNELS) return;
+  LastTick = millis();
+  Kept.Charge[channel] = r;
+  Kept.Saved |= _BV(channel);
+  Seal();
+}
+
+//////////////////////////////////////////////////////////////
+//From the supervise task. Feeds the watchdog if the control
+//loop has checked in within the last limit ms, otherwise
+//leaves it to run out.
+//////////////////////////////////////////////////////////////
+
+void Supervisor::Feed (unsigned long limit)
+{
+  if (millis() - LastTick <= limit) wdt_reset();
+}
+
+void Supervisor::Seal (void)
+{
+  Kept.CRC = KeptCRC();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Supervisor
+//////////////////////////////////////////////////////////////////////////////////////////////
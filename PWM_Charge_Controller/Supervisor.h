@@ -0,0 +1,81 @@
+#define SupervisorLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Supervisor class, the watchdog, why the chip last reset and what to carry on with after one
+//
+//  Watchdog: Arm() turns it on in reset mode for SUPERVISE_TIMEOUT. It is fed by the sketch's
+//  supervise task, but only while the control loop has checked in (Tick()) within the limit
+//  given to Feed(). So a task that never returns stops the scheduler and the feeding, and a
+//  control loop that has stopped being run stops the feeding too, either way the chip resets
+//  with the charge switch off rather than being left at whatever duty it had.
+//
+//  The Low-Power library uses the watchdog as its wake up timer and leaves it off after a
+//  power down, so Arm() has to be called again after each sleep. Power down itself isn't
+//  watched, there is nothing running to hang.
+//
+//  Reset cause: MCUSR is read and cleared in .init3, before the C runtime, as the watchdog is
+//  still on after a watchdog reset and would go off again before setup() got to it. The
+//  Uno's optiboot clears MCUSR before starting the sketch; newer optiboots pass it on in r2,
+//  which is used if MCUSR reads 0 and r2 looks like a set of reset flags. With the older one
+//  every reset reads as 0, not counted.
+//
+//  Recovery record: kept in .noinit RAM, which the C runtime doesn't clear, so it lasts
+//  through any reset but a power on. It has the charge state, the waveform and its duty, the
+//  absorption time so far, latched faults, the state of charge, the profile it was for (a CRC
+//  of it) and the control law, with a CRC over the lot. Begin() checks it; a power on, a
+//  brown out that took the RAM with it or a reset part way through Tick() all fail the CRC
+//  and the sketch starts afresh. Whether to resume is up to the sketch, see setup(). There is
+//  one record for each charge channel, up to SUPERVISE_CHANNELS, each saved by its own Tick().
+//
+//  Reset counts: external, brown out and watchdog resets since the last power on, kept in the
+//  same record. They go to the boot record in the TelemetryLog.
+//
+//  The brown out detector is left off in power down (BOD_OFF, SleepManager), it only saves
+//  the ~20uA it takes while asleep: it is back on as the chip wakes, before any code runs.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SUPERVISE_TIMEOUT WDTO_4S     //Watchdog, longer than anything a task does awake
+#define SUPERVISE_CHANNELS 2          //Recovery records kept, one per charge channel
+
+//Reset counts, by cause
+#define RESET_EXTERNAL 0
+#define RESET_BROWNOUT 1
+#define RESET_WATCHDOG 2
+#define RESET_CAUSES   3
+
+//What the sketch needs to carry on where it was
+struct RecoveryRecord {
+  byte State;                     //ChargeStateMachine's CHARGE_xxx
+  byte Mode;                      //ChargePWM's PWM_xxx
+  unsigned int Pulse;             //and its duty, in timer counts
+  unsigned long AbsorbSeconds;
+  byte Faults;                    //Latched by ChargeProtection
+  bool Hysteresis;                //Control law, a different build doesn't resume
+  unsigned int ProfileId;         //CRC of the charge profile
+  unsigned int SocPermille;
+};
+
+class Supervisor {
+
+  public:
+        Supervisor (void);
+        void Begin (void);
+        bool Recovered (byte channel = 0);
+        const RecoveryRecord &Record (byte channel = 0);
+        byte ResetFlags (void);
+        unsigned int Resets (byte cause);
+        void Arm (void);
+        void Tick (byte channel, const RecoveryRecord &r);
+        void Feed (unsigned long limit);
+
+  private:
+        void Seal (void);
+        bool Valid;                     //The record was good at Begin()
+        byte Flags;                     //MCUSR at reset
+        unsigned long LastTick;         //millis()
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Supervisor
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "TelemetryLog.h"
+
+/*  Telemetry Log
+ *
+ *  Head finding: writes go round the slots in order with the sequence counting up (mod 255),
+ *  so reading from slot 0 each sequence is one more than the last until the slot after the
+ *  newest record. That slot is either erased (0xFF) or holds the oldest record, whose sequence
+ *  is one more than the newest less the number of slots. With 120 slots and a count of 255
+ *  that can't be mistaken for the next in line. If every slot follows on, the newest is the
+ *  last slot and the next write goes back to slot 0.
+ */
+
+#define SEQ_EMPTY 0xFF
+#define SEQ_MOD   255
+#define KIND_DAY  (1 << 3)      //In the state byte with TELEMETRY_BOOT, see TelemetryLog.h
+
+//A week of readings and day records for every channel, the period going up with the channels
+static_assert(TELEMETRY_DAYS * 86400UL / TELEMETRY_PERIOD + TELEMETRY_DAYS * TELEMETRY_CHANNELS <=
+              (E2END + 1 - TELEMETRY_BASE) / TELEMETRY_RECORD, "The telemetry log must hold TELEMETRY_DAYS");
+
+static byte NextSeq (byte s)
+{
+  return ((s + 1) % SEQ_MOD);
+}
+
+TelemetryLog::TelemetryLog (byte channels)
+{
+  SlotCount = (E2END + 1 - TELEMETRY_BASE) / TELEMETRY_RECORD;
+  Period = (unsigned long)TELEMETRY_PERIOD * (channels ? channels : 1);
+  Next = 0;
+  Seq = 0;
+  Used = 0;
+  for (byte c = 0; c < TELEMETRY_CHANNELS; c++)
+  {
+    LastAdd[c] = 0;
+    Started[c] = false;
+  }
+  Queued = 0;
+}
+
+int TelemetryLog::Address (int slot)
+{
+  return (TELEMETRY_BASE + slot * TELEMETRY_RECORD);
+}
+
+//////////////////////////////////////////////////////////////
+//Find where the log got to, see top of file
+//////////////////////////////////////////////////////////////
+
+void TelemetryLog::Scan (void)
+{
+  Next = 0;
+  Seq = 0;
+  Used = 0;
+  byte prev = EEPROM.read(Address(0));
+  if (prev == SEQ_EMPTY) return;
+  Used = 1;
+  for (int i = 1; i < SlotCount; i++)
+  {
+    byte s = EEPROM.read(Address(i));
+    if (s != NextSeq(prev))
+    {
+      Next = i;
+      Seq = NextSeq(prev);
+      if (s != SEQ_EMPTY) Used = SlotCount;   //Wrapped, the rest are older records
+      return;
+    }
+    prev = s;
+    Used++;
+  }
+  Next = 0;                                   //Every slot in order, the newest is the last
+  Seq = NextSeq(prev);
+}
+
+//////////////////////////////////////////////////////////////
+//Call once from setup(), finds the end of the log and writes
+//a boot record so resets, and why, show up in the history.
+//////////////////////////////////////////////////////////////
+
+void TelemetryLog::Begin (unsigned long seconds, byte resetFlags, unsigned int watchdogResets, unsigned int brownoutResets)
+{
+  Scan();
+  Add(seconds, watchdogResets, brownoutResets, TELEMETRY_BOOT, resetFlags, 0);
+  Commit();
+}
+
+//True when it is time for a channel's next record
+bool TelemetryLog::Due (unsigned long seconds, byte channel)
+{
+  if (channel >= TELEMETRY_CHANNELS) return (false);
+  return (!Started[channel] || seconds - LastAdd[channel] >= Period);
+}
+
+//////////////////////////////////////////////////////////////
+//Queue a record, written out once TELEMETRY_BATCH are waiting.
+//A day record doesn't count towards the readings being Due().
+//////////////////////////////////////////////////////////////
+
+void TelemetryLog::Add (unsigned long seconds, unsigned int batterymV, unsigned int solarmV, byte state, byte duty, byte soc, byte channel)
+{
+  if (channel >= TELEMETRY_CHANNELS) return;
+  for (byte c = 0; c < TELEMETRY_CHANNELS && state != TELEMETRY_DAY; c++)
+    if (c == channel || state == TELEMETRY_BOOT)
+    {
+      LastAdd[c] = seconds;
+      Started[c] = (state != TELEMETRY_BOOT);
+    }
+  if (Queued >= TELEMETRY_BATCH) Commit();
+  TelemetryRecord &r = Queue[Queued++];
+  r.minutes = (unsigned int)(seconds / 60);
+  r.batterymV = batterymV;
+  r.solarmV = solarmV;
+  r.state = state;
+  r.soc = soc;
+  r.duty = duty;
+  r.channel = channel;
+  if (Queued >= TELEMETRY_BATCH) Commit();
+}
+
+void TelemetryLog::Commit (void)
+{
+  for (byte i = 0; i < Queued; i++) Write(Queue[i]);
+  Queued = 0;
+}
+
+byte TelemetryLog::Pending (void)
+{
+  return (Queued);
+}
+
+void TelemetryLog::Write (const TelemetryRecord &r)
+{
+  bool boot = (r.state >= TELEMETRY_BOOT);      //Reset counts or energy, not scaled
+  unsigned int bat = boot ? r.batterymV : (r.batterymV + 2) / 5;
+  unsigned int sol = boot ? r.solarmV : (r.solarmV + 5) / 10;
+  byte soc = (r.soc >= 100) ? 31 : (r.soc * 31 + 50) / 100;
+  byte state = (r.state == TELEMETRY_DAY) ? TELEMETRY_BOOT | KIND_DAY : (r.state & 0x07) | (soc << 3);
+  if (bat > 0x0FFF) bat = 0x0FFF;
+  if (sol > 0x0FFF) sol = 0x0FFF;
+
+  unsigned int minutes = (r.minutes & 0x7FFF) | ((r.channel & 1) << 15);
+
+  int a = Address(Next);
+  EEPROM.update(a + 1, minutes & 0xFF);
+  EEPROM.update(a + 2, minutes >> 8);
+  EEPROM.update(a + 3, bat & 0xFF);
+  EEPROM.update(a + 4, (bat >> 8) | ((sol & 0x0F) << 4));
+  EEPROM.update(a + 5, sol >> 4);
+  EEPROM.update(a + 6, state);
+  EEPROM.update(a + 7, r.duty);
+  EEPROM.update(a, Seq);                      //Last, this is what makes the record count
+
+  Seq = NextSeq(Seq);
+  if (++Next >= SlotCount) Next = 0;
+  if (Used < SlotCount) Used++;
+}
+
+int TelemetryLog::Slots (void)
+{
+  return (SlotCount);
+}
+
+//Records in the EEPROM, not counting any still waiting in RAM
+int TelemetryLog::Count (void)
+{
+  return (Used);
+}
+
+//////////////////////////////////////////////////////////////
+//Read back a record, 0 is the oldest. False if there isn't one.
+//////////////////////////////////////////////////////////////
+
+bool TelemetryLog::Read (int index, TelemetryRecord &r)
+{
+  if (index < 0 || index >= Used) return (false);
+  int slot = Next - Used + index;
+  if (slot < 0) slot += SlotCount;
+  int a = Address(slot);
+  if (EEPROM.read(a) == SEQ_EMPTY) return (false);
+  r.minutes = EEPROM.read(a + 1) | (EEPROM.read(a + 2) << 8);
+  r.channel = r.minutes >> 15;
+  r.minutes &= 0x7FFF;
+  byte b4 = EEPROM.read(a + 4);
+  byte s = EEPROM.read(a + 6);
+  bool boot = ((s & 0x07) == TELEMETRY_BOOT);
+  r.batterymV = (EEPROM.read(a + 3) | ((b4 & 0x0F) << 8)) * (boot ? 1 : 5);
+  r.solarmV = ((b4 >> 4) | (EEPROM.read(a + 5) << 4)) * (boot ? 1 : 10);
+  r.state = (s == (TELEMETRY_BOOT | KIND_DAY)) ? TELEMETRY_DAY : s & 0x07;
+  r.soc = boot ? 0 : ((s >> 3) * 100 + 15) / 31;
+  r.duty = EEPROM.read(a + 7);
+  return (true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class TelemetryLog
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,104 @@
+#define TelemetryLogLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  TelemetryLog class, a history of the charger kept in EEPROM
+//
+//  Fixed 8 byte records in a circular buffer from TELEMETRY_BASE to the end of the EEPROM,
+//  the space below is left for settings. Every slot is written once per trip round, so the
+//  wear is spread evenly; at one record every TELEMETRY_PERIOD the 100,000 write life of the
+//  cells is centuries away. The log is sized to hold a week: with one charge channel that is
+//  84 records two hours apart and 7 day records in the 120 slots of a 1K EEPROM, leaving room
+//  for a boot record most days. With more channels, given to the constructor, each channel's
+//  period is that many times longer (4 hours for two) so it still covers the week, at the cost
+//  of fewer readings a channel.
+//
+//  Record layout, little endian:
+//    0     sequence, counts 0-254 round and round, 0xFF is an empty (erased) slot
+//    1-2   minutes since reset (15 bits), the log has a boot record at each reset to line them
+//          up. The top bit is the charge channel. They wrap after 32768 minutes, about 22.7
+//          days up; records are at most a period apart, so one that is less than the record
+//          before it since the last boot record has wrapped, telemetry_dump adds the 32768.
+//    3-5   battery in 5mV steps (12 bits), then solar in 10mV steps (12 bits)
+//    6     state, the ChargeStateMachine's CHARGE_xxx or TELEMETRY_BOOT, in the low 3 bits. The top
+//          5 bits are the state of charge, 0-31 for 0-100%
+//    7     charge duty, 0-255 of full on
+//
+//  TELEMETRY_BOOT in the state bits is a record with no readings, the top 5 bits say which:
+//
+//    0     a boot record, why the chip reset: 3-5 hold the Supervisor's counts of watchdog then
+//          brown out resets since the last power on (12 bits each, as they are) and 7 the reset
+//          flags, MCUSR.
+//    1     a day record (TELEMETRY_DAY), a channel's EnergyMeter roll-up: 3-5 the energy
+//          delivered then available in tenths of a Wh (12 bits each, stopping at 409.5Wh) and
+//          7 the peak charge current in TELEMETRY_PEAK_MA steps.
+//
+//  In a TelemetryRecord read back they are in batterymV, solarmV and duty, as they are.
+//
+//  The sequence byte is written last, so a record cut short by a reset reads as the end of
+//  the log. At start up the head is found as the first slot that doesn't follow on from the
+//  one before.
+//
+//  Records are held in RAM and written TELEMETRY_BATCH at a time (or by Commit()), using
+//  EEPROM.update() so bytes that haven't changed cost nothing. An EEPROM byte write takes
+//  3.3ms with the CPU waiting, a batch is best written when the controller is awake anyway.
+//
+//  An EEPROM image read off the board (avrdude -U eeprom:r:log.bin:r) is turned into CSV by
+//  the host build's telemetry_dump, see host/TelemetryDump.cpp.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define TELEMETRY_BASE   64       //EEPROM below this is left for settings
+#define TELEMETRY_RECORD  8
+#define TELEMETRY_BATCH   4       //Records held in RAM before writing
+#define TELEMETRY_PERIOD 7200     //Seconds between records with one channel, see above
+#define TELEMETRY_DAYS      7     //The log holds at least this, see TelemetryLog.cpp
+#define TELEMETRY_CHANNELS  2     //Charge channels a record can be for
+
+//State for the first record after a reset, the others are CHARGE_OFF to CHARGE_SLEEPING
+#define TELEMETRY_BOOT     7
+#define TELEMETRY_DAY      8      //Read back and given to Add(), stored as TELEMETRY_BOOT, see above
+#define TELEMETRY_TENTHS_MAX 0x0FFF
+#define TELEMETRY_PEAK_MA   50
+
+struct TelemetryRecord {
+  unsigned int minutes;
+  unsigned int batterymV;
+  unsigned int solarmV;
+  byte state;
+  byte soc;                       //Percent, to the nearest 3% or so
+  byte duty;
+  byte channel;
+};
+
+class TelemetryLog {
+
+  public:
+        TelemetryLog (byte channels = 1);
+        void Begin (unsigned long seconds, byte resetFlags, unsigned int watchdogResets, unsigned int brownoutResets);
+        bool Due (unsigned long seconds, byte channel = 0);
+        void Add (unsigned long seconds, unsigned int batterymV, unsigned int solarmV, byte state, byte duty, byte soc, byte channel = 0);
+        void Commit (void);
+        byte Pending (void);
+        void Scan (void);
+        int Slots (void);
+        int Count (void);
+        bool Read (int index, TelemetryRecord &r);
+
+  private:
+        int SlotCount;
+        unsigned long Period;           //Between a channel's records
+        int Next;                       //Slot the next record goes in
+        byte Seq;                       //Sequence number it gets
+        int Used;                       //Slots holding records
+        unsigned long LastAdd[TELEMETRY_CHANNELS];
+        bool Started[TELEMETRY_CHANNELS];
+        TelemetryRecord Queue[TELEMETRY_BATCH];
+        byte Queued;
+
+        int Address (int slot);
+        void Write (const TelemetryRecord &r);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class TelemetryLog
+//////////////////////////////////////////////////////////////////////////////////////////////
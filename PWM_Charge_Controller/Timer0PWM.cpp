@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include "Timer0PWM.h"
+
+/*  Timer0 PWM
+ *
+ *  Non-inverting fast PWM: OC0B is set at BOTTOM and cleared on the match, so the gap is the
+ *  w = 256 - duty counts from OCR0B + 1 to 255. Compare A matches once on the way up and the
+ *  sample is h counts after it, so OCR0A goes halfway along what is left of the gap once h is
+ *  taken off. At prescale 64 h is 5 counts, so in-phase sampling works up to 97% duty.
+ */
+
+#define TIMER0_HOLD_COUNTS ((TIMER0_HOLD_CYCLES + 63) / 64)
+
+Timer0PWM::Timer0PWM (void)
+{
+  Duty = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Output low and off the timer, which is already running
+//////////////////////////////////////////////////////////////
+
+void Timer0PWM::Begin (unsigned long hz)
+{
+  (void)hz;
+  pinMode(TIMER0_PWM_PIN, OUTPUT);
+  digitalWrite(TIMER0_PWM_PIN, LOW);
+  TCCR0A &= ~(_BV(COM0A1) | _BV(COM0A0) | _BV(COM0B1) | _BV(COM0B0));
+  OCR0A = TIMER0_TOP - 1 - TIMER0_HOLD_COUNTS;
+  Duty = 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Set the duty, 0 to Top(). Takes effect at the next BOTTOM.
+//////////////////////////////////////////////////////////////
+
+void Timer0PWM::Write (unsigned int duty)
+{
+  if (duty > TIMER0_TOP) duty = TIMER0_TOP;
+  Duty = duty;
+  if (duty == 0)
+  {
+    TCCR0A &= ~_BV(COM0B1);     //The pin goes back to its PORT bit, low
+    return;
+  }
+  unsigned int w = TIMER0_TOP - duty;
+  unsigned int g = (w > TIMER0_HOLD_COUNTS) ? (w - TIMER0_HOLD_COUNTS) >> 1 : 0;
+  OCR0B = duty - 1;
+  OCR0A = (duty + g > 255) ? 255 : duty + g;    //Full on has no gap, 256 would wrap to 0
+  TCCR0A |= _BV(COM0B1);
+}
+
+unsigned int Timer0PWM::Read (void)
+{
+  return (Duty);
+}
+
+unsigned int Timer0PWM::Top (void)
+{
+  return (TIMER0_TOP);
+}
+
+unsigned long Timer0PWM::Frequency (void)
+{
+  return (F_CPU / (64UL * TIMER0_TOP));
+}
+
+bool Timer0PWM::CanTrigger (void)
+{
+  return (Duty > 0 && TIMER0_TOP - Duty > TIMER0_HOLD_COUNTS);
+}
+
+byte Timer0PWM::Trigger (void)
+{
+  return (PWM_TRIGGER_TIMER0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Timer0PWM
+//////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,48 @@
+#ifndef Timer0PWMLib
+#define Timer0PWMLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Timer0PWM class, a second charge waveform on pin 5 (OC0B) from Timer0
+//
+//  Timer0 is millis()'s, so it is left as the core sets it up: fast PWM, prescale 64, 976Hz
+//  at 16MHz, and the frequency given to Begin() is ignored. The duty is 0 to 256: 0 takes the
+//  pin off the timer and holds it low, otherwise OCR0B = duty - 1 and the pin is high for duty
+//  of the 256 counts, so 256 is full on. Fast PWM loads OCR0A and OCR0B together at BOTTOM.
+//
+//  Compare A isn't connected to a pin. Like Timer1PWM's compare B it is kept in the middle of
+//  the low part of the pulse as the ADC auto-trigger (ADTS = 3), so pin 6 can't be used for
+//  PWM. Its interrupt is shared with the optical burst clock (MorseSender::Interrupt()), which
+//  only counts matches and never writes OCR0A: there is a match once a period wherever OCR0A
+//  is, so moving it with the duty doesn't change the burst timing.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "PWMOutput.h"
+
+#define TIMER0_PWM_PIN 5
+#define TIMER0_TOP   256
+
+//CPU cycles from the trigger to the A-D sample and hold, as TIMER1_HOLD_CYCLES
+#define TIMER0_HOLD_CYCLES 320
+
+class Timer0PWM : public PWMOutput {
+
+  public:
+        Timer0PWM (void);
+        void Begin (unsigned long hz);
+        void Write (unsigned int duty);
+        unsigned int Read (void);
+        unsigned int Top (void);
+        unsigned long Frequency (void);
+        bool CanTrigger (void);
+        byte Trigger (void);
+
+  private:
+        unsigned int Duty;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Timer0PWM
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
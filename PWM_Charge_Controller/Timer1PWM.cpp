@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include "Timer1PWM.h"
+
+/*  Timer1 PWM
+ *
+ *  Mode 10, phase correct with TOP in ICR1. The counter runs up to TOP and back down. OC1A
+ *  (non-inverting) is high while the count is below OCR1A, so the pulse is centred on BOTTOM
+ *  and the gap on TOP.
+ *
+ *  The gap runs from OCR1A on the way up to OCR1A on the way down, w = TOP - OCR1A counts
+ *  either side of TOP. Compare B matches on the way up and on the way down, and the ADC takes
+ *  whichever comes first once it is free. Both must have the sample and hold (h counts after
+ *  the match) inside the gap: the one on the way down is the later, so with g = TOP - OCR1B
+ *  it needs g + h <= w. OCR1B is put halfway between, g = (w - h) / 2.
+ *
+ *  OCR1A and OCR1B are loaded at TOP independently, so a TOP can fall between writing them.
+ *  Writing the one that keeps the trigger inside the smaller of the old and new gaps first
+ *  means that one period still samples in the gap.
+ */
+
+Timer1PWM::Timer1PWM (void)
+{
+  TopCount = 0;
+  Prescale = 1;
+  Duty = 0;
+  HoldCounts = TIMER1_HOLD_CYCLES;
+}
+
+//////////////////////////////////////////////////////////////
+//Start the timer at the given frequency with the output low
+//////////////////////////////////////////////////////////////
+
+void Timer1PWM::Begin (unsigned long hz)
+{
+  Prescale = Timer1Prescale(hz);
+  TopCount = Timer1Top(hz);
+  HoldCounts = (TIMER1_HOLD_CYCLES + Prescale - 1) / Prescale;
+
+  byte cs;
+  switch (Prescale)
+  {
+    case 1:   cs = _BV(CS10); break;
+    case 8:   cs = _BV(CS11); break;
+    case 64:  cs = _BV(CS11) | _BV(CS10); break;
+    case 256: cs = _BV(CS12); break;
+    default:  cs = _BV(CS12) | _BV(CS10); break;
+  }
+
+  pinMode(TIMER1_PWM_PIN, OUTPUT);
+  digitalWrite(TIMER1_PWM_PIN, LOW);
+  TCCR1B = 0;                                 //Stop while TOP is changed, ICR1 isn't buffered
+  TCNT1 = 0;
+  ICR1 = TopCount;
+  Duty = 0;
+  OCR1A = 0;
+  OCR1B = TopCount;
+  TCCR1A = _BV(COM1A1) | _BV(WGM11);          //OC1A non-inverting, OC1B not connected
+  TCCR1B = _BV(WGM13) | cs;                   //Mode 10, phase correct, TOP = ICR1
+}
+
+//////////////////////////////////////////////////////////////
+//Set the duty, 0 to Top(). Takes effect at the next TOP.
+//////////////////////////////////////////////////////////////
+
+void Timer1PWM::Write (unsigned int duty)
+{
+  if (duty > TopCount) duty = TopCount;
+  unsigned int w = TopCount - duty;
+  unsigned int g = (w > HoldCounts) ? (w - HoldCounts) >> 1 : 0;
+  if (duty > Duty)        //Gap getting shorter, move the trigger in first
+  {
+    OCR1B = TopCount - g;
+    OCR1A = duty;
+  }
+  else
+  {
+    OCR1A = duty;
+    OCR1B = TopCount - g;
+  }
+  Duty = duty;
+}
+
+unsigned int Timer1PWM::Read (void)
+{
+  return (Duty);
+}
+
+unsigned int Timer1PWM::Top (void)
+{
+  return (TopCount);
+}
+
+unsigned long Timer1PWM::Frequency (void)
+{
+  if (TopCount == 0) return (0);
+  return (F_CPU / (2UL * Prescale * TopCount));
+}
+
+//////////////////////////////////////////////////////////////
+//True if the gap in the pulse is long enough for an A-D
+//conversion triggered from compare B to sample inside it
+//////////////////////////////////////////////////////////////
+
+bool Timer1PWM::CanTrigger (void)
+{
+  return (Duty > 0 && TopCount - Duty >= HoldCounts);
+}
+
+byte Timer1PWM::Trigger (void)
+{
+  return (PWM_TRIGGER_TIMER1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Timer1PWM
+//////////////////////////////////////////////////////////////////////////////////////////////
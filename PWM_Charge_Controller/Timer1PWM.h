@@ -0,0 +1,68 @@
+#ifndef Timer1PWMLib
+#define Timer1PWMLib
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Timer1PWM class, phase correct PWM on pin 9 (OC1A) from the 16 bit Timer1
+//
+//  analogWrite gives 8 bits at a fixed frequency. Here TOP is ICR1, so the frequency can be
+//  set and the duty has TOP+1 steps, TOP = F_CPU / (2 * prescale * frequency). At 16MHz that
+//  is 10 bits at 7.8kHz, 11 bits at 3.9kHz, or the full 16 bits at 122Hz.
+//
+//  OCR1A is double buffered and only loaded at TOP, so a duty change never cuts a pulse short
+//  or doubles one up. Duty 0 holds the pin low and TOP holds it high, no special cases.
+//
+//  Compare B isn't connected to a pin. It is kept in the middle of the low part of the pulse
+//  so the ADC can use it as an auto-trigger (ADTS = 5) and read the battery and panel with the
+//  switch open, see ADCSampler. That means pin 10 can't be used for PWM.
+//
+//  Timer1 is set up by Begin(), not the constructor. The core's init() runs after global
+//  constructors and sets Timer1 up for analogWrite.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "PWMOutput.h"
+
+#define TIMER1_PWM_PIN 9
+
+//CPU cycles from the trigger to the A-D sample and hold: up to 1 ADC clock to synchronise
+//then 1.5 ADC clocks, at the ADCSampler's prescale of 128
+#define TIMER1_HOLD_CYCLES 320
+
+//Smallest prescaler that fits TOP in 16 bits, and TOP, for a frequency
+constexpr unsigned int Timer1Prescale (unsigned long hz)
+{
+  return (F_CPU / (2UL * hz) <= 65535UL) ? 1 :
+         (F_CPU / (16UL * hz) <= 65535UL) ? 8 :
+         (F_CPU / (128UL * hz) <= 65535UL) ? 64 :
+         (F_CPU / (512UL * hz) <= 65535UL) ? 256 : 1024;
+}
+
+constexpr unsigned int Timer1Top (unsigned long hz)
+{
+  return (unsigned int)(F_CPU / (2UL * Timer1Prescale(hz) * hz));
+}
+
+class Timer1PWM : public PWMOutput {
+
+  public:
+        Timer1PWM (void);
+        void Begin (unsigned long hz);
+        void Write (unsigned int duty);
+        unsigned int Read (void);
+        unsigned int Top (void);
+        unsigned long Frequency (void);
+        bool CanTrigger (void);
+        byte Trigger (void);
+
+  private:
+        unsigned int TopCount;
+        unsigned int Prescale;
+        unsigned int Duty;
+        unsigned int HoldCounts;      //TIMER1_HOLD_CYCLES in timer counts
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//END Class Timer1PWM
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef HostArduino_h
+#define HostArduino_h
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host (Linux) backend for the charge controller sketch.
+//
+//  The sketch is written against the Arduino core and a handful of ATmega328P registers, so
+//  that is the hardware abstraction: on the board the real Arduino core is linked, on the host
+//  this header and HostArduino.cpp are. Registers are plain variables, and the parts of the
+//  chip the sketch relies on (Timer0 tick, Timer1 PWM, ADC with auto-trigger, power down) are
+//  emulated against a virtual clock, so the interrupt routines in the sketch run as they would
+//  on the chip, just a great deal faster than real time.
+//
+//  Time only moves when the sketch calls delay(), millis()/micros() (each poll costs a few
+//  microseconds) or sleeps, or when the host code calls HostAdvance().
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20      //Analog only, on the 32 pin packages (Nano, Pro Mini)
+#define A7 21
+#define LED_BUILTIN 13
+#define HOST_PINS 20
+#define SERIAL_TX_BUFFER 64
+
+#define E2END 0x3FF     //Last EEPROM address
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define _BV(b) (1 << (b))
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+
+#define ISR(vector) extern "C" void vector(void); void vector(void)
+inline void cli(void) {}
+inline void sei(void) {}
+inline void noInterrupts(void) {}
+inline void interrupts(void) {}
+
+//ATmega328P registers used by the sketch
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B;
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B;
+extern volatile uint8_t ADCSRA, ADCSRB, ADMUX, DIDR0;
+extern volatile uint8_t ACSR;
+extern volatile uint16_t ADC;
+extern volatile uint8_t MCUSR, WDTCSR;
+
+//Register bits
+#define OCIE0A 1
+#define OCF0A  1
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM13  4
+#define WGM12  3
+#define WGM11  1
+#define WGM10  0
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define OCIE1B 2
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM22  3
+#define WGM21  1
+#define WGM20  0
+#define CS22   2
+#define CS21   1
+#define CS20   0
+#define OCF1B  2
+#define ADEN   7
+#define ADSC   6
+#define ADATE  5
+#define ADIF   4
+#define ADIE   3
+#define ADPS2  2
+#define ADPS1  1
+#define ADPS0  0
+#define ADTS2  2
+#define ADTS1  1
+#define ADTS0  0
+#define ACME   6
+#define ACD    7
+#define ACBG   6
+#define ACO    5
+#define ACI    4
+#define ACIE   3
+#define REFS1  7
+#define REFS0  6
+#define WDRF   3
+#define BORF   2
+#define EXTRF  1
+#define PORF   0
+#define WDIE   6
+#define WDE    3
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+int analogRead(uint8_t pin);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis(void);
+unsigned long micros(void);
+
+//Serial goes to stdout once begin() has been called
+class HostSerial {
+  public:
+        void begin (unsigned long baud);
+        void end (void);
+        int available (void);
+        int read (void);
+        size_t write (uint8_t c);
+        size_t write (const uint8_t *buf, size_t len);
+        int availableForWrite (void);
+        void flush (void);
+        void print (const char *);
+        void print (char);
+        void print (int);
+        void print (unsigned int);
+        void print (long);
+        void print (unsigned long);
+        void print (double, int decimals = 2);
+        void println (void);
+        template <class T> void println (T v) { print(v); println(); }
+        operator bool (void) { return true; }
+};
+extern HostSerial Serial;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//  Host side controls, not part of the Arduino API
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Supplies the voltage (in mV) seen at an analog pin, the ADC converts it against 5V
+typedef unsigned int (*HostAnalogSource)(uint8_t channel);
+void HostSetAnalogSource (HostAnalogSource source);
+
+//Called with the virtual wall time (us) whenever time moves, for plant models
+typedef void (*HostTimeHook)(unsigned long long wallMicros);
+void HostSetTimeHook (HostTimeHook hook);
+
+void HostAdvance (unsigned long us);          //Run the emulated chip for this long
+void HostSleep (unsigned long ms);            //Power down, Timer0 and the ADC stop
+unsigned long long HostWallMicros (void);     //Includes time asleep, unlike micros()
+unsigned long long HostSleptMicros (void);
+void HostStopAt (unsigned long long wallMicros);  //HostStop is thrown when this is reached
+struct HostStop {};
+
+int HostPinLevel (uint8_t pin);               //Last digitalWrite level
+unsigned long long HostPinChanged (uint8_t pin);  //Wall time digitalWrite last changed it
+int HostPinPWM (uint8_t pin);                 //Last analogWrite value, -1 if digital
+double HostPinDuty (uint8_t pin);             //0-1, from Timer0/1/2 compare outputs, else analogWrite or level
+void HostSerialInput (const uint8_t *buf, size_t len);   //Queue bytes for Serial.read()
+typedef void (*HostSerialSink)(uint8_t c);
+void HostSetSerialSink (HostSerialSink sink);  //Serial output goes here instead of stdout
+uint8_t *HostEEPROM (void);                   //The E2END+1 byte EEPROM image
+unsigned long HostEEPROMWrites (void);        //Bytes actually written (changed), for wear
+unsigned long HostWatchdogTimeouts (void);    //Times the watchdog ran out, the chip would have reset
+
+#endif
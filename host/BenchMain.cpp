@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Hot path benchmark. Runs the sketch built with PROBES 1 (see Probe.h) on the emulated chip
+//  and prints each probe's figures, then checks them against a baseline.
+//
+//  pwm_charge_bench [--seconds S] [--save file] [--baseline file] [--tolerance %]
+//
+//  The battery is taken slowly up and down between BENCH_LOW_V and BENCH_HIGH_V under a
+//  steady panel, so the charge goes through bulk (suspended for its readings, the settle
+//  probe), absorption and back, and every probe has runs. S is seconds of emulated time,
+//  3600 unless given.
+//
+//  Prints a CSV line a probe (reading, waveform, control, sample, settle, indicator, current,
+//  see Probe.h): runs, shortest, mean and longest in us and the percentage of
+//  runs in each histogram bucket. The times are the host's, std::chrono, of the sketch
+//  running on the emulated core, so they compare one build with the next on the same
+//  machine, not with the board (link_decode --probes reads a board's).
+//
+//  --save writes each probe's mean to a file, --baseline reads one back and fails (exit 1)
+//  if any probe's mean is more than the tolerance (25% unless given) over it, and by more
+//  than BENCH_NOISE_US, about what reading the clock twice costs. It also fails if a probe
+//  had no runs, the benchmark no longer reaches that path. The host is busy with other
+//  things as well, so a run that fails is worth repeating before looking for the cause.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "PWM_Charge_Controller.ino"
+
+#define BENCH_LOW_V    12.2
+#define BENCH_HIGH_V   14.6
+#define BENCH_SWING_S  1200.0     //Seconds from low to high and back
+#define BENCH_SOLAR_V  18.0
+#define BENCH_NOISE_US  0.1
+
+static_assert(PROBES, "pwm_charge_bench needs the sketch built with PROBES 1");
+
+static unsigned int BenchDivider (double volts, int high, int low)
+{
+  return (unsigned int)(volts * 1000.0 * low / (high + low) + 0.5);
+}
+
+static double BenchBattery (void)
+{
+  double phase = fmod(HostWallMicros() / 1e6, BENCH_SWING_S) / BENCH_SWING_S;
+  double swing = (phase < 0.5) ? phase * 2 : 2 - phase * 2;
+  return BENCH_LOW_V + (BENCH_HIGH_V - BENCH_LOW_V) * swing;
+}
+
+static unsigned int BenchAnalog (uint8_t channel)
+{
+  if (channel == A0 - A0) return BenchDivider(BenchBattery(), BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE);
+  if (channel == A1 - A0) return BenchDivider(BENCH_SOLAR_V, SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE);
+  if (channel == TEMP_SENSOR_PIN - A0) return 2500;     //25C with NTC_R25 equal to NTC_FIXED_R
+  return 0;
+}
+
+static void BenchSerial (uint8_t c)
+{
+  (void)c;
+}
+
+int main (int argc, char **argv)
+{
+  double seconds = 3600;
+  const char *save = 0;
+  const char *baseline = 0;
+  double tolerance = 25;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) seconds = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--save") && i + 1 < argc) save = argv[++i];
+    else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baseline = argv[++i];
+    else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) tolerance = atof(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage: %s [--seconds S] [--save file] [--baseline file] [--tolerance %%]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  HostSetAnalogSource(BenchAnalog);
+  HostSetSerialSink(BenchSerial);
+  HostStopAt((unsigned long long)(seconds * 1e6));
+  try
+  {
+    setup();
+    ProbeClear();       //Only the running sketch, not the start up
+    while (true) loop();
+  }
+  catch (HostStop &)
+  {
+  }
+
+  bool failed = false;
+  printf("probe,runs,min_us,mean_us,max_us");
+  for (int b = 0; b < PROBE_BUCKETS; b++) printf(",h%d", b);
+  printf("\n");
+  for (byte p = 0; p < PROBE_COUNT; p++)
+  {
+    const ProbeStats &s = ProbeRead(p);
+    unsigned long runs = 0;
+    for (int b = 0; b < PROBE_BUCKETS; b++) runs += s.Buckets[b];
+    printf("%s,%lu,%.3f,%.3f,%.3f", ProbeName(p), s.Count, s.Min / (double)PROBE_TICKS_PER_US,
+           ProbeMean(p) / (double)PROBE_TICKS_PER_US, s.Max / (double)PROBE_TICKS_PER_US);
+    for (int b = 0; b < PROBE_BUCKETS; b++) printf(",%.1f", runs ? 100.0 * s.Buckets[b] / runs : 0.0);
+    printf("\n");
+    if (!s.Count)
+    {
+      fprintf(stderr, "%s: no runs\n", ProbeName(p));
+      failed = true;
+    }
+  }
+
+  if (save)
+  {
+    FILE *f = fopen(save, "w");
+    if (!f)
+    {
+      fprintf(stderr, "%s: can't write %s\n", argv[0], save);
+      return 1;
+    }
+    for (byte p = 0; p < PROBE_COUNT; p++) fprintf(f, "%s,%lu\n", ProbeName(p), ProbeMean(p));
+    fclose(f);
+  }
+
+  if (baseline)
+  {
+    FILE *f = fopen(baseline, "r");
+    if (!f)
+    {
+      fprintf(stderr, "%s: can't read %s\n", argv[0], baseline);
+      return 1;
+    }
+    char line[64], name[32];
+    unsigned long was;
+    while (fgets(line, sizeof(line), f))
+    {
+      if (sscanf(line, "%31[a-z],%lu", name, &was) != 2) continue;
+      for (byte p = 0; p < PROBE_COUNT; p++)
+      {
+        if (strcmp(name, ProbeName(p))) continue;
+        double over = (double)ProbeMean(p) - was;
+        double change = was ? 100.0 * over / was : 0;
+        if (change > tolerance && over > BENCH_NOISE_US * PROBE_TICKS_PER_US)
+        {
+          fprintf(stderr, "%s: mean %.3fus, %.0f%% over the baseline's %.3fus\n", name, ProbeMean(p) / (double)PROBE_TICKS_PER_US,
+                  change, was / (double)PROBE_TICKS_PER_US);
+          failed = true;
+        }
+      }
+    }
+    fclose(f);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+#include "ChargePlant.h"
+#include <math.h>
+#include <stdio.h>
+
+#define THERMAL_VOLTS 0.02569     //kT/q at 25C
+
+//////////////////////////////////////////////////////////////
+//Battery
+//////////////////////////////////////////////////////////////
+
+double LeadAcidBattery::OpenCircuit (void) const
+{
+  return 11.9 + 0.8 * SoC;
+}
+
+//Resistance behind the polarisation voltage, climbs steeply over
+//the last 20% so the terminal voltage runs up as the battery fills.
+//That is the charge reaction struggling, a discharge doesn't see it.
+double LeadAcidBattery::Resistance1 (double amps) const
+{
+  if (amps < 0) return 0.05;
+  double full = (SoC - 0.8) / 0.2;
+  if (full < 0) full = 0;
+  return 0.05 + 5.2 * full * full;
+}
+
+double LeadAcidBattery::Terminal (double amps) const
+{
+  return OpenCircuit() + amps * R0 + Polarisation;
+}
+
+void LeadAcidBattery::Step (double amps, double seconds)
+{
+  double efficiency = 1.0;
+  if (amps > 0)
+  {
+    double over = Terminal(amps) - (GassingVolts + GassingCoeff * (Celsius - 25.0));
+    if (over > 0) efficiency = (over > 0.3) ? 0.0 : 1.0 - over / 0.3;
+    if (SoC >= 1.0) efficiency = 0.0;
+  }
+  double ah = amps * seconds / 3600.0;
+  SoC += efficiency * ah / CapacityAh;
+  if (amps > 0) GassedAh += (1.0 - efficiency) * ah;
+  if (SoC > 1.0) SoC = 1.0;
+  if (SoC < 0.0) SoC = 0.0;
+
+  double target = amps * Resistance1(amps);
+  Polarisation = target + (Polarisation - target) * exp(-seconds / Tau);
+}
+
+//////////////////////////////////////////////////////////////
+//Thermistor
+//////////////////////////////////////////////////////////////
+
+double Thermistor::Pin (double celsius) const
+{
+  double r = R25 * exp(Beta * (1.0 / (celsius + 273.15) - 1.0 / 298.15));
+  return 5.0 * r / (r + FixedR);
+}
+
+//////////////////////////////////////////////////////////////
+//Panel
+//////////////////////////////////////////////////////////////
+
+static double PanelVt (const SolarPanel &p)
+{
+  return p.Cells * p.Ideality * THERMAL_VOLTS;
+}
+
+double SolarPanel::Isc (void) const
+{
+  return IscSTC * Irradiance / 1000.0;
+}
+
+double SolarPanel::Current (double volts) const
+{
+  double vt = PanelVt(*this);
+  double i0 = IscSTC / (exp(VocSTC / vt) - 1.0);
+  double i = Isc() - i0 * (exp(volts / vt) - 1.0);
+  return (i > 0) ? i : 0.0;
+}
+
+double SolarPanel::OpenCircuit (void) const
+{
+  if (Isc() <= 0) return 0.0;
+  double vt = PanelVt(*this);
+  double i0 = IscSTC / (exp(VocSTC / vt) - 1.0);
+  return vt * log(Isc() / i0 + 1.0);
+}
+
+double SolarPanel::MaxPower (void) const
+{
+  double voc = OpenCircuit();
+  double best = 0;
+  for (int i = 1; i < 200; i++)
+  {
+    double v = voc * i / 200.0;
+    double p = v * Current(v);
+    if (p > best) best = p;
+  }
+  return best;
+}
+
+//////////////////////////////////////////////////////////////
+//Panel, switch and battery together
+//////////////////////////////////////////////////////////////
+
+void ChargePlant::Step (double seconds, int state)
+{
+  if (Panel.Irradiance != LastIrradiance)
+  {
+    LastIrradiance = Panel.Irradiance;
+    MaxPower = Panel.MaxPower();
+  }
+
+  double duty = StuckOn ? 1.0 : Pumping ? Duty : 0.0;
+  double other = ExtraAmps - LoadAmps;
+  OnAmps = (duty > 0) ? ClosedAmps() : 0;
+  BatteryRest = Battery.Terminal(other);
+  BatteryOn = Battery.Terminal(OnAmps + other);
+
+  double volts = (duty > 0) ? BatteryOn : BatteryRest;
+  if (volts > PeakVolts) PeakVolts = volts;
+  if (volts > Threshold)
+  {
+    SecondsAbove += seconds;
+    if (FirstAbove < 0) FirstAbove = Seconds;
+  }
+
+  HarvestWh += duty * OnAmps * BatteryOn * seconds / 3600.0;
+  AvailableWh += MaxPower * seconds / 3600.0;
+  Battery.Step(duty * OnAmps + other, seconds);
+  if (state >= 0 && state < PLANT_STATES) StateSeconds[state] += seconds;
+  Seconds += seconds;
+}
+
+//With the switch closed the panel and battery sit at the same voltage,
+//find the current where the panel curve meets the battery line
+double ChargePlant::ClosedAmps (void) const
+{
+  double other = ExtraAmps - LoadAmps;
+  double lo = 0, hi = Panel.Isc();
+  if (hi <= 0) return 0;
+  for (int i = 0; i < 30; i++)
+  {
+    double mid = (lo + hi) / 2;
+    if (Panel.Current(Battery.Terminal(mid + other)) > mid) lo = mid;
+    else hi = mid;
+  }
+  return (lo);
+}
+
+//Voltage at the solar terminal. An A-D conversion timed into the
+//off part of the PWM sees the open panel, otherwise it is as likely
+//to land in the on part as the duty cycle says. A stuck switch
+//holds the panel at the battery, light or dark.
+double ChargePlant::SolarPin (bool offPhase) const
+{
+  if (StuckOn) return BatteryOn;
+  double open = Panel.OpenCircuit();
+  double duty = Pumping ? Duty : 0.0;
+  if (offPhase || OnAmps <= 0) return open;
+  return duty * BatteryOn + (1.0 - duty) * open;
+}
+
+double ChargePlant::BatteryPin (bool offPhase) const
+{
+  if (StuckOn) return BatteryOn;
+  double duty = Pumping ? Duty : 0.0;
+  if (offPhase || OnAmps <= 0) return BatteryRest;
+  return duty * BatteryOn + (1.0 - duty) * BatteryRest;
+}
+
+//////////////////////////////////////////////////////////////
+//Irradiance profile, CSV lines of "seconds,W/m2", anything
+//else is skipped, as are times that don't go forward
+//////////////////////////////////////////////////////////////
+
+bool IrradianceProfile::Load (const char *name)
+{
+  FILE *f = fopen(name, "r");
+  if (!f) return false;
+  char line[128];
+  while (fgets(line, sizeof(line), f))
+  {
+    double t, g;
+    if (sscanf(line, "%lf,%lf", &t, &g) != 2) continue;
+    if (!Time.empty() && t <= Time.back()) continue;
+    Time.push_back(t);
+    Irradiance.push_back(g < 0 ? 0 : g);
+  }
+  fclose(f);
+  if (Time.size() < 2) return false;
+  Length = Time.back();
+  return true;
+}
+
+double IrradianceProfile::At (double seconds) const
+{
+  double t = fmod(seconds, Length);
+  size_t hi = 1;
+  while (hi < Time.size() - 1 && Time[hi] < t) hi++;
+  double t0 = Time[hi - 1], t1 = Time[hi];
+  double f = (t - t0) / (t1 - t0);
+  if (f < 0) f = 0;
+  if (f > 1) f = 1;
+  return Irradiance[hi - 1] + f * (Irradiance[hi] - Irradiance[hi - 1]);
+}
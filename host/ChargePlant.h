@@ -0,0 +1,118 @@
+#ifndef ChargePlant_h
+#define ChargePlant_h
+
+#include <vector>
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Physics of the things the controller is wired to, for host simulation.
+//
+//  LeadAcidBattery   - open circuit voltage from state of charge, series resistance, and a slow
+//                      polarisation (surface charge) voltage that grows steeply near full charge.
+//                      Above the gassing voltage part of the current makes gas, not charge.
+//                      The gassing voltage falls as the battery warms.
+//  SolarPanel        - single diode model, short circuit current in proportion to irradiance.
+//  Thermistor        - NTC in a divider from the 5V reference, the voltage at the A-D pin.
+//  ChargePlant       - panel switched onto the battery by the MOSFET at the PWM duty cycle,
+//                      keeps the energy and voltage statistics. Faults can be put in: a
+//                      switch that has failed closed, another charger on the battery.
+//  IrradianceProfile - a day (or days) of W/m2 read from CSV, interpolated. Read only once
+//                      loaded, so one can be shared by any number of plants and threads.
+//
+//  Nothing is shared between two plants, the sweep (pwm_charge_sweep) runs them in threads.
+//
+//  Values are loosely a 45Ah car battery and a 10W, 36 cell panel. They are good enough to show
+//  how a charge algorithm behaves, not to predict a particular battery.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class LeadAcidBattery {
+  public:
+        double CapacityAh = 45.0;
+        double SoC = 0.6;             //0-1
+        double R0 = 0.02;             //Series resistance, ohms
+        double Polarisation = 0.0;    //Surface charge voltage, volts
+        double Tau = 1800.0;          //Polarisation time constant, seconds
+        double GassingVolts = 14.4;   //At 25C
+        double GassingCoeff = -0.030; //Volts per degree
+        double Celsius = 25.0;
+        double GassedAh = 0.0;
+
+        double OpenCircuit (void) const;
+        double Resistance1 (double amps) const;
+        double Terminal (double amps) const;
+        void Step (double amps, double seconds);
+};
+
+class SolarPanel {
+  public:
+        double IscSTC = 0.62;         //Short circuit amps at 1000 W/m2
+        double VocSTC = 21.6;
+        double Cells = 36;
+        double Ideality = 1.3;
+        double Irradiance = 0.0;      //W/m2
+
+        double Isc (void) const;
+        double Current (double volts) const;
+        double OpenCircuit (void) const;
+        double MaxPower (void) const;
+};
+
+class Thermistor {
+  public:
+        double FixedR = 10000;        //Up to the reference
+        double R25 = 10000;
+        double Beta = 3950;
+
+        double Pin (double celsius) const;
+};
+
+#define PLANT_STATES 5    //Off, trickle, hard on, regulate, asleep (charge pump stopped)
+
+class ChargePlant {
+  public:
+        LeadAcidBattery Battery;
+        SolarPanel Panel;
+        double LoadAmps = 0.0;        //Parasitic drain on the battery
+        double ExtraAmps = 0.0;       //Another charger on the battery
+        bool StuckOn = false;         //MOSFET failed closed, conducts whatever the gate drive
+
+        //Switch state, set from the sketch's outputs before each step
+        double Duty = 0.0;            //0-1
+        bool Pumping = false;         //Gate drive running, without it the MOSFET can't turn on
+
+        //Results of the last step
+        double OnAmps = 0.0;          //Current while the switch is closed
+        double BatteryRest = 0.0;     //Terminal volts with the switch open
+        double BatteryOn = 0.0;       //Terminal volts with the switch closed
+
+        //Running totals
+        double Seconds = 0.0;
+        double HarvestWh = 0.0;       //Into the battery
+        double AvailableWh = 0.0;     //What the panel could have given at its maximum power point
+        double StateSeconds[PLANT_STATES] = {0, 0, 0, 0, 0};
+        double PeakVolts = 0.0;
+        double SecondsAbove = 0.0;    //Time above the Threshold
+        double FirstAbove = -1.0;     //When the Threshold was first reached
+        double Threshold = 14.0;
+
+        //For the totals, the panel's maximum power is only worked out when the light changes
+        double LastIrradiance = -1.0;
+        double MaxPower = 0.0;
+
+        void Step (double seconds, int state);
+        double ClosedAmps (void) const;
+        double SolarPin (bool offPhase) const;
+        double BatteryPin (bool offPhase) const;
+};
+
+class IrradianceProfile {
+  public:
+        std::vector<double> Time;     //Seconds, rising
+        std::vector<double> Irradiance;
+        double Length = 0.0;          //Seconds, it repeats after this
+
+        bool Load (const char *name);
+        double At (double seconds) const;
+};
+
+#endif
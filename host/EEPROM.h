@@ -0,0 +1,31 @@
+#ifndef HostEEPROM_h
+#define HostEEPROM_h
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//  Host stand-in for the Arduino EEPROM library
+//  The 1K image is held in HostArduino.cpp, erased (0xFF) at start. A write that changes a
+//  byte moves the virtual clock on by the 3.3ms the chip waits, see HostEEPROM().
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Arduino.h"
+
+class EEPROMClass {
+  public:
+        uint8_t read (int address);
+        void write (int address, uint8_t value);
+        void update (int address, uint8_t value);
+        uint16_t length (void) { return E2END + 1; }
+        template <class T> T &get (int address, T &t)
+        {
+          for (size_t i = 0; i < sizeof(T); i++) ((uint8_t *)&t)[i] = read(address + i);
+          return t;
+        }
+        template <class T> const T &put (int address, const T &t)
+        {
+          for (size_t i = 0; i < sizeof(T); i++) update(address + i, ((const uint8_t *)&t)[i]);
+          return t;
+        }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,430 @@
+#include "Arduino.h"
+#include "LowPower.h"
+#include "EEPROM.h"
+#include "avr/wdt.h"
+#include <deque>
+#include <stdarg.h>
+
+/*  Host backend for the Arduino core, see Arduino.h
+ *
+ *  Emulated:
+ *    Timer0      - a tick every 1024us of awake time, calls TIMER0_COMPA_vect if OCIE0A is set
+ *                  and is the ADC auto-trigger source 3 (compare A). Fast PWM, the duty on
+ *                  pin 5 is (OCR0B + 1)/256 when COM0B1 connects it.
+ *    Timer1      - phase correct PWM with TOP in ICR1, the duty on pins 9/10 is OCR1x/ICR1.
+ *                  Compare B is the ADC auto-trigger source 5, once a period. The flag is not
+ *                  modelled, so a trigger is never missed for want of clearing it.
+ *    Timer2      - 8 bit phase correct, the duty on pins 11/3 is OCR2x/255 (inverted if COM2x0)
+ *                  when the compare outputs are connected.
+ *    ADC         - conversions take 13 ADC clocks, ADSC start, free running, Timer0 or Timer1
+ *                  trigger, ADC_vect if ADIE is set. The value comes from the HostAnalogSource.
+ *    Comparator  - bandgap against the ADC multiplexer (ACBG, ACME, ADC off) sets ACO from
+ *                  the HostAnalogSource. The AIN0/AIN1 pins aren't modelled.
+ *    Power down  - the virtual wall clock moves on, millis() does not, as on the chip.
+ *    Serial      - the TX buffer empties at the baud rate, as on the chip, to stdout or a sink.
+ *                  Received bytes are queued by HostSerialInput.
+ *    EEPROM      - a byte write that changes the cell takes EEPROM_WRITE_US of awake time.
+ *    Watchdog    - wdt_enable() in reset mode, runs on the wall clock. A timeout can't reset
+ *                  the sketch here, it is counted (HostWatchdogTimeouts) and the watchdog
+ *                  carries on. MCUSR starts with PORF, as at power on. powerDown() leaves it
+ *                  off, as the Low-Power library does after using it to wake.
+ *
+ *  Anything not listed just stores the value written.
+ */
+
+volatile uint8_t TCCR0A = 0x03, TCCR0B = 0x03, TCNT0, OCR0A, OCR0B, TIMSK0 = 0x01, TIFR0;
+volatile uint8_t TCCR1A = 0x01, TCCR1B = 0x03, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B;
+volatile uint8_t TCCR2A = 0x01, TCCR2B = 0x04, TCNT2, OCR2A, OCR2B;
+volatile uint8_t ADCSRA = 0x87, ADCSRB, ADMUX, DIDR0;
+volatile uint8_t ACSR;
+volatile uint16_t ADC;
+volatile uint8_t MCUSR = _BV(PORF), WDTCSR;
+
+extern "C" void TIMER0_COMPA_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+
+HostSerial Serial;
+LowPowerClass LowPower;
+EEPROMClass EEPROM;
+
+#define POLL_COST_US   4        //Time charged for each millis()/micros() call
+#define TIMER0_TICK_US 1024     //Prescaler 64, 256 counts
+#define EEPROM_WRITE_US 3400    //Erase and write, the CPU waits on the next access
+
+static unsigned long long AwakeMicros = 0;   //What micros() is based on
+static unsigned long long WallMicros = 0;    //Includes time powered down
+static unsigned long long SleptMicros = 0;
+static unsigned long long NextTimer0 = TIMER0_TICK_US;
+static unsigned long long NextTimer1 = 0;
+static unsigned long long AdcDone = 0;
+static unsigned long long StopAt = ~0ULL;
+static bool Converting = false;
+static bool InISR = false;
+
+static HostAnalogSource AnalogSource = 0;
+static HostTimeHook TimeHook = 0;
+static int PinLevel[HOST_PINS];
+static int PinPWM[HOST_PINS];
+static unsigned long long PinChanged[HOST_PINS];
+static bool SerialOpen = false;
+static std::deque<uint8_t> SerialIn;
+static HostSerialSink SerialSink = 0;
+static unsigned long TxByteMicros = 174;
+static unsigned long long TxFreeAt = 0;
+static uint8_t EEPROMImage[E2END + 1];
+static bool EEPROMErased = false;
+static unsigned long EEPROMWrites = 0;
+static unsigned long long WatchdogPeriod = 0;
+static unsigned long long WatchdogDue = 0;
+static unsigned long WatchdogTimeouts = 0;
+
+void HostSetAnalogSource (HostAnalogSource source) { AnalogSource = source; }
+void HostSetTimeHook (HostTimeHook hook) { TimeHook = hook; }
+unsigned long long HostWallMicros (void) { return WallMicros; }
+unsigned long long HostSleptMicros (void) { return SleptMicros; }
+unsigned long HostWatchdogTimeouts (void) { return WatchdogTimeouts; }
+void HostStopAt (unsigned long long wallMicros) { StopAt = wallMicros; }
+int HostPinLevel (uint8_t pin) { return pin < HOST_PINS ? PinLevel[pin] : 0; }
+unsigned long long HostPinChanged (uint8_t pin) { return pin < HOST_PINS ? PinChanged[pin] : 0; }
+int HostPinPWM (uint8_t pin) { return pin < HOST_PINS ? PinPWM[pin] : -1; }
+
+double HostPinDuty (uint8_t pin)
+{
+  if (pin >= HOST_PINS) return 0;
+  if (pin == 5 && (TCCR0A & _BV(COM0B1))) return (OCR0B + 1) / 256.0;
+  bool running = (TCCR1B & 0x07) && ICR1;
+  if (pin == 9 && running && (TCCR1A & _BV(COM1A1))) return OCR1A >= ICR1 ? 1.0 : (double)OCR1A / ICR1;
+  if (pin == 10 && running && (TCCR1A & _BV(COM1B1))) return OCR1B >= ICR1 ? 1.0 : (double)OCR1B / ICR1;
+  bool running2 = (TCCR2B & 0x07) != 0;
+  if (pin == 11 && running2 && (TCCR2A & _BV(COM2A1))) return (TCCR2A & _BV(COM2A0)) ? 1.0 - OCR2A / 255.0 : OCR2A / 255.0;
+  if (pin == 3 && running2 && (TCCR2A & _BV(COM2B1))) return (TCCR2A & _BV(COM2B0)) ? 1.0 - OCR2B / 255.0 : OCR2B / 255.0;
+  if (PinPWM[pin] >= 0) return PinPWM[pin] / 255.0;
+  return PinLevel[pin] ? 1.0 : 0.0;
+}
+
+static void TimeMoved (void)
+{
+  while ((WDTCSR & _BV(WDE)) && WallMicros >= WatchdogDue)
+  {
+    WatchdogTimeouts++;
+    WatchdogDue += WatchdogPeriod;
+  }
+  if (TimeHook) TimeHook(WallMicros);
+  if (WallMicros >= StopAt) throw HostStop();
+}
+
+static uint16_t Convert (uint8_t channel)
+{
+  TimeMoved();    //Bring any plant model up to date before sampling it
+  unsigned long mv = AnalogSource ? AnalogSource(channel & 0x07) : 0;
+  unsigned long code = (mv * 1023 + 2500) / 5000;
+  return (code > 1023) ? 1023 : (uint16_t)code;
+}
+
+static void Compare (void)
+{
+  if ((ACSR & _BV(ACD)) || !(ACSR & _BV(ACBG)) || !(ADCSRB & _BV(ACME)) || (ADCSRA & _BV(ADEN))) return;
+  TimeMoved();
+  unsigned long mv = AnalogSource ? AnalogSource(ADMUX & 0x07) : 0;
+  if (mv < 1100) ACSR |= _BV(ACO);
+  else ACSR &= ~_BV(ACO);
+}
+
+static unsigned long ConversionMicros (void)
+{
+  unsigned long div = 1UL << (ADCSRA & 0x07);
+  if (div < 2) div = 2;
+  return (13 * div * 1000000UL / F_CPU) + 1;
+}
+
+static bool AutoTrigger (uint8_t source)
+{
+  return (ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE)) && (ADCSRB & 0x07) == source;
+}
+
+//One Timer1 period in us, phase correct so twice TOP, 0 if stopped
+static unsigned long long Timer1Period (void)
+{
+  static const unsigned int Prescale[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  unsigned long long div = Prescale[TCCR1B & 0x07];
+  if (div == 0 || ICR1 == 0) return 0;
+  unsigned long long period = 2ULL * ICR1 * div * 1000000ULL / F_CPU;
+  return period ? period : 1;
+}
+
+static void StartConversion (void)
+{
+  Converting = true;
+  ADCSRA |= _BV(ADSC);
+  AdcDone = AwakeMicros + ConversionMicros();
+}
+
+static void RunISR (void (*vector)(void))
+{
+  if (!vector) return;
+  bool was = InISR;
+  InISR = true;
+  vector();
+  InISR = was;
+}
+
+void HostAdvance (unsigned long us)
+{
+  unsigned long long target = AwakeMicros + us;
+  while (true)
+  {
+    if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADSC)) && !Converting) StartConversion();
+
+    unsigned long long period1 = AutoTrigger(5) ? Timer1Period() : 0;
+    if (period1 && NextTimer1 <= AwakeMicros) NextTimer1 = (AwakeMicros / period1 + 1) * period1;
+
+    unsigned long long next = target;
+    if (NextTimer0 < next) next = NextTimer0;
+    if (period1 && NextTimer1 < next) next = NextTimer1;
+    if (Converting && AdcDone < next) next = AdcDone;
+    WallMicros += next - AwakeMicros;
+    AwakeMicros = next;
+
+    if (Converting && AwakeMicros >= AdcDone)
+    {
+      Converting = false;
+      ADC = Convert(ADMUX);
+      ADCSRA &= ~_BV(ADSC);
+      if (ADCSRA & _BV(ADIE)) RunISR(ADC_vect);
+      if (AutoTrigger(0)) StartConversion();
+    }
+    if (period1 && AwakeMicros >= NextTimer1)
+    {
+      NextTimer1 += period1;
+      if (AutoTrigger(5) && !Converting) StartConversion();
+    }
+    if (AwakeMicros >= NextTimer0)
+    {
+      NextTimer0 += TIMER0_TICK_US;
+      TimeMoved();
+      if (TIMSK0 & _BV(OCIE0A)) RunISR(TIMER0_COMPA_vect);
+      if (AutoTrigger(3) && !Converting) StartConversion();
+    }
+    if (AwakeMicros >= target) break;
+  }
+  Compare();
+}
+
+void HostSleep (unsigned long ms)
+{
+  TimeMoved();    //Outputs changed just before powering down apply to the sleep, not the old ones
+  WallMicros += ms * 1000ULL;
+  SleptMicros += ms * 1000ULL;
+  TimeMoved();
+}
+
+//////////////////////////////////////////////////////////////
+//Arduino core
+//////////////////////////////////////////////////////////////
+
+void pinMode (uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+
+void digitalWrite (uint8_t pin, uint8_t level)
+{
+  if (pin >= HOST_PINS) return;
+  if (PinLevel[pin] != (level ? HIGH : LOW)) PinChanged[pin] = WallMicros;
+  PinLevel[pin] = level ? HIGH : LOW;
+  PinPWM[pin] = -1;
+}
+
+int digitalRead (uint8_t pin)
+{
+  return HostPinLevel(pin);
+}
+
+void analogWrite (uint8_t pin, int value)
+{
+  if (pin >= HOST_PINS) return;
+  if (value < 0) value = 0;
+  if (value > 255) value = 255;
+  PinPWM[pin] = value;
+  PinLevel[pin] = value ? HIGH : LOW;
+  switch (pin)
+  {
+    case 5:  OCR0B = value; break;
+    case 6:  OCR0A = value; break;
+    case 11: OCR2A = value; break;
+    case 3:  OCR2B = value; break;
+  }
+}
+
+int analogRead (uint8_t pin)
+{
+  if (pin >= A0) pin -= A0;
+  ADMUX = (ADMUX & 0xF0) | (pin & 0x07);
+  if (!InISR) HostAdvance(ConversionMicros());
+  return Convert(pin);
+}
+
+void delay (unsigned long ms)
+{
+  HostAdvance(ms * 1000UL);
+}
+
+void delayMicroseconds (unsigned int us)
+{
+  HostAdvance(us);
+}
+
+unsigned long millis (void)
+{
+  if (!InISR) HostAdvance(POLL_COST_US);
+  return (unsigned long)(AwakeMicros / 1000);
+}
+
+unsigned long micros (void)
+{
+  if (!InISR) HostAdvance(POLL_COST_US);
+  return (unsigned long)AwakeMicros;
+}
+
+//////////////////////////////////////////////////////////////
+//Serial
+//////////////////////////////////////////////////////////////
+
+void HostSerialInput (const uint8_t *buf, size_t len)
+{
+  SerialIn.insert(SerialIn.end(), buf, buf + len);
+}
+
+void HostSetSerialSink (HostSerialSink sink) { SerialSink = sink; }
+
+void HostSerial::begin (unsigned long baud)
+{
+  SerialOpen = true;
+  TxByteMicros = 10000000UL / baud;           //Start, 8 data and stop bits
+}
+
+void HostSerial::end (void) { SerialOpen = false; }
+int HostSerial::available (void) { return (int)SerialIn.size(); }
+
+int HostSerial::read (void)
+{
+  if (SerialIn.empty()) return -1;
+  int c = SerialIn.front();
+  SerialIn.pop_front();
+  return c;
+}
+
+//Bytes still in the TX buffer, it empties at a byte per TxByteMicros
+static unsigned int TxQueued (void)
+{
+  if (TxFreeAt <= AwakeMicros) return 0;
+  return (unsigned int)((TxFreeAt - AwakeMicros + TxByteMicros - 1) / TxByteMicros);
+}
+
+int HostSerial::availableForWrite (void) { return SERIAL_TX_BUFFER - 1 - (int)TxQueued(); }
+
+void HostSerial::flush (void)
+{
+  if (!InISR && TxFreeAt > AwakeMicros) HostAdvance((unsigned long)(TxFreeAt - AwakeMicros));
+}
+
+size_t HostSerial::write (uint8_t c)
+{
+  if (!SerialOpen) return 1;
+  if (!InISR && availableForWrite() <= 0) HostAdvance(TxByteMicros);   //Full, waits as the core does
+  TxFreeAt = (TxFreeAt > AwakeMicros ? TxFreeAt : AwakeMicros) + TxByteMicros;
+  if (SerialSink) SerialSink(c);
+  else fputc(c, stdout);
+  return 1;
+}
+
+size_t HostSerial::write (const uint8_t *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++) write(buf[i]);
+  return len;
+}
+
+static void SerialPrintf (const char *format, ...)
+{
+  char text[64];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (n > (int)sizeof(text) - 1) n = sizeof(text) - 1;
+  Serial.write((const uint8_t *)text, n > 0 ? n : 0);
+}
+
+void HostSerial::print (const char *s) { write((const uint8_t *)s, strlen(s)); }
+void HostSerial::print (char c) { write((uint8_t)c); }
+void HostSerial::print (int v) { SerialPrintf("%d", v); }
+void HostSerial::print (unsigned int v) { SerialPrintf("%u", v); }
+void HostSerial::print (long v) { SerialPrintf("%ld", v); }
+void HostSerial::print (unsigned long v) { SerialPrintf("%lu", v); }
+void HostSerial::print (double v, int decimals) { SerialPrintf("%.*f", decimals, v); }
+void HostSerial::println (void) { print("\r\n"); }
+
+//////////////////////////////////////////////////////////////
+//EEPROM library
+//////////////////////////////////////////////////////////////
+
+uint8_t *HostEEPROM (void)
+{
+  if (!EEPROMErased)
+  {
+    memset(EEPROMImage, 0xFF, sizeof(EEPROMImage));
+    EEPROMErased = true;
+  }
+  return EEPROMImage;
+}
+
+unsigned long HostEEPROMWrites (void) { return EEPROMWrites; }
+
+uint8_t EEPROMClass::read (int address)
+{
+  return HostEEPROM()[address & E2END];
+}
+
+void EEPROMClass::write (int address, uint8_t value)
+{
+  HostEEPROM()[address & E2END] = value;
+  EEPROMWrites++;
+  if (!InISR) HostAdvance(EEPROM_WRITE_US);
+}
+
+void EEPROMClass::update (int address, uint8_t value)
+{
+  if (read(address) != value) write(address, value);
+}
+
+//////////////////////////////////////////////////////////////
+//LowPower library
+//////////////////////////////////////////////////////////////
+
+void LowPowerClass::powerDown (period_t period, adc_t adc, bod_t bod)
+{
+  static const unsigned int Periods[] = {15, 30, 60, 120, 250, 500, 1000, 2000, 4000, 8000};
+  (void)adc;
+  (void)bod;
+  wdt_disable();    //The library's wake up timer takes the watchdog over
+  if (period < SLEEP_FOREVER) HostSleep(Periods[period]);
+}
+
+//////////////////////////////////////////////////////////////
+//Watchdog, 16ms doubling for each step as on the chip
+//////////////////////////////////////////////////////////////
+
+void wdt_enable (uint8_t timeout)
+{
+  WatchdogPeriod = 16000ULL << timeout;
+  WatchdogDue = WallMicros + WatchdogPeriod;
+  WDTCSR = _BV(WDE);
+}
+
+void wdt_reset (void)
+{
+  WatchdogDue = WallMicros + WatchdogPeriod;
+}
+
+void wdt_disable (void)
+{
+  WDTCSR = 0;
+}
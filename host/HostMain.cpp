@@ -0,0 +1,166 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Runs the charge controller sketch on the host against the emulated chip in HostArduino.cpp
+//
+//  pwm_charge_controller_host [--battery V] [--solar V] [--temp C] [--seconds S] [--trace] [--pty]
+//                             [--led file]
+//
+//  Battery and solar are held at fixed voltages, and the thermistor at a fixed temperature
+//  (--temp none leaves it unplugged), the sketch runs for S seconds of virtual time
+//  and the charge waveform, time spent awake/asleep and any watchdog time outs are reported.
+//  --trace prints the charge PWM value once a second. --led writes the LED's edges to a file
+//  as a capture for optical_decode (host/OpticalDecode.cpp).
+//
+//  --pty connects the sketch's serial port to a pseudo-terminal, whose name is printed, and
+//  runs in real time, so link_decode can talk to it as it would to a board:
+//      pwm_charge_controller_host --pty --seconds 60 &
+//      link_decode /dev/pts/N --set target 13.8
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "PWM_Charge_Controller.ino"
+#include "ChargePlant.h"
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+
+static double HostBattery = 12.8;
+static double HostSolar = 18.0;
+static double HostTemp = 25.0;
+static bool HostThermistor = true;
+static Thermistor HostNtc;
+static bool HostTrace = false;
+static unsigned long long NextTrace = 0;
+static int HostPty = -1;
+static std::chrono::steady_clock::time_point HostStart;
+static LinkReader HostLink;
+static unsigned long HostFrames = 0;
+static FILE *HostLed = 0;
+static int HostLedLevel = LOW;
+
+//Voltage at the A-D pin, through the same dividers the sketch assumes
+static unsigned int HostDivider (double volts, int high, int low)
+{
+  return (unsigned int)(volts * 1000.0 * low / (high + low) + 0.5);
+}
+
+static unsigned int HostAnalog (uint8_t channel)
+{
+  if (channel == A0 - A0) return HostDivider(HostBattery, BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE);
+  if (channel == A1 - A0) return HostDivider(HostSolar, SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE);
+  if (channel == TEMP_SENSOR_PIN - A0) return (unsigned int)((HostThermistor ? HostNtc.Pin(HostTemp) : 5.0) * 1000.0 + 0.5);
+  return 0;
+}
+
+//Sketch serial output, frames are counted and passed on to the pty if there is one
+static void HostSerialOut (uint8_t c)
+{
+  if (HostLink.Receive(c)) HostFrames++;
+  if (HostPty >= 0 && write(HostPty, &c, 1) < 0) HostPty = -1;
+}
+
+//Keeps the virtual clock to real time and passes on what the pty has sent
+static void HostPtyPoll (unsigned long long wall)
+{
+  uint8_t buf[64];
+  ssize_t n;
+  while ((n = read(HostPty, buf, sizeof(buf))) > 0) HostSerialInput(buf, n);
+  std::chrono::microseconds real = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - HostStart);
+  if ((long long)wall > real.count() + 1000) std::this_thread::sleep_for(std::chrono::microseconds(wall - real.count()));
+}
+
+static bool HostOpenPty (void)
+{
+  HostPty = posix_openpt(O_RDWR | O_NOCTTY);
+  if (HostPty < 0 || grantpt(HostPty) || unlockpt(HostPty)) return false;
+  //Held open in raw mode so nothing is echoed back before link_decode opens it
+  int slave = open(ptsname(HostPty), O_RDWR | O_NOCTTY);
+  struct termios t;
+  if (slave < 0 || tcgetattr(slave, &t)) return false;
+  cfmakeraw(&t);
+  tcsetattr(slave, TCSANOW, &t);
+  fcntl(HostPty, F_SETFL, O_NONBLOCK);
+  fprintf(stderr, "Serial port on %s\n", ptsname(HostPty));
+  return true;
+}
+
+static void HostTraceHook (unsigned long long wall)
+{
+  if (HostPty >= 0) HostPtyPoll(wall);
+  if (HostLed && HostPinLevel(13) != HostLedLevel)
+  {
+    double at = HostPinChanged(13) / 1e6;
+    fprintf(HostLed, "%.6f,%d\n%.6f,%d\n", at, HostLedLevel, at, HostPinLevel(13));
+    HostLedLevel = HostPinLevel(13);
+  }
+  if (!HostTrace || wall < NextTrace) return;
+  NextTrace = wall + 1000000ULL;
+  printf("%8.1fs charge duty %5.1f%% LED %d\n", wall / 1e6, 100 * HostPinDuty(CHARGEWAVEFORM), HostPinLevel(13));
+}
+
+int main (int argc, char **argv)
+{
+  double seconds = 60;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--battery") && i + 1 < argc) HostBattery = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--solar") && i + 1 < argc) HostSolar = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--temp") && i + 1 < argc) HostThermistor = strcmp(argv[++i], "none"), HostTemp = atof(argv[i]);
+    else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) seconds = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--trace")) HostTrace = true;
+    else if (!strcmp(argv[i], "--pty")) HostPty = 0;
+    else if (!strcmp(argv[i], "--led") && i + 1 < argc)
+    {
+      if (!(HostLed = fopen(argv[++i], "w")))
+      {
+        fprintf(stderr, "%s: can't write %s\n", argv[0], argv[i]);
+        return 1;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [--battery V] [--solar V] [--temp C|none] [--seconds S] [--trace] [--pty] [--led file]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (HostPty == 0 && !HostOpenPty())
+  {
+    fprintf(stderr, "%s: can't open a pseudo-terminal\n", argv[0]);
+    return 1;
+  }
+  HostStart = std::chrono::steady_clock::now();
+  HostNtc.FixedR = NTC_FIXED_R;
+  HostNtc.R25 = NTC_R25;
+  HostNtc.Beta = NTC_BETA;
+
+  HostSetAnalogSource(HostAnalog);
+  HostSetTimeHook(HostTraceHook);
+  HostSetSerialSink(HostSerialOut);
+  HostStopAt((unsigned long long)(seconds * 1e6));
+  try
+  {
+    setup();
+    while (true) loop();
+  }
+  catch (HostStop &)
+  {
+  }
+
+  printf("Ran %.1fs virtual, %.1fs asleep, estimated board current %luuA\n", HostWallMicros() / 1e6,
+         HostSleptMicros() / 1e6, Sleeper.AverageMicroAmps());
+  printf("Watchdog ran out %lu times, reset flags 0x%02X\n", HostWatchdogTimeouts(), Minder.ResetFlags());
+  ChargeChannel &c = Bank[0];
+  printf("Battery %.2fV Solar %.2fV, last reading %.2fV / %.2fV\n", HostBattery, HostSolar, c.BatVoltage, c.SolarVoltage);
+  printf("Charge duty %.1f%% (%s, %s for %lus)\n", 100 * HostPinDuty(CHARGEWAVEFORM),
+         c.Charger.isRegulating() ? "regulate" : c.Charger.isHardOn() ? "hard on" : c.Charger.isTrickle() ? "trickle" : "off",
+         ChargeStateMachine::Name(c.State.State()), c.State.Dwell(Sleeper.Uptime()));
+  if (BattTemp.isPresent()) printf("Battery temperature %.1fC, ", BattTemp.LastCelsius10() / 10.0);
+  else printf("No thermistor, ");
+  printf("setpoints for %dC absorb %.2fV float %.2fV\n", CompensatedC, c.AbsorbSetpoint() / 1000.0, c.FloatSetpoint() / 1000.0);
+  if (HostLed) fclose(HostLed);
+  printf("Serial link %lu frames sent, %u dropped, target %.2fV gap %.2fV period %ums\n", HostFrames, Link.Dropped(),
+         Profile.AbsorbmV / 1000.0, Profile.HystGapmV / 1000.0, WaitTime);
+  return 0;
+}
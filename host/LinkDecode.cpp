@@ -0,0 +1,256 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Serial link decoder. Talks to the charger's SerialLink (see SerialLink.h) on a serial port,
+//  or decodes a capture of one from a file, and prints each frame as a CSV line:
+//
+//      status,seq,seconds,battery_v,solar_v,state,duty_pct,soc_pct,channel
+//      settings,target_v,hystgap_v,wait_ms,float_v,bulk_v,absorb_min,batt_high,batt_low,
+//               solar_high,solar_low,chemistry
+//      nak,command,reason
+//      probe,name,runs,min_us,max_us,mean_us,h0,...h7
+//      energy,channel,which,days,hours,delivered_wh,available_wh,harvest_pct,peak_a
+//
+//  link_decode port [--set setting value]... [--get] [--preset chemistry] [--save] [--clear]
+//                   [--probes] [--energy channel] [--frames N] [--seconds S]
+//
+//  Commands are sent first, in the order given, and each is answered with a settings or nak
+//  line. --set takes volts for target, hystgap, float and bulk, ms for wait, minutes for
+//  absorbtime and ohms for batt_high, batt_low, solar_high and solar_low. --preset loads the
+//  figures for flooded, agm or gel, --save keeps the profile in use over a reset, --clear
+//  lets the charge start again after a fault (see ChargeProtection.h). --probes asks for each
+//  of the hot path timings of a board built with PROBES 1 (see Probe.h): reading and current
+//  for the voltage and current sensors, waveform, control, sample, settle and indicator. h0-h7
+//  are the percentage of runs in each histogram bucket. --energy asks for a channel's EnergyMeter
+//  (see EnergyMeter.h), since reset for each ChargePWM mode, then today so far and the last
+//  day rolled up; the board also sends the day line itself at each roll-up. harvest_pct is
+//  delivered against what full on would have given. Commands go LINK_GAP_MS apart, so each
+//  reply has the board's transmit buffer to itself. The board
+//  doesn't hear anything while it sleeps, so during a pause a command may need sending again.
+//  Stops after N frames or S seconds, or at the end of a file, otherwise runs until killed.
+//  Frames with a bad CRC are counted on stderr.
+//
+//  The framing is the sketch's own SerialLink.cpp, built for the host.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "SerialLink.h"
+#include "ChargeProfile.h"
+#include "ChargeStateMachine.h"
+#include "TelemetryLog.h"
+#include "Probe.h"
+#include "EnergyMeter.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <time.h>
+
+#define LINK_COMMANDS 24
+#define LINK_GAP_MS  150        //Longer than the board's LINK_PERIOD
+
+static const char *Chemistries[PROFILE_TYPES] = {"custom", "flooded", "agm", "gel"};
+static const char *Meters[LINK_METER_WHICH] = {"off", "trickle", "hardon", "regulate", "today", "day"};
+
+//LINK_SET names in setting order, and whether they are in mV
+static const char *Settings[LINK_SETTING_COUNT] = {"target", "hystgap", "wait", "float", "bulk", "absorbtime",
+                                                   "batt_high", "batt_low", "solar_high", "solar_low"};
+static const bool Volts[LINK_SETTING_COUNT] = {true, true, false, true, true, false, false, false, false, false};
+
+static unsigned int Get16 (const byte *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static double Get64 (const byte *p)
+{
+  unsigned long long v = 0;
+  for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return (double)v;
+}
+
+static void Print (const byte *p, byte len)
+{
+  if (p[0] == LINK_STATUS && len >= 13)
+    printf("status,%u,%lu,%.3f,%.3f,%s,%.1f,%u,%u\n", p[1], Get16(p + 2) | ((unsigned long)Get16(p + 4) << 16),
+           Get16(p + 6) / 1000.0, Get16(p + 8) / 1000.0, (p[10] & 7) == TELEMETRY_BOOT ? "boot" : ChargeStateMachine::Name(p[10] & 7), 100.0 * p[11] / 255, p[12],
+           len >= 14 ? p[13] : 0);     //Older builds send no channel
+  else if (p[0] == LINK_SETTINGS && len >= 2 + 2 * LINK_SETTING_COUNT)
+  {
+    printf("settings");
+    for (int i = 0; i < LINK_SETTING_COUNT; i++)
+    {
+      if (Volts[i]) printf(",%.3f", Get16(p + 1 + 2 * i) / 1000.0);
+      else printf(",%u", Get16(p + 1 + 2 * i));
+    }
+    byte chemistry = p[1 + 2 * LINK_SETTING_COUNT];
+    printf(",%s\n", chemistry < PROFILE_TYPES ? Chemistries[chemistry] : "?");
+  }
+  else if (p[0] == LINK_NAK && len >= 3)
+    printf("nak,%u,%u\n", p[1], p[2]);
+  else if (p[0] == LINK_PROBE && len >= 20 + PROBE_BUCKETS)
+  {
+    double us = Get16(p + 2) ? Get16(p + 2) : 1;
+    unsigned long f[4];
+    for (int i = 0; i < 4; i++) f[i] = Get16(p + 4 + 4 * i) | ((unsigned long)Get16(p + 6 + 4 * i) << 16);
+    printf("probe,%s,%lu,%.1f,%.1f,%.1f", ProbeName(p[1]), f[0], f[1] / us, f[2] / us, f[3] / us);
+    for (int b = 0; b < PROBE_BUCKETS; b++) printf(",%.1f", 100.0 * p[20 + b] / 255);
+    printf("\n");
+  }
+  else if (p[0] == LINK_ENERGY && len >= 27)
+  {
+    double delivered = Get64(p + 9) / ENERGY_PER_WH, available = Get64(p + 17) / ENERGY_PER_WH;
+    printf("energy,%u,%s,%u,%.2f,%.3f,%.3f,%.1f,%.3f\n", p[1], p[2] < LINK_METER_WHICH ? Meters[p[2]] : "?", Get16(p + 3),
+           (Get16(p + 5) | ((unsigned long)Get16(p + 7) << 16)) / 3600.0, delivered, available,
+           available > 0 ? 100 * delivered / available : 0.0, Get16(p + 25) / 1000.0);
+  }
+  else
+    printf("unknown,%u,%u\n", p[0], len);
+  fflush(stdout);
+}
+
+static bool Send (int fd, const byte *payload, byte len)
+{
+  byte frame[LINK_MAX_FRAME];
+  byte n = LinkEncode(payload, len, frame);
+  return (write(fd, frame, n) == n);
+}
+
+int main (int argc, char **argv)
+{
+  const char *port = 0;
+  byte commands[LINK_COMMANDS][4];
+  byte lengths[LINK_COMMANDS];
+  int count = 0;
+  long frames = -1;
+  double seconds = -1;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--set") && i + 2 < argc && count < LINK_COMMANDS)
+    {
+      const char *name = argv[++i];
+      double value = atof(argv[++i]);
+      byte setting = 0;
+      for (int s = 0; s < LINK_SETTING_COUNT; s++)
+        if (!strcmp(name, Settings[s])) setting = s + 1;
+      if (!setting) port = 0, i = argc;
+      else
+      {
+        unsigned int v = (unsigned int)(Volts[setting - 1] ? value * 1000 + 0.5 : value);
+        byte *c = commands[count];
+        c[0] = LINK_SET;
+        c[1] = setting;
+        c[2] = v & 0xFF;
+        c[3] = v >> 8;
+        lengths[count++] = 4;
+      }
+    }
+    else if (!strcmp(argv[i], "--get") && count < LINK_COMMANDS)
+    {
+      commands[count][0] = LINK_GET;
+      lengths[count++] = 1;
+    }
+    else if (!strcmp(argv[i], "--save") && count < LINK_COMMANDS)
+    {
+      commands[count][0] = LINK_SAVE;
+      lengths[count++] = 1;
+    }
+    else if (!strcmp(argv[i], "--clear") && count < LINK_COMMANDS)
+    {
+      commands[count][0] = LINK_CLEAR;
+      lengths[count++] = 1;
+    }
+    else if (!strcmp(argv[i], "--probes") && count + PROBE_COUNT <= LINK_COMMANDS)
+    {
+      for (byte probe = 0; probe < PROBE_COUNT; probe++)
+      {
+        commands[count][0] = LINK_PROBES;
+        commands[count][1] = probe;
+        lengths[count++] = 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--energy") && i + 1 < argc && count + LINK_METER_WHICH <= LINK_COMMANDS)
+    {
+      byte channel = atoi(argv[++i]);
+      for (byte which = 0; which < LINK_METER_WHICH; which++)
+      {
+        commands[count][0] = LINK_METER;
+        commands[count][1] = channel;
+        commands[count][2] = which;
+        lengths[count++] = 3;
+      }
+    }
+    else if (!strcmp(argv[i], "--preset") && i + 1 < argc && count < LINK_COMMANDS)
+    {
+      const char *name = argv[++i];
+      commands[count][0] = LINK_PRESET;
+      commands[count][1] = 0;
+      for (int c = 1; c < PROFILE_TYPES; c++)
+        if (!strcmp(name, Chemistries[c])) commands[count][1] = c;
+      if (!commands[count][1]) port = 0, i = argc;
+      else lengths[count++] = 2;
+    }
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc) frames = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) seconds = atof(argv[++i]);
+    else if (argv[i][0] != '-' && !port) port = argv[i];
+    else port = 0, i = argc;
+  }
+  if (!port)
+  {
+    fprintf(stderr, "usage: %s port [--set setting value]... [--get] [--preset flooded|agm|gel] [--save] [--clear]"
+                    " [--probes] [--energy channel] [--frames N] [--seconds S]\n", argv[0]);
+    return 1;
+  }
+
+  int fd = open(port, (count ? O_RDWR : O_RDONLY) | O_NOCTTY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "%s: can't open %s\n", argv[0], port);
+    return 1;
+  }
+  struct termios t;
+  if (isatty(fd) && !tcgetattr(fd, &t))
+  {
+    cfmakeraw(&t);
+    cfsetspeed(&t, B57600);
+    tcsetattr(fd, TCSANOW, &t);
+  }
+  for (int i = 0; i < count; i++)
+  {
+    if (i) usleep(LINK_GAP_MS * 1000);
+    if (!Send(fd, commands[i], lengths[i]))
+    {
+      fprintf(stderr, "%s: can't write to %s\n", argv[0], port);
+      return 1;
+    }
+  }
+
+  LinkReader Reader;
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long seen = 0;
+  while (frames < 0 || seen < frames)
+  {
+    double elapsed = 0;
+    if (seconds >= 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+      if (elapsed >= seconds) break;
+    }
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, seconds >= 0 ? (int)((seconds - elapsed) * 1000) + 1 : -1) <= 0) continue;
+    byte buf[64];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    for (ssize_t i = 0; i < n && (frames < 0 || seen < frames); i++)
+    {
+      if (!Reader.Receive(buf[i])) continue;
+      Print(Reader.Payload(), Reader.Length());
+      seen++;
+    }
+  }
+  if (Reader.Errors()) fprintf(stderr, "%u bad frames\n", Reader.Errors());
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef HostLowPower_h
+#define HostLowPower_h
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//  Host stand-in for the Low-Power library (https://github.com/rocketscream/Low-Power)
+//  Only what the sketch uses, powerDown() moves the virtual clock on, see HostArduino.cpp
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum period_t { SLEEP_15MS, SLEEP_30MS, SLEEP_60MS, SLEEP_120MS, SLEEP_250MS, SLEEP_500MS,
+                SLEEP_1S, SLEEP_2S, SLEEP_4S, SLEEP_8S, SLEEP_FOREVER };
+enum adc_t { ADC_OFF, ADC_ON };
+enum bod_t { BOD_OFF, BOD_ON };
+
+class LowPowerClass {
+  public:
+        void powerDown (period_t period, adc_t adc, bod_t bod);
+};
+
+extern LowPowerClass LowPower;
+
+#endif
@@ -0,0 +1,304 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Optical frame decoder. Reads the frames the charger sends on its LED (SendFrame() in
+//  MorseSender.h, INDICATOR_OPTICAL in PWM_Charge_Controller.h) from a capture of the light,
+//  or sends some through the sketch's own MorseSender on the emulated chip and checks they
+//  come back.
+//
+//  optical_decode capture.csv
+//  optical_decode --selftest [--frames N] [--jitter us] [--rate Hz] [--save file]
+//
+//  A capture is "seconds,level" lines, from a photodiode on a scope or logic analyser or the
+//  brightness of the LED in each frame of a video. Anything over halfway between the darkest
+//  and brightest sample is on. Each good frame is printed as a CSV line:
+//
+//      status,seconds,battery_v,solar_v,state,waveform,duty_pct,faults,soc_pct,channel
+//      frame,seconds,length,payload in hex
+//
+//  the first for the sketch's status (OPTICAL_STATUS_LENGTH), the second anything else. The
+//  bit rate is found from each frame's preamble, so a build with another OPTICAL_HALF_TICKS
+//  reads the same way. It needs a few samples a half bit: at the default 244 bits/s that is a
+//  photodiode, a 240fps camera wants OPTICAL_HALF_TICKS 8 or more. Frames with a bad CRC, or
+//  that stop part way, are counted on stderr.
+//
+//  --selftest sends N frames (100 unless given) of random bytes, every other one the length
+//  of the status, records the pin's edges, moves each by up to --jitter us either way and,
+//  with --rate, samples them as a capture would be. Then it decodes them, prints how many
+//  came back, and fails (exit 1) unless every one did, in order. --save writes the trace as
+//  a capture.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "PWM_Charge_Controller.h"
+#include "MorseSender.h"
+#include "SerialLink.h"
+#include "PWMLibs.h"
+#include "ChargeStateMachine.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#define OPTICAL_PIN        13
+#define OPTICAL_LOCK_EDGES  8     //Preamble edges the half bit is measured over
+
+static const char *Waveforms[] = {"off", "trickle", "hardon", "regulate"};
+
+struct Edge {
+  double Time;        //Seconds
+  bool Rising;
+};
+
+struct Frame {
+  double Time;        //Of its first edge
+  std::vector<byte> Payload;
+};
+
+//////////////////////////////////////////////////////////////
+//A level trace to its edges, each halfway between the samples
+//either side of it
+//////////////////////////////////////////////////////////////
+
+static std::vector<Edge> FindEdges (const std::vector<double> &time, const std::vector<double> &level)
+{
+  std::vector<Edge> edges;
+  if (time.empty()) return edges;
+  double middle = (*std::min_element(level.begin(), level.end()) + *std::max_element(level.begin(), level.end())) / 2;
+  bool on = level[0] > middle;
+  for (size_t i = 1; i < time.size(); i++)
+  {
+    bool now = level[i] > middle;
+    if (now == on) continue;
+    edges.push_back({(time[i - 1] + time[i]) / 2, now});
+    on = now;
+  }
+  return edges;
+}
+
+static byte GetByte (const std::vector<byte> &bits, size_t at)
+{
+  byte b = 0;
+  for (int i = 0; i < 8; i++) b |= bits[at + i] << i;
+  return b;
+}
+
+//////////////////////////////////////////////////////////////
+//Manchester, see MorseSender.h. A frame starts with a rising
+//edge, the middle of the preamble's first bit, and the preamble
+//is a square wave with an edge every bit, which gives the half
+//bit. After that an edge about a bit after the last middle is
+//the next middle, its direction the bit, one about half a bit
+//after is the boundary between two bits the same. Anything else
+//ends the frame. The half bit follows the middles, so a sender
+//whose clock is a little out is still read.
+//////////////////////////////////////////////////////////////
+
+static std::vector<Frame> Decode (const std::vector<Edge> &e, unsigned int &bad)
+{
+  std::vector<Frame> frames;
+  size_t i = 0;
+  while (i + OPTICAL_LOCK_EDGES < e.size())
+  {
+    if (!e[i].Rising)
+    {
+      i++;
+      continue;
+    }
+    double half = (e[i + OPTICAL_LOCK_EDGES].Time - e[i].Time) / (2 * OPTICAL_LOCK_EDGES);
+    bool square = half > 0;
+    for (size_t k = 1; k <= OPTICAL_LOCK_EDGES && square; k++)
+      if (fabs(e[i + k].Time - e[i + k - 1].Time - 2 * half) > half / 2) square = false;
+    if (!square)
+    {
+      i++;
+      continue;
+    }
+
+    std::vector<byte> bits(1, 1);
+    double middle = e[i].Time;
+    size_t j = i + 1;
+    for (; j < e.size(); j++)
+    {
+      double gap = e[j].Time - middle;
+      if (gap < half / 2 || gap > half * 2.5) break;
+      if (gap < half * 1.5) continue;
+      bits.push_back(e[j].Rising);
+      half += (gap / 2 - half) / 8;
+      middle = e[j].Time;
+    }
+
+    //The start byte, after what is left of the preamble
+    size_t at = 0;
+    byte shift = 0;
+    while (at < bits.size() && at < 3 * 8)
+    {
+      shift = (shift >> 1) | (bits[at++] << 7);
+      if (at >= 8 && shift == OPTICAL_START) break;
+    }
+    if (shift == OPTICAL_START)
+    {
+      std::vector<byte> bytes;
+      for (; at + 8 <= bits.size(); at += 8) bytes.push_back(GetByte(bits, at));
+      if (bytes.size() >= 3 && bytes[0] <= OPTICAL_MAX_PAYLOAD && bytes.size() >= bytes[0] + 3U &&
+          LinkCRC(&bytes[0], bytes[0] + 1) == (unsigned int)(bytes[bytes[0] + 1] | (bytes[bytes[0] + 2] << 8)))
+        frames.push_back({e[i].Time, std::vector<byte>(bytes.begin() + 1, bytes.begin() + 1 + bytes[0])});
+      else bad++;
+    }
+    i = j;
+  }
+  return frames;
+}
+
+static void Print (const Frame &f)
+{
+  const std::vector<byte> &p = f.Payload;
+  if (p.size() == OPTICAL_STATUS_LENGTH)
+  {
+    printf("status,%.3f,%.3f,%.3f,%s,%s,%.1f,%u,%u,%u\n", f.Time, (p[0] | (p[1] << 8)) / 1000.0,
+           (p[2] | (p[3] << 8)) / 1000.0, ChargeStateMachine::Name(p[4]), p[5] <= PWM_REGULATE ? Waveforms[p[5]] : "?",
+           100.0 * p[6] / 255, p[7], p[8], p[9]);
+    return;
+  }
+  printf("frame,%.3f,%u,", f.Time, (unsigned int)p.size());
+  for (size_t i = 0; i < p.size(); i++) printf("%02X", p[i]);
+  printf("\n");
+}
+
+//////////////////////////////////////////////////////////////
+//Self test, the pin's edges as the emulated core moves on
+//////////////////////////////////////////////////////////////
+
+static std::vector<Edge> Recorded;
+static int LastLevel = LOW;
+
+static void Watch (unsigned long long wallMicros)
+{
+  (void)wallMicros;
+  int level = HostPinLevel(OPTICAL_PIN);
+  if (level == LastLevel) return;
+  Recorded.push_back({HostPinChanged(OPTICAL_PIN) / 1e6, level == HIGH});
+  LastLevel = level;
+}
+
+static void Finish (MorseSender &led)
+{
+  delay(1);
+  led.Update();
+}
+
+static int SelfTest (int count, double jitterUs, double rate, const char *save)
+{
+  MorseSender led(OPTICAL_PIN);
+  HostSetTimeHook(Watch);
+  srand(1);
+  std::vector<std::vector<byte> > sent;
+  for (int n = 0; n < count; n++)
+  {
+    std::vector<byte> p((n & 1) ? OPTICAL_STATUS_LENGTH : 1 + rand() % OPTICAL_MAX_PAYLOAD);
+    for (size_t i = 0; i < p.size(); i++) p[i] = rand() & 0xFF;
+    while (!led.SendFrame(&p[0], p.size())) Finish(led);
+    sent.push_back(p);
+  }
+  while (led.isBusy()) Finish(led);
+  delay(OPTICAL_GAP_MS);
+
+  std::vector<Edge> edges = Recorded;
+  for (size_t i = 0; i < edges.size(); i++) edges[i].Time += jitterUs / 1e6 * (2.0 * rand() / RAND_MAX - 1);
+  std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) { return a.Time < b.Time; });
+
+  //As a capture would have it, sampled, or a pair of samples either side of each edge
+  std::vector<double> time, level;
+  if (rate > 0)
+  {
+    double end = (edges.empty() ? 0 : edges.back().Time) + OPTICAL_GAP_MS / 1000.0;
+    size_t next = 0;
+    bool on = false;
+    for (double t = 0; t < end; t += 1 / rate)
+    {
+      while (next < edges.size() && edges[next].Time <= t) on = edges[next++].Rising;
+      time.push_back(t);
+      level.push_back(on);
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < edges.size(); i++)
+    {
+      time.push_back(edges[i].Time);
+      level.push_back(!edges[i].Rising);
+      time.push_back(edges[i].Time);
+      level.push_back(edges[i].Rising);
+    }
+  }
+  if (save)
+  {
+    FILE *f = fopen(save, "w");
+    if (!f)
+    {
+      fprintf(stderr, "can't write %s\n", save);
+      return 1;
+    }
+    for (size_t i = 0; i < time.size(); i++) fprintf(f, "%.6f,%d\n", time[i], (int)level[i]);
+    fclose(f);
+  }
+
+  unsigned int bad = 0;
+  std::vector<Frame> frames = Decode(FindEdges(time, level), bad);
+  size_t matched = 0;
+  for (size_t i = 0; i < frames.size() && matched < sent.size(); i++)
+    if (frames[i].Payload == sent[matched]) matched++;
+  double seconds = Recorded.empty() ? 0 : Recorded.back().Time - Recorded.front().Time;
+  printf("sent %zu, decoded %zu, matched %zu, bad %u, %.1fs of light, %.0f bits/s\n", sent.size(), frames.size(),
+         matched, bad, seconds, 500.0 / (OPTICAL_HALF_TICKS * 1.024));
+  return (matched == sent.size() && frames.size() == sent.size()) ? 0 : 1;
+}
+
+int main (int argc, char **argv)
+{
+  const char *capture = 0;
+  const char *save = 0;
+  bool selftest = false;
+  int count = 100;
+  double jitter = 0, rate = 0;
+  bool ok = true;
+  for (int i = 1; i < argc && ok; i++)
+  {
+    if (!strcmp(argv[i], "--selftest")) selftest = true;
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc) ok = (count = atoi(argv[++i])) > 0;
+    else if (!strcmp(argv[i], "--jitter") && i + 1 < argc) jitter = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--rate") && i + 1 < argc) rate = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--save") && i + 1 < argc) save = argv[++i];
+    else if (argv[i][0] != '-' && !capture) capture = argv[i];
+    else ok = false;
+  }
+  if (!ok || selftest == (capture != 0))
+  {
+    fprintf(stderr, "usage: %s capture.csv\n"
+                    "       %s --selftest [--frames N] [--jitter us] [--rate Hz] [--save file]\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (selftest) return SelfTest(count, jitter, rate, save);
+
+  FILE *f = fopen(capture, "r");
+  if (!f)
+  {
+    fprintf(stderr, "%s: can't read %s\n", argv[0], capture);
+    return 1;
+  }
+  std::vector<double> time, level;
+  char line[128];
+  double t, v;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "%lf,%lf", &t, &v) != 2) continue;     //Headings
+    time.push_back(t);
+    level.push_back(v);
+  }
+  fclose(f);
+
+  unsigned int bad = 0;
+  std::vector<Frame> frames = Decode(FindEdges(time, level), bad);
+  for (size_t i = 0; i < frames.size(); i++) Print(frames[i]);
+  if (bad) fprintf(stderr, "%u bad frames\n", bad);
+  return 0;
+}
@@ -0,0 +1,328 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Charge algorithm simulator. Runs the sketch on the emulated chip (HostArduino.cpp) wired to
+//  the battery and panel models in ChargePlant.cpp, driven by an irradiance trace.
+//
+//  pwm_charge_sim profile.csv [--repeat N] [--soc 0-1] [--capacity Ah] [--load mA] [--temp C]
+//                             [--inject fault@hours] [--trace S] [--eeprom file] [--soc-limit avg:worst]
+//
+//  The profile is CSV lines of "seconds,W/m2", anything else is skipped, irradiance between
+//  points is interpolated. --repeat plays the profile N times back to back. --temp is the
+//  battery's temperature, which moves its gassing voltage and is what the thermistor reads. --trace S prints a
+//  CSV line of the plant every S seconds of simulated time. --eeprom saves the EEPROM image at
+//  the end, the telemetry log in it can be read back with telemetry_dump.
+//
+//  Built three times, pwm_charge_sim with the sketch as configured, pwm_charge_sim_legacy with
+//  CONTROL_PI 0 (the original trickle and hysteresis law) so the two can be compared, and
+//  pwm_charge_sim_dual with CHARGE_CHANNELS 2. That gives each channel its own battery and
+//  panel, alike and under the same sky, so they should come out the same; the options apply
+//  to both, --inject and --trace to the first. Its summary is given for each channel.
+//
+//  Reports energy put into the battery against what the panel could have given at its maximum
+//  power point, and the sketch's own EnergyMeter figures from its current sensor (EnergyMeter.h),
+//  time spent in each ChargePWM state with the energy metered in it and in each
+//  ChargeStateMachine state (with how often it was entered), how far the battery went over TARGET, the SleepManager's
+//  estimate of the board's own current and how often the watchdog ran out (the Supervisor
+//  should never let it). Also how long into the sample task each channel's control step is
+//  done, on the emulated chip's clock, which goes up by a scan and a control step for each
+//  channel after the first (ChargeChannel.h).
+//
+//  --inject puts a fault into the plant at a time, to see ChargeProtection find it:
+//      battery      the battery divider goes open, A0 reads 0V
+//      solar        the solar divider's low side goes open, A1 reads 5V
+//      jump         a bad joint in the battery sense lead, A0 reads 1.5V low
+//      stuck        the MOSFET fails closed
+//      overcharge   another 3A charger is put on the battery
+//  The summary says which faults latched and how long after the injection.
+//
+//  The sketch's SocEstimator is checked against the battery model as it goes: the trace has
+//  both, and the summary gives the average and worst difference. --load is given to the
+//  estimator as well, --capacity isn't, so a wrong BATTERY_AH can be tried. --soc-limit fails
+//  the run (exit 1) if the average or worst difference is over the percentages given, ctest
+//  runs three_days.csv with it.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "PWM_Charge_Controller.ino"
+#include "ChargePlant.h"
+#include <time.h>
+
+#define SIM_STEP 0.1              //Longest plant step, seconds
+#define SOC_SETTLED 10.0          //Seconds before the estimate is marked, setup() gives it its start
+
+static ChargePlant Plant[CHARGE_CHANNELS];
+static const uint8_t PlantWaveform[2] = {CHARGEWAVEFORM, TIMER0_PWM_PIN};
+static const uint8_t PlantBattery[2] = {A0, CHARGE2_BATTERY_PIN};
+static const uint8_t PlantSolar[2] = {A1, CHARGE2_SOLAR_PIN};
+static const uint8_t PlantCurrent[2] = {CURRENT_SENSE_PIN, CHARGE2_CURRENT_PIN};
+static const uint8_t PlantTrigger[2] = {PWM_TRIGGER_TIMER1, PWM_TRIGGER_TIMER0};
+static Thermistor SimNtc;
+static IrradianceProfile Sky;
+static double LastStep = 0;
+static double TraceEvery = 0, NextTrace = 0;
+static double SocError = 0, SocWorst = 0, SocWorstAt = 0;
+static double SocLimitAverage = -1, SocLimitWorst = -1;       //Percent, off unless given
+
+#define INJECT_NONE       0
+#define INJECT_BATTERY    1
+#define INJECT_SOLAR      2
+#define INJECT_JUMP       3
+#define INJECT_STUCK      4
+#define INJECT_OVERCHARGE 5
+static const char *InjectNames[] = {"none", "battery", "solar", "jump", "stuck", "overcharge"};
+static int Inject = INJECT_NONE;
+static double InjectAt = 0;
+static bool Injected = false;
+
+static const char *StateNames[PLANT_STATES] = {"Off", "Trickle", "Hard on", "Regulate", "Asleep"};
+
+//The serial link isn't looked at, just kept off stdout
+static void SimSerial (uint8_t c)
+{
+  (void)c;
+}
+
+static int PlantState (int i)
+{
+  if (!Plant[i].Pumping) return 4;
+  if (Bank[i].Charger.isRegulating()) return 3;
+  if (Bank[i].Charger.isHardOn()) return 2;
+  if (Bank[i].Charger.isTrickle()) return 1;
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Called by the emulator whenever time moves. The plant runs on
+//with the outputs as they were, then picks up any new ones.
+//////////////////////////////////////////////////////////////
+
+static void SimTime (unsigned long long wall)
+{
+  double now = wall / 1e6;
+  double duty[CHARGE_CHANNELS];
+  bool changed = false;
+  for (int i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    duty[i] = HostPinDuty(PlantWaveform[i]);
+    if (duty[i] != Plant[i].Duty) changed = true;
+  }
+  bool pumping = HostPinDuty(CHARGEPUMP_PWM_A) > 0 && HostPinDuty(CHARGEPUMP_PWM_A) < 1;
+  if (now - LastStep < SIM_STEP && !changed && pumping == Plant[0].Pumping) return;
+
+  int state[CHARGE_CHANNELS];
+  for (int i = 0; i < CHARGE_CHANNELS; i++) state[i] = PlantState(i);
+  while (LastStep < now)
+  {
+    double dt = now - LastStep;
+    if (dt > 1.0) dt = 1.0;
+    if (Inject != INJECT_NONE && !Injected && LastStep >= InjectAt)
+    {
+      Injected = true;
+      if (Inject == INJECT_STUCK) Plant[0].StuckOn = true;
+      if (Inject == INJECT_OVERCHARGE) Plant[0].ExtraAmps = 3.0;
+    }
+    for (int i = 0; i < CHARGE_CHANNELS; i++)
+    {
+      Plant[i].Panel.Irradiance = Sky.At(LastStep);
+      Plant[i].Step(dt, state[i]);
+    }
+    LastStep += dt;
+    double error = (now > SOC_SETTLED) ? fabs(Bank[0].Soc.Permille() / 1000.0 - Plant[0].Battery.SoC) : 0;   //Not begun yet
+    SocError += error * dt;
+    if (error > SocWorst) SocWorst = error, SocWorstAt = LastStep;
+    if (TraceEvery > 0 && LastStep >= NextTrace)
+    {
+      NextTrace += TraceEvery;
+      printf("%.0f,%.0f,%.4f,%.3f,%.3f,%.3f,%s,%.3f\n", LastStep, Plant[0].Panel.Irradiance, Plant[0].Battery.SoC,
+             Plant[0].BatteryRest, Plant[0].BatteryOn, Plant[0].Pumping ? Plant[0].Duty : 0.0, StateNames[state[0]],
+             Bank[0].Soc.Permille() / 1000.0);
+    }
+  }
+  for (int i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    Plant[i].Duty = duty[i];
+    Plant[i].Pumping = pumping;
+  }
+}
+
+static unsigned int SimDivider (double volts, int high, int low)
+{
+  return (unsigned int)(volts * 1000.0 * low / (high + low) + 0.5);
+}
+
+static unsigned int SimAnalog (uint8_t channel)
+{
+  if (channel == A0 - A0 && Injected && Inject == INJECT_BATTERY) return 0;
+  if (channel == A1 - A0 && Injected && Inject == INJECT_SOLAR) return 5000;
+  if (channel == TEMP_SENSOR_PIN - A0) return (unsigned int)(SimNtc.Pin(Plant[0].Battery.Celsius) * 1000.0 + 0.5);
+  for (int i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    bool offPhase = (ADCSRA & _BV(ADATE)) && (ADCSRB & 0x07) == PlantTrigger[i];   //Triggered from its own waveform
+    double battery = Plant[i].BatteryPin(offPhase);
+    if (!i && Injected && Inject == INJECT_JUMP) battery -= 1.5;
+    if (channel == PlantBattery[i] - A0) return SimDivider(battery, BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE);
+    if (channel == PlantSolar[i] - A0) return SimDivider(Plant[i].SolarPin(offPhase), SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE);
+    if (channel == PlantCurrent[i] - A0)
+    {
+      //The average over the waveform, as the oversampled free running scan sees it. From the
+      //outputs as they are now, the plant only catches up with them at its next step
+      double pump = HostPinDuty(CHARGEPUMP_PWM_A);
+      double duty = Plant[i].StuckOn ? 1.0 : (offPhase || pump <= 0 || pump >= 1) ? 0.0 : HostPinDuty(PlantWaveform[i]);
+      double mv = (duty > 0) ? duty * Plant[i].ClosedAmps() * CURRENT_SHUNT_MOHM * CURRENT_GAIN + CURRENT_OFFSET_MV : CURRENT_OFFSET_MV;
+      return (unsigned int)(mv > 5000 ? 5000 : mv + 0.5);
+    }
+  }
+  return 0;
+}
+
+int main (int argc, char **argv)
+{
+  const char *profile = 0;
+  const char *eeprom = 0;
+  int repeat = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--soc") && i + 1 < argc) Plant[0].Battery.SoC = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--capacity") && i + 1 < argc) Plant[0].Battery.CapacityAh = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--load") && i + 1 < argc) Plant[0].LoadAmps = atof(argv[++i]) / 1000.0, DrainmA = (unsigned int)(Plant[0].LoadAmps * 1000 + 0.5);
+    else if (!strcmp(argv[i], "--temp") && i + 1 < argc) Plant[0].Battery.Celsius = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--inject") && i + 1 < argc)
+    {
+      char kind[16];
+      if (sscanf(argv[++i], "%15[a-z]@%lf", kind, &InjectAt) != 2) InjectAt = -1;
+      for (int k = INJECT_BATTERY; k <= INJECT_OVERCHARGE; k++)
+        if (!strcmp(kind, InjectNames[k])) Inject = k;
+      if (Inject == INJECT_NONE || InjectAt < 0) profile = 0, i = argc;
+      InjectAt *= 3600;
+    }
+    else if (!strcmp(argv[i], "--trace") && i + 1 < argc) TraceEvery = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--soc-limit") && i + 1 < argc)
+    {
+      if (sscanf(argv[++i], "%lf:%lf", &SocLimitAverage, &SocLimitWorst) != 2) profile = 0, i = argc;
+    }
+    else if (!strcmp(argv[i], "--eeprom") && i + 1 < argc) eeprom = argv[++i];
+    else if (argv[i][0] != '-' && !profile) profile = argv[i];
+    else profile = 0, i = argc;
+  }
+  if (!profile)
+  {
+    fprintf(stderr, "usage: %s profile.csv [--repeat N] [--soc 0-1] [--capacity Ah] [--load mA] [--temp C] [--inject fault@hours] [--trace S] [--eeprom file] [--soc-limit avg:worst]\n", argv[0]);
+    return 1;
+  }
+  if (!Sky.Load(profile))
+  {
+    fprintf(stderr, "%s: can't read an irradiance profile from %s\n", argv[0], profile);
+    return 1;
+  }
+
+  double startSoC = Plant[0].Battery.SoC;
+  Plant[0].Threshold = TARGET;
+  SimNtc.FixedR = NTC_FIXED_R;
+  SimNtc.R25 = NTC_R25;
+  SimNtc.Beta = NTC_BETA;
+  Plant[0].Panel.Irradiance = Sky.At(0);
+  for (int i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    Plant[i] = Plant[0];      //The others the same as the first
+    Plant[i].Step(0, -1);     //Readings for the first A-D scan
+  }
+  if (TraceEvery > 0) printf("seconds,irradiance,soc,rest_v,on_v,duty,state,soc_estimate\n");
+
+  HostSetAnalogSource(SimAnalog);
+  HostSetTimeHook(SimTime);
+  HostSetSerialSink(SimSerial);
+  HostStopAt((unsigned long long)(Sky.Length * repeat * 1e6));
+  clock_t began = clock();
+  try
+  {
+    setup();
+    while (true) loop();
+  }
+  catch (HostStop &)
+  {
+  }
+  double cpu = (double)(clock() - began) / CLOCKS_PER_SEC;
+
+  printf("Simulated %.1f hours in %.1fs (%.0fx real time)\n", Plant[0].Seconds / 3600, cpu, Plant[0].Seconds / (cpu > 0 ? cpu : 1e-3));
+  unsigned long uptime = Sleeper.Uptime();
+  for (int i = 0; i < CHARGE_CHANNELS; i++)
+  {
+    ChargePlant &plant = Plant[i];
+    ChargeChannel &c = Bank[i];
+    if (CHARGE_CHANNELS > 1) printf("Channel %d, waveform on pin %u:\n", i, PlantWaveform[i]);
+    printf("Energy into battery %.2fWh of %.2fWh available at the panel's maximum power point (%.1f%%)\n",
+           plant.HarvestWh, plant.AvailableWh, plant.AvailableWh > 0 ? 100 * plant.HarvestWh / plant.AvailableWh : 0.0);
+    printf("State of charge %.1f%% -> %.1f%%, %.3fAh lost to gassing\n", 100 * startSoC, 100 * plant.Battery.SoC, plant.Battery.GassedAh);
+    if (!i)
+    {
+      printf("Battery at %.1fC, setpoints absorb %.2fV float %.2fV\n", plant.Battery.Celsius, c.AbsorbSetpoint() / 1000.0,
+             c.FloatSetpoint() / 1000.0);
+      printf("Estimated state of charge %.1f%%, out by %.1f%% on average, worst %.1f%% at %.2fh\n", c.Soc.Permille() / 10.0,
+             100 * SocError / plant.Seconds, 100 * SocWorst, SocWorstAt / 3600);
+    }
+    else printf("Estimated state of charge %.1f%%\n", c.Soc.Permille() / 10.0);
+    double delivered = 0, available = 0;
+    for (byte m = 0; m < ENERGY_MODES; m++)
+    {
+      delivered += c.Energy.Mode(m).DeliveredUj / (double)ENERGY_PER_WH;
+      available += c.Energy.Mode(m).AvailableUj / (double)ENERGY_PER_WH;
+    }
+    printf("Metered %.2fWh delivered of %.2fWh at full on (%.1f%%), %u days rolled up\n", delivered, available,
+           available > 0 ? 100 * delivered / available : 0.0, c.Energy.Days());
+    for (int s = 0; s < PLANT_STATES; s++)
+    {
+      printf("  %-8s %8.2fh %5.1f%%", StateNames[s], plant.StateSeconds[s] / 3600, 100 * plant.StateSeconds[s] / plant.Seconds);
+      if (s < ENERGY_MODES)
+      {
+        const EnergyTotals &t = c.Energy.Mode(s);
+        printf(" %7.2fWh of %7.2fWh metered", t.DeliveredUj / (double)ENERGY_PER_WH, t.AvailableUj / (double)ENERGY_PER_WH);
+      }
+      printf("\n");
+    }
+    for (byte s = 0; s < CHARGE_STATES; s++)
+      printf("  %-8s %8.2fh %5u entries\n", ChargeStateMachine::Name(s), c.State.Seconds(s, uptime) / 3600.0,
+             c.State.Entries(s));
+    printf("Peak battery %.2fV, %.2fV over TARGET, %.2fh above it", plant.PeakVolts,
+           plant.PeakVolts > TARGET ? plant.PeakVolts - TARGET : 0.0, plant.SecondsAbove / 3600);
+    if (plant.FirstAbove >= 0) printf(", first reached after %.2fh", plant.FirstAbove / 3600);
+    printf("\n");
+    if (c.Protect.Faults())
+    {
+      printf("Faults latched:");
+      for (byte f = 1; f < (1 << FAULT_CHECKS); f <<= 1)
+        if (c.Protect.Faults() & f) printf(" %s", ChargeProtection::Name(f));
+      printf(", first at %.2fh", c.Protect.LatchedAt() / 3600.0);
+      if (Injected && !i) printf(" (%.0fs after the injection)", c.Protect.LatchedAt() - InjectAt);
+      printf(", indicator %s\n", c.Protect.Code());
+    }
+    else printf("No faults latched\n");
+    printf("Control step done %.1fms into the sample task, worst %.1fms\n", c.ServiceMicros / 1000.0, c.WorstServiceMicros / 1000.0);
+  }
+  printf("Sample task worst case %.1fms, %u overruns\n", Tasks.WorstCase(SampleTask) / 1000.0, Tasks.Overruns(SampleTask));
+  printf("Awake %.2fh, estimated average board current %luuA\n", (Plant[0].Seconds - HostSleptMicros() / 1e6) / 3600,
+         Sleeper.AverageMicroAmps());
+  printf("Watchdog ran out %lu times\n", HostWatchdogTimeouts());
+  if (Inject != INJECT_NONE) printf("Injected %s at %.2fh%s\n", InjectNames[Inject], InjectAt / 3600, Injected ? "" : ", after the end");
+  printf("Telemetry %d records, %lu EEPROM bytes written\n", Telemetry.Count(), HostEEPROMWrites());
+
+  if (eeprom)
+  {
+    FILE *f = fopen(eeprom, "wb");
+    if (!f || fwrite(HostEEPROM(), 1, E2END + 1, f) != E2END + 1)
+    {
+      fprintf(stderr, "%s: can't write %s\n", argv[0], eeprom);
+      if (f) fclose(f);
+      return 1;
+    }
+    fclose(f);
+  }
+  double average = 100 * SocError / Plant[0].Seconds;
+  if (SocLimitAverage >= 0 && (average > SocLimitAverage || 100 * SocWorst > SocLimitWorst))
+  {
+    printf("State of charge estimate out by %.1f%% on average, worst %.1f%%, over the limit of %.1f%% and %.1f%%\n",
+           average, 100 * SocWorst, SocLimitAverage, SocLimitWorst);
+    return 1;
+  }
+  return 0;
+}
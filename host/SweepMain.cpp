@@ -0,0 +1,270 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Parameter sweep. Runs a fleet of ChargeControllers, each on its own battery and panel model
+//  (ChargePlant.cpp) under the same sky, for every combination of the settings given, spread
+//  over a pool of threads.
+//
+//  pwm_charge_sweep profile.csv [--target V] [--hystgap V] [--wait ms] [--law pi|hysteresis]
+//                               [--fleet N] [--soc from:to] [--load mA] [--repeat N] [--threads N]
+//
+//  --target, --hystgap and --wait take one value or from:to:step, the defaults are TARGET,
+//  HYSTGAP and WAIT_TIME from PWM_Charge_Controller.h. --fleet is how many units each setting
+//  is run on, their batteries starting spread evenly over --soc (0.5:0.9 unless given). --law
+//  picks the control law, the default is the one CONTROL_PI builds. --threads defaults to one
+//  per core.
+//
+//  Prints a CSV line for each setting: the fleet's average energy into the battery, the
+//  highest battery voltage any unit saw and the average time above the target, the average
+//  state of charge at the end, and how many units latched a fault. harvest_pct is the units'
+//  own EnergyMeter figure (EnergyMeter.h), energy delivered against what full on would have
+//  given, averaged over the fleet, as a board would report it. The throughput goes to
+//  stderr, units times simulated hours for each second of wall time.
+//
+//  Unlike pwm_charge_sim this doesn't run the sketch on the emulated chip, whose registers and
+//  clock there is only one of. Each unit is a ChargeController (ChargeController.h) on an
+//  in-memory PWMOutput, given ideal readings with the switch open (what the sketch's sample
+//  task reads, in the off part of the waveform or suspended) every WaitTime, with no pause
+//  task, gate drive or indicator. So it compares settings, pwm_charge_sim is for the board.
+//  Units share nothing but the irradiance profile, which is only read, and the results come
+//  out the same whatever the number of threads.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "PWM_Charge_Controller.h"
+#include "PWMLibs.h"
+#include "MorseSender.h"
+#include "ChargeStateMachine.h"
+#include "SocEstimator.h"
+#include "EnergyMeter.h"
+#include "ChargeProtection.h"
+#include "ChargeController.h"
+#include "ChargePlant.h"
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define SWEEP_PLANT_STEP 1.0      //Longest plant step, seconds
+
+//The charge waveform, a duty in memory
+class MemoryPWM : public PWMOutput {
+
+  public:
+        MemoryPWM (unsigned int top) : TopCount(top), Hz(0), Width(0) {}
+        void Begin (unsigned long hz) { Hz = hz; }
+        void Write (unsigned int duty) { Width = duty; }
+        unsigned int Read (void) { return Width; }
+        unsigned int Top (void) { return TopCount; }
+        unsigned long Frequency (void) { return Hz; }
+        bool CanTrigger (void) { return false; }
+        byte Trigger (void) { return 0; }
+
+  private:
+        unsigned int TopCount;
+        unsigned long Hz;
+        unsigned int Width;
+};
+
+struct SweepSetting {
+  unsigned int AbsorbmV;
+  unsigned int GapmV;
+  unsigned int WaitTime;          //ms
+};
+
+struct SweepResult {
+  double HarvestWh;
+  double AvailableWh;
+  double PeakVolts;
+  double SecondsAbove;
+  double SoC;
+  double HarvestPct;              //From the unit's EnergyMeter
+  byte Faults;
+};
+
+static IrradianceProfile Sky;
+static const SocEstimator BatteryModel(BATTERY_AH, PANEL_ISC_MA, PANEL_VOC_MV, PANEL_VT_MV);
+static bool Hysteresis = !CONTROL_PI;
+static double Seconds = 0;        //Each unit runs for
+static double LoadmA = 0;
+
+static unsigned int MilliVolts (double volts)
+{
+  return (volts > 0) ? (unsigned int)(volts * 1000.0 + 0.5) : 0;
+}
+
+//////////////////////////////////////////////////////////////
+//One unit for one setting, from startSoC to the end of the
+//profile. Everything is local, so any number can run at once.
+//////////////////////////////////////////////////////////////
+
+static void RunUnit (const SweepSetting &s, double startSoC, SweepResult &r)
+{
+  MemoryPWM output(CHARGE_DUTY_MAX);
+  ChargeController control(output, -1, CHARGE_PWM_HZ, CHARGE_DUTY_MAX, ABSORB_KP, ABSORB_KI, BatteryModel, Hysteresis);
+  ChargePlant plant;
+  plant.Battery.SoC = startSoC;
+  plant.LoadAmps = LoadmA / 1000.0;
+  plant.Threshold = s.AbsorbmV / 1000.0;
+  plant.Pumping = true;
+  plant.Panel.Irradiance = Sky.At(0);
+  plant.Step(0, -1);
+
+  //As the sketch's CompensateSetpoints() would leave them at the reference temperature
+  unsigned int bulkmV = MilliVolts(BULK_VOLTAGE);
+  unsigned int floatmV = MilliVolts(FLOAT_VOLTAGE);
+  if (floatmV > s.AbsorbmV) floatmV = s.AbsorbmV;
+  control.Begin();
+  control.Setpoints(bulkmV, s.AbsorbmV, floatmV, s.GapmV, ABSORB_MINUTES);
+  control.Soc.Begin(MilliVolts(plant.BatteryPin(true)), 0);
+  control.State.Begin(0);
+
+  double period = s.WaitTime / 1000.0;
+  for (double now = 0; now < Seconds; )
+  {
+    unsigned long seconds = (unsigned long)now;
+    unsigned int bat = MilliVolts(plant.BatteryPin(true));
+    unsigned int sol = MilliVolts(plant.SolarPin(true));
+    unsigned int chargemA = (unsigned int)(plant.Duty * plant.OnAmps * 1000.0 + 0.5);    //An ideal current sensor
+    control.Count(bat, sol, true, chargemA, 0, (unsigned int)LoadmA, seconds);
+    control.Check(bat, sol, true, seconds);
+    control.Step(bat, sol, seconds);
+    plant.Duty = (double)output.Read() / output.Top();
+
+    int state = control.Charger.State();      //PWM_OFF to PWM_REGULATE, the plant's first four
+    double until = now + period;
+    if (until > Seconds) until = Seconds;
+    while (now < until)
+    {
+      double dt = until - now;
+      if (dt > SWEEP_PLANT_STEP) dt = SWEEP_PLANT_STEP;
+      plant.Panel.Irradiance = Sky.At(now);
+      plant.Step(dt, state);
+      now += dt;
+    }
+  }
+
+  r.HarvestWh = plant.HarvestWh;
+  r.AvailableWh = plant.AvailableWh;
+  r.PeakVolts = plant.PeakVolts;
+  r.SecondsAbove = plant.SecondsAbove;
+  r.SoC = plant.Battery.SoC;
+  double delivered = 0, available = 0;
+  for (byte m = 0; m < ENERGY_MODES; m++)
+  {
+    delivered += control.Energy.Mode(m).DeliveredUj;
+    available += control.Energy.Mode(m).AvailableUj;
+  }
+  r.HarvestPct = (available > 0) ? 100 * delivered / available : 0;
+  r.Faults = control.Protect.Faults();
+}
+
+//"V" or "from:to:step", scaled by unit, false if it isn't either
+static bool ParseRange (const char *text, double unit, std::vector<unsigned int> &values)
+{
+  double from, to, step;
+  int n = sscanf(text, "%lf:%lf:%lf", &from, &to, &step);
+  if (n == 1) to = from, step = 1;
+  else if (n != 3 || step <= 0 || to < from) return false;
+  if (from <= 0) return false;
+  values.clear();
+  int count = (int)floor((to - from) / step + 1e-6) + 1;
+  for (int i = 0; i < count; i++) values.push_back((unsigned int)((from + i * step) * unit + 0.5));
+  return true;
+}
+
+int main (int argc, char **argv)
+{
+  const char *profile = 0;
+  std::vector<unsigned int> targets(1, MilliVolts(TARGET));
+  std::vector<unsigned int> gaps(1, MilliVolts(HYSTGAP));
+  std::vector<unsigned int> waits(1, WAIT_TIME);
+  int fleet = 1;
+  double socFrom = 0.5, socTo = 0.9;
+  int repeat = 1;
+  int threads = std::thread::hardware_concurrency();
+  bool ok = true;
+  for (int i = 1; i < argc && ok; i++)
+  {
+    if (!strcmp(argv[i], "--target") && i + 1 < argc) ok = ParseRange(argv[++i], 1000, targets);
+    else if (!strcmp(argv[i], "--hystgap") && i + 1 < argc) ok = ParseRange(argv[++i], 1000, gaps);
+    else if (!strcmp(argv[i], "--wait") && i + 1 < argc) ok = ParseRange(argv[++i], 1, waits);
+    else if (!strcmp(argv[i], "--law") && i + 1 < argc)
+    {
+      i++;
+      if (!strcmp(argv[i], "pi")) Hysteresis = false;
+      else if (!strcmp(argv[i], "hysteresis")) Hysteresis = true;
+      else ok = false;
+    }
+    else if (!strcmp(argv[i], "--fleet") && i + 1 < argc) ok = (fleet = atoi(argv[++i])) > 0;
+    else if (!strcmp(argv[i], "--soc") && i + 1 < argc) ok = sscanf(argv[++i], "%lf:%lf", &socFrom, &socTo) == 2;
+    else if (!strcmp(argv[i], "--load") && i + 1 < argc) LoadmA = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) ok = (repeat = atoi(argv[++i])) > 0;
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc) ok = (threads = atoi(argv[++i])) > 0;
+    else if (argv[i][0] != '-' && !profile) profile = argv[i];
+    else ok = false;
+  }
+  if (!ok || !profile)
+  {
+    fprintf(stderr, "usage: %s profile.csv [--target V|from:to:step] [--hystgap V|from:to:step] [--wait ms|from:to:step]\n"
+                    "       [--law pi|hysteresis] [--fleet N] [--soc from:to] [--load mA] [--repeat N] [--threads N]\n", argv[0]);
+    return 1;
+  }
+  if (!Sky.Load(profile))
+  {
+    fprintf(stderr, "%s: can't read an irradiance profile from %s\n", argv[0], profile);
+    return 1;
+  }
+  Seconds = Sky.Length * repeat;
+  if (threads < 1) threads = 1;
+
+  std::vector<SweepSetting> settings;
+  for (size_t t = 0; t < targets.size(); t++)
+    for (size_t g = 0; g < gaps.size(); g++)
+      for (size_t w = 0; w < waits.size(); w++)
+        settings.push_back({targets[t], gaps[g], waits[w]});
+
+  //A job is one unit of one setting, the workers take the next one there is
+  size_t jobs = settings.size() * fleet;
+  std::vector<SweepResult> results(jobs);
+  std::atomic<size_t> next(0);
+  auto worker = [&]()
+  {
+    for (size_t j; (j = next++) < jobs; )
+    {
+      int unit = j % fleet;
+      double soc = (fleet > 1) ? socFrom + (socTo - socFrom) * unit / (fleet - 1) : socFrom;
+      RunUnit(settings[j / fleet], soc, results[j]);
+    }
+  };
+  auto began = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) pool.push_back(std::thread(worker));
+  for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+
+  printf("law,target_v,hystgap_v,wait_ms,units,energy_wh,available_wh,peak_v,hours_above,soc_pct,faulted,harvest_pct\n");
+  for (size_t s = 0; s < settings.size(); s++)
+  {
+    double harvest = 0, above = 0, soc = 0, peak = 0, metered = 0;
+    int faulted = 0;
+    for (int u = 0; u < fleet; u++)
+    {
+      const SweepResult &r = results[s * fleet + u];
+      harvest += r.HarvestWh;
+      above += r.SecondsAbove;
+      soc += r.SoC;
+      metered += r.HarvestPct;
+      if (r.PeakVolts > peak) peak = r.PeakVolts;
+      if (r.Faults) faulted++;
+    }
+    printf("%s,%.3f,%.3f,%u,%d,%.2f,%.2f,%.2f,%.2f,%.1f,%d,%.1f\n", Hysteresis ? "hysteresis" : "pi",
+           settings[s].AbsorbmV / 1000.0, settings[s].GapmV / 1000.0, settings[s].WaitTime, fleet,
+           harvest / fleet, results[s * fleet].AvailableWh, peak, above / fleet / 3600, 100 * soc / fleet, faulted,
+           metered / fleet);
+  }
+  fprintf(stderr, "%zu units x %.1fh in %.2fs on %d threads, %.0f unit hours a second\n", jobs, Seconds / 3600,
+          wall, threads, jobs * Seconds / 3600 / (wall > 0 ? wall : 1e-3));
+  return 0;
+}
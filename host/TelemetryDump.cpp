@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Telemetry log decoder. Reads an EEPROM image and prints the TelemetryLog records in it as
+//  CSV, oldest first.
+//
+//  telemetry_dump eeprom.bin
+//
+//  The image is the raw 1K EEPROM, as read off the board with
+//      avrdude -p m328p -c arduino -P /dev/ttyUSB0 -U eeprom:r:eeprom.bin:r
+//  or saved by pwm_charge_sim --eeprom. The records are read with the sketch's own
+//  TelemetryLog against the host EEPROM, so the decoder can't drift from the layout.
+//
+//  minutes counts from the last reset, each boot record starts it again from 0. The log keeps
+//  15 bits of it (TelemetryLog.h), it is unwrapped here from the record order, so a board up
+//  for weeks still comes out in order: the minutes of the oldest records may be a multiple of
+//  32768 short of the true uptime, they are right from each boot record on. Boot records
+//  have no readings, the last three columns say why the chip reset: MCUSR (1 power on,
+//  2 external, 4 brown out, 8 watchdog) and the watchdog and brown out resets since the
+//  last power on. channel is the charge channel a reading is from, blank for boot records.
+//  Day records are a channel's EnergyMeter roll-up (EnergyMeter.h): the energy delivered, what
+//  full on would have given and the peak charge current, in the last three columns.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "TelemetryLog.h"
+#include "ChargeStateMachine.h"
+
+int main (int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s eeprom.bin\n", argv[0]);
+    return 1;
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (!f)
+  {
+    fprintf(stderr, "%s: can't read %s\n", argv[0], argv[1]);
+    return 1;
+  }
+  size_t n = fread(HostEEPROM(), 1, E2END + 1, f);
+  fclose(f);
+  if (n < TELEMETRY_BASE + TELEMETRY_RECORD)
+  {
+    fprintf(stderr, "%s: %s is too short for an EEPROM image\n", argv[0], argv[1]);
+    return 1;
+  }
+
+  TelemetryLog Log;
+  Log.Scan();
+  printf("index,minutes,battery_v,solar_v,state,soc_pct,duty_pct,reset_flags,watchdog_resets,brownout_resets,channel,"
+         "delivered_wh,available_wh,peak_a\n");
+  TelemetryRecord r;
+  unsigned long wraps = 0, last = 0;     //Minutes added for the wraps since the last boot record
+  for (int i = 0; Log.Read(i, r); i++)
+  {
+    if (r.state == TELEMETRY_BOOT) wraps = 0;
+    else if (r.minutes < last) wraps += 0x8000;
+    last = r.minutes;
+    unsigned long minutes = r.minutes + wraps;
+    if (r.state == TELEMETRY_BOOT)
+      printf("%d,%lu,,,boot,,,0x%02X,%u,%u,,,,\n", i, minutes, r.duty, r.batterymV, r.solarmV);
+    else if (r.state == TELEMETRY_DAY)
+      printf("%d,%lu,,,day,,,,,,%u,%.1f,%.1f,%.2f\n", i, minutes, r.channel, r.batterymV / 10.0, r.solarmV / 10.0,
+             r.duty * TELEMETRY_PEAK_MA / 1000.0);
+    else
+      printf("%d,%lu,%.3f,%.2f,%s,%u,%.1f,,,,%u,,,\n", i, minutes, r.batterymV / 1000.0, r.solarmV / 1000.0,
+             ChargeStateMachine::Name(r.state), r.soc, 100.0 * r.duty / 255, r.channel);
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeChannel tests
+//
+//  channel_latency the control latency against the number of channels: the board's two
+//                  channels, Timer1 and Timer0, on one ADCSampler, with every channel controlled
+//                  every run. Measure() is a copy of the sketch's sample task pipeline
+//                  (SampleVoltages(): Prepare, settle, StartScan, FinishScan, then Check and
+//                  Step), not the sketch's own, which is built for one CHARGE_CHANNELS; a change
+//                  to SampleVoltages() has to be made here as well. Each channel's ServiceMicros,
+//                  from the start of the run to the end of its control step, is measured in
+//                  emulated time first with the channel on its own and then with both. Together
+//                  a channel's latency should be the channels ahead of it and its own, each
+//                  costing what it does alone. There are only the two points, one channel and
+//                  two (CHARGE_CHANNELS is at most 2), so that is all it shows, not a trend. The
+//                  channels are in bulk, full on, so each run suspends them, and the settle time
+//                  should be once a run, shared. It is left out of the latency here, the
+//                  sketch's own ServiceMicros takes it in.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include "PWM_Charge_Controller.h"
+#include "PWMLibs.h"
+#include "Timer0PWM.h"
+#include "MorseSender.h"
+#include "ADCSampler.h"
+#include "ChargeStateMachine.h"
+#include "SocEstimator.h"
+#include "EnergyMeter.h"
+#include "ChargeProtection.h"
+#include "ChargeController.h"
+#include "ChargeChannel.h"
+
+#define CHANNEL_COUNT     2
+#define CHANNEL_RUNS     40       //Sample runs a measurement
+#define CHANNEL_BATTERY_V 12.0    //Bulk, full on, so suspended and settled for each reading
+#define CHANNEL_SOLAR_V   18.0
+#define CHANNEL_SLACK_US  250     //Either way, a few polls and a conversion
+
+static unsigned int ChannelDivider (double volts, int high, int low)
+{
+  return (unsigned int)(volts * 1000.0 * low / (high + low) + 0.5);
+}
+
+static unsigned int ChannelAnalog (uint8_t channel)
+{
+  if (channel == A0 - A0 || channel == CHARGE2_BATTERY_PIN - A0) return ChannelDivider(CHANNEL_BATTERY_V, BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE);
+  if (channel == A1 - A0 || channel == CHARGE2_SOLAR_PIN - A0) return ChannelDivider(CHANNEL_SOLAR_V, SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE);
+  return (CURRENT_OFFSET_MV);
+}
+
+//The mean latency of each channel in use over CHANNEL_RUNS sample runs,
+//gives the mean length of a run with any settle time
+static unsigned long Measure (ChargeChannel *const *channels, byte count, ADCSampler &sampler, unsigned long *latency)
+{
+  unsigned long long length = 0;
+  unsigned long long total[CHANNEL_COUNT] = {};
+  for (byte run = 0; run < CHANNEL_RUNS; run++)
+  {
+    unsigned long start = millis(), startMicros = micros();
+    bool settle = false;
+    for (byte i = 0; i < count; i++)
+      if (channels[i]->Prepare(1)) settle = true;
+    if (settle) delay(SETTLE_TIME);
+    unsigned long began = micros();
+    channels[0]->StartScan(sampler);
+    for (byte i = 0; i < count; i++)
+    {
+      ChargeChannel &c = *channels[i];
+      c.FinishScan(sampler, SAMPLE_TIMEOUT);
+      if (i + 1 < count) channels[i + 1]->StartScan(sampler);
+      unsigned long seconds = millis() / 1000;
+      c.Check(c.Battery.LastMilliVolts(), c.Solar.LastMilliVolts(), c.SolarOpen, seconds);
+      c.Step(c.Battery.LastMilliVolts(), c.Solar.LastMilliVolts(), seconds);
+      c.ServiceMicros = micros() - began;
+      total[i] += c.ServiceMicros;
+    }
+    length += micros() - startMicros;
+    delay(SAMPLE_PERIOD - (millis() - start) % SAMPLE_PERIOD);
+  }
+  for (byte i = 0; i < count; i++) latency[i] = (unsigned long)(total[i] / CHANNEL_RUNS);
+  return ((unsigned long)(length / CHANNEL_RUNS));
+}
+
+bool TestChannelLatency (void)
+{
+  static const SocEstimator Model(BATTERY_AH, PANEL_ISC_MA, PANEL_VOC_MV, PANEL_VT_MV);
+  static Timer1PWM Waveform1;
+  static Timer0PWM Waveform0;
+  static ChargeChannel Channel0(0, Waveform1, CHARGEWAVEFORM, CHARGE_PWM_HZ, CHARGE_DUTY_MAX, A0, A1,
+                                CurrentSensor(CURRENT_SENSE_PIN, CURRENT_SHUNT_MOHM, CURRENT_GAIN, CURRENT_OFFSET_MV),
+                                ABSORB_KP, ABSORB_KI, Model, false);
+  static ChargeChannel Channel1(1, Waveform0, TIMER0_PWM_PIN, 0, TIMER0_TOP, CHARGE2_BATTERY_PIN, CHARGE2_SOLAR_PIN,
+                                CurrentSensor(CHARGE2_CURRENT_PIN, CURRENT_SHUNT_MOHM, CURRENT_GAIN, CURRENT_OFFSET_MV),
+                                ABSORB_KP, ABSORB_KI, Model, false);
+  ChargeChannel *const Both[CHANNEL_COUNT] = {&Channel0, &Channel1};
+
+  HostSetAnalogSource(ChannelAnalog);
+  ADCSampler sampler;
+  for (byte i = 0; i < CHANNEL_COUNT; i++)
+  {
+    ChargeChannel &c = *Both[i];
+    c.Begin(&sampler, SAMPLE_OVERSAMPLE_BITS, SAMPLE_FILTER_SHIFT);
+    c.Battery.SetDivider(BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE);
+    c.Solar.SetDivider(SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE);
+    c.Setpoints(BULK_VOLTAGE * 1000, TARGET * 1000, FLOAT_VOLTAGE * 1000, HYSTGAP * 1000, ABSORB_MINUTES);
+    c.State.Begin(0);
+  }
+  bool ok = true;
+  unsigned long alone[CHANNEL_COUNT], together[CHANNEL_COUNT];
+  Measure(Both, CHANNEL_COUNT, sampler, together);      //Into absorption, duty settled
+  for (byte i = 0; i < CHANNEL_COUNT; i++) Measure(Both + i, 1, sampler, alone + i);
+  unsigned long run = Measure(Both, CHANNEL_COUNT, sampler, together);
+  unsigned long ahead = 0;
+  for (byte i = 0; i < CHANNEL_COUNT; i++)
+  {
+    ahead += alone[i];
+    printf("channel %u (%s, duty %u): %luus alone, %luus with %u, %luus from the ones ahead and its own\n", i,
+           ChargeStateMachine::Name(Both[i]->State.State()), Both[i]->Duty(), alone[i], together[i], CHANNEL_COUNT, ahead);
+    ok &= CHECK(alone[i] > 0);
+    ok &= CHECK(together[i] + CHANNEL_SLACK_US >= ahead && together[i] <= ahead + CHANNEL_SLACK_US);
+  }
+  printf("a run with %u takes %luus, settling %luus of it\n", CHANNEL_COUNT, run, run - together[CHANNEL_COUNT - 1]);
+  ok &= CHECK(run >= SETTLE_TIME * 1000UL && run <= SETTLE_TIME * 1000UL + together[CHANNEL_COUNT - 1] + CHANNEL_SLACK_US);   //One for all
+  return (ok);
+}
@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargePumpPWM tests
+//
+//  pump_registers  the Timer2 registers after On() for the sketch's settings and after each run
+//                  time change, against values worked out by hand from the datasheet: phase
+//                  correct, a count is prescale / 16MHz, OC2A set either side of the midpoint
+//                  (127) by half the dead time in counts, OC2B inverted the rest of it above.
+//                  The sketch's 31372Hz and 1250ns give 117 and 137, the values the original
+//                  driver had written in. Also that Off() stops the timer and lets go of the
+//                  pins, and which pins ChargePumpPins() takes.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include "PWM_Charge_Controller.h"
+#include "PWMLibs.h"
+
+#define PUMP_TCCR2A (_BV(COM2A1) | _BV(COM2B1) | _BV(COM2B0) | _BV(WGM20))
+
+static_assert(ChargePumpPins(11, 3), "OC2A and OC2B");
+static_assert(!ChargePumpPins(3, 11) && !ChargePumpPins(9, 10), "Only Timer2's outputs, the right way round");
+
+struct PumpExpected {
+  const char *What;
+  byte TCCR2B;              //Prescaler
+  byte OCR2A;
+  byte OCR2B;
+  unsigned long Hz;
+};
+
+static bool Registers (ChargePumpPWM &pump, const PumpExpected &e)
+{
+  printf("%-24s TCCR2A 0x%02X TCCR2B %u OCR2A %3u OCR2B %3u %luHz\n", e.What, TCCR2A, TCCR2B, OCR2A, OCR2B, pump.Frequency());
+  bool ok = CHECK(TCCR2A == PUMP_TCCR2A);
+  ok &= CHECK(TCCR2B == e.TCCR2B);
+  ok &= CHECK(OCR2A == e.OCR2A);
+  ok &= CHECK(OCR2B == e.OCR2B);
+  ok &= CHECK(pump.Frequency() == e.Hz);
+  return (ok);
+}
+
+bool TestPumpRegisters (void)
+{
+  static const PumpExpected Setup = {"31372Hz 1250ns",         1,  117,  137, 31372};
+  static const PumpExpected Down  = {"a step down",            2,  126,  129,  3921};    //Prescale 8, 20 cycles is 3 counts rounded
+  static const PumpExpected At980 = {"980Hz",                  3,  127,  128,   980};    //Prescale 32, 1 count
+  static const PumpExpected Near  = {"10kHz, nearest on a log", 2,  126,  129,  3921};    //Below sqrt(31372 x 3921)
+  static const PumpExpected Up    = {"back up a step",         1,  117,  137, 31372};
+  static const PumpExpected Wide  = {"20us dead time",         1,    1,  253, 31372};    //320 counts, held to 252
+
+  bool ok = true;
+  ChargePumpPWM pump(CHARGEPUMP_PWM_A, CHARGEPUMP_PWM_B, CHARGEPUMP_HZ, CHARGEPUMP_DEADTIME_NS);
+  ok &= CHECK(!pump.isOn());
+  pump.On();
+  ok &= CHECK(pump.isOn());
+  ok &= Registers(pump, Setup);
+
+  //The gap between one output going low and the other going high, a count each side of the match
+  double deadNs = (OCR2B - OCR2A) * 1e9 / F_CPU;
+  printf("dead time %.0fns, outputs high %.1f%% and %.1f%%\n", deadNs, 100 * HostPinDuty(CHARGEPUMP_PWM_A), 100 * HostPinDuty(CHARGEPUMP_PWM_B));
+  ok &= CHECK(deadNs == CHARGEPUMP_DEADTIME_NS);
+  ok &= CHECK(HostPinDuty(CHARGEPUMP_PWM_A) + HostPinDuty(CHARGEPUMP_PWM_B) < 1.0);
+
+  ok &= CHECK(pump.StepFrequency(-1) == 3921);
+  ok &= Registers(pump, Down);
+  pump.SetFrequency(980);
+  ok &= Registers(pump, At980);
+  pump.SetFrequency(10000);
+  ok &= Registers(pump, Near);
+  ok &= CHECK(pump.StepFrequency(1) == 31372);
+  ok &= Registers(pump, Up);
+  ok &= CHECK(pump.StepFrequency(1) == 31372);      //Already the top
+  pump.SetDeadTime(20000);
+  ok &= Registers(pump, Wide);
+  pump.SetDeadTime(CHARGEPUMP_DEADTIME_NS);
+
+  pump.Off();
+  printf("off: TCCR2A 0x%02X TCCR2B %u\n", TCCR2A, TCCR2B);
+  ok &= CHECK(!pump.isOn());
+  ok &= CHECK(TCCR2A == _BV(WGM20) && TCCR2B == 0);
+  ok &= CHECK(HostPinDuty(CHARGEPUMP_PWM_A) == 0 && HostPinDuty(CHARGEPUMP_PWM_B) == 0);
+
+  pump.SetFrequency(980);       //Kept for the next On(), the timer stays off
+  ok &= CHECK(TCCR2B == 0);
+  pump.On();
+  ok &= Registers(pump, At980);
+  return (ok);
+}
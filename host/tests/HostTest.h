@@ -0,0 +1,33 @@
+#ifndef HostTest_h
+#define HostTest_h
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host tests, run by ctest (see CMakeLists.txt), one host_tests process a test:
+//
+//      host_tests name       runs it, exit 0 if it passed
+//      host_tests --list     the names
+//
+//  Each test is a function returning true if it passed, listed in TestMain.cpp. They run on
+//  the emulated chip (HostArduino.cpp), whose state is global, hence one a process. CHECK()
+//  prints what failed and where and gives false, a test ands them together so it reports
+//  every failure rather than the first. The figures a test measures are printed as it goes,
+//  so a failing run says by how much.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <stdio.h>
+
+bool HostCheck (bool ok, const char *what, const char *file, int line);
+#define CHECK(x) HostCheck((x), #x, __FILE__, __LINE__)
+
+bool TestMorseLatency (void);
+bool TestFixedPoint (void);
+bool TestMorseTiming (void);
+bool TestNoAllocation (void);
+bool TestPumpRegisters (void);
+bool TestLinkLoopback (void);
+bool TestStateMachine (void);
+bool TestChannelLatency (void);
+
+#endif
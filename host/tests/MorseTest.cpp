@@ -0,0 +1,106 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  MorseSender tests
+//
+//  morse_timing    every character with an ITU code, sent on its own and timed off the LED:
+//                  each mark is a dot (1 tempo) or a dash (5, the 1:5 ratio in MorseSender.h)
+//                  in the order the code has them, each element is followed by 3 off, the
+//                  letter by the 3 of charGap() and punctuation has a charGap() either side.
+//                  Lower case is sent as upper case, characters without a code send nothing.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include "MorseSender.h"
+#include <ctype.h>
+
+#define MORSE_PIN      12
+#define MORSE_STEP_US  1000       //Emulated time between Update() calls
+#define MORSE_SLACK_US 2000       //Either way on a timing, a step and the polls in it. Each
+                                  //step of the sender starts when it is seen to be due, so
+                                  //the letter's length can be out by this for each
+#define MORSE_MOST     8          //Elements a code can have
+
+struct MorseExpected {
+  char Letter;
+  const char *Code;
+};
+
+//ITU-R M.1677, with the $ and _ in common use
+static const MorseExpected Codes[] = {
+  {'A', ".-"},     {'B', "-..."},   {'C', "-.-."},   {'D', "-.."},    {'E', "."},      {'F', "..-."},
+  {'G', "--."},    {'H', "...."},   {'I', ".."},     {'J', ".---"},   {'K', "-.-"},    {'L', ".-.."},
+  {'M', "--"},     {'N', "-."},     {'O', "---"},    {'P', ".--."},   {'Q', "--.-"},   {'R', ".-."},
+  {'S', "..."},    {'T', "-"},      {'U', "..-"},    {'V', "...-"},   {'W', ".--"},    {'X', "-..-"},
+  {'Y', "-.--"},   {'Z', "--.."},   {'0', "-----"},  {'1', ".----"},  {'2', "..---"},  {'3', "...--"},
+  {'4', "....-"},  {'5', "....."},  {'6', "-...."},  {'7', "--..."},  {'8', "---.."},  {'9', "----."},
+  {'.', ".-.-.-"}, {',', "--..--"}, {'?', "..--.."}, {'\'', ".----."}, {'!', "-.-.--"}, {'/', "-..-."},
+  {'(', "-.--."},  {')', "-.--.-"}, {'&', ".-..."},  {':', "---..."}, {';', "-.-.-."}, {'=', "-...-"},
+  {'+', ".-.-."},  {'-', "-....-"}, {'_', "..--.-"}, {'"', ".-..-."}, {'$', "...-..-"}, {'@', ".--.-."},
+  {'a', ".-"},     {'q', "--.-"},   {'z', "--.."},
+};
+
+static const char NoCode[] = "#%*<>[\\]^`{|}~\t";
+
+static bool Near (unsigned long long took, unsigned long want, unsigned long slack = MORSE_SLACK_US)
+{
+  return (took + slack >= want && took <= want + slack);
+}
+
+//Sends a letter and checks its marks, spaces and length against the code
+static bool TimeLetter (MorseSender &morse, char letter, const char *code)
+{
+  unsigned long tempo = morse.tempo * 1000UL;
+  unsigned long long marks[MORSE_MOST], spaces[MORSE_MOST];
+  byte markCount = 0, spaceCount = 0;
+  int level = LOW;
+  unsigned long long began = HostWallMicros(), edge = began;
+  morse.SendLetter(letter);
+  while (morse.isBusy())
+  {
+    HostAdvance(MORSE_STEP_US);
+    morse.Update();
+    if (HostPinLevel(MORSE_PIN) == level) continue;
+    unsigned long long at = HostPinChanged(MORSE_PIN);
+    if (level == HIGH && markCount < MORSE_MOST) marks[markCount++] = at - edge;
+    else if (markCount && spaceCount < MORSE_MOST) spaces[spaceCount++] = at - edge;
+    level = HostPinLevel(MORSE_PIN);
+    edge = at;
+  }
+  unsigned long long took = HostWallMicros() - began;
+
+  bool ok = CHECK(level == LOW);
+  byte length = strlen(code);
+  ok &= CHECK(markCount == length);
+  unsigned long want = 3 * tempo;                       //charGap()
+  byte steps = 1 + 2 * length;
+  if (!isalnum(letter)) want += 6 * tempo, steps += 2;  //One either side
+  for (byte i = 0; i < length; i++)
+  {
+    unsigned long mark = (code[i] == '-') ? 5 * tempo : tempo;
+    want += mark + 3 * tempo;
+    if (i < markCount) ok &= CHECK(Near(marks[i], mark));
+    if (i + 1 < length && i < spaceCount) ok &= CHECK(Near(spaces[i], 3 * tempo));
+  }
+  ok &= CHECK(Near(took, want, steps * MORSE_SLACK_US));
+  if (!ok) printf("'%c' %s: %u marks, %.3fs against %.3fs\n", letter, code, markCount, took / 1e6, want / 1e6);
+  return (ok);
+}
+
+bool TestMorseTiming (void)
+{
+  MorseSender morse(MORSE_PIN);
+  bool ok = true;
+  unsigned int timed = 0;
+  for (unsigned int i = 0; i < sizeof(Codes) / sizeof(Codes[0]); i++, timed++)
+    ok &= TimeLetter(morse, Codes[i].Letter, Codes[i].Code);
+  for (const char *p = NoCode; *p; p++)
+  {
+    morse.SendLetter(*p);
+    ok &= CHECK(!morse.isBusy());
+    if (morse.isBusy()) printf("'%c' has no code but was sent\n", *p);
+    morse.Wait();
+  }
+  printf("%u characters timed at a tempo of %dms, %u without a code\n", timed, morse.tempo, (unsigned int)strlen(NoCode));
+  return (ok);
+}
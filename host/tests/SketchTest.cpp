@@ -0,0 +1,303 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of the whole sketch on the emulated chip, with the Morse indicator (INDICATOR_OPTICAL
+//  0) as that is the reporting path they are about. The battery and panel are held steady,
+//  the battery in the absorption range so the duty moves and is reported.
+//
+//  morse_latency   the longest loop() takes with a Morse message of each length going out
+//                  against with none, and how long queueing it takes. Sending used to wait
+//                  out every element with delay(), holding the control loop up for seconds.
+//
+//  no_allocation   the heap isn't touched once the sketch is running: an hour of loop() with
+//                  the control steps, duty reports in Morse (Format.h), status frames and
+//                  telemetry going, counted by wrapping glibc's malloc, which operator new and
+//                  the Arduino String class both come down to. Checks first that the count
+//                  does see an allocation.
+//
+//  link_loopback   the serial link end to end through a pseudo-terminal, as link_decode talks
+//                  to a board: the sketch's UART output goes into the pty and is framed back up
+//                  by a LinkReader on the other end, commands written there come through the
+//                  pty to the sketch's Serial input, where SerialLink::Poll() picks them up as
+//                  it does off the UART. Status frames arrive in order with the readings,
+//                  LINK_GET and LINK_SET are answered with the settings, bad commands with the
+//                  NAK reason, and a frame with a bad CRC is counted and not acted on.
+//                  Divider resistors past an int, or a divider reading past PROFILE_SCALE_MV,
+//                  are turned down before they get to the VoltageSensors. So is a saved profile
+//                  with a temperature coefficient or reference out of range, and a cold battery
+//                  doesn't take the compensated absorption past PROFILE_MAX_MV.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define INDICATOR_OPTICAL 0
+#include "PWM_Charge_Controller.ino"
+#include "HostTest.h"
+#include <string>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define SKETCH_BATTERY_V 13.6
+#define SKETCH_SOLAR_V   18.0
+#define LATENCY_SECONDS    30       //Of loop() a message, long enough for the longest to go
+#define LATENCY_SLACK_US  500       //Between the worst loop() with a message and without
+#define QUEUE_MOST_US     100       //For SendString() to return
+#define STEADY_SECONDS   3600       //Of loop() with the allocations counted
+#define LINK_SECONDS       30       //Of status frames
+#define LINK_REPLY_US  1000000      //For a command's answer
+#define LINK_NEAR_MV      100       //Of the battery held, in the status frames
+
+extern "C" void *__libc_malloc (size_t size);
+extern "C" void *__libc_calloc (size_t count, size_t size);
+extern "C" void *__libc_realloc (void *p, size_t size);
+
+static bool Counting = false;
+static unsigned long Allocations = 0;
+
+extern "C" void *malloc (size_t size)
+{
+  if (Counting) Allocations++;
+  return (__libc_malloc(size));
+}
+
+extern "C" void *calloc (size_t count, size_t size)
+{
+  if (Counting) Allocations++;
+  return (__libc_calloc(count, size));
+}
+
+extern "C" void *realloc (void *p, size_t size)
+{
+  if (Counting) Allocations++;
+  return (__libc_realloc(p, size));
+}
+
+static unsigned int SketchDivider (double volts, int high, int low)
+{
+  return (unsigned int)(volts * 1000.0 * low / (high + low) + 0.5);
+}
+
+static unsigned int SketchAnalog (uint8_t channel)
+{
+  if (channel == A0 - A0) return SketchDivider(SKETCH_BATTERY_V, BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE);
+  if (channel == A1 - A0) return SketchDivider(SKETCH_SOLAR_V, SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE);
+  if (channel == TEMP_SENSOR_PIN - A0) return 2500;     //25C with NTC_R25 equal to NTC_FIXED_R
+  return 0;
+}
+
+static void SketchSerial (uint8_t c)
+{
+  (void)c;
+}
+
+static void SketchBegin (HostSerialSink sink = SketchSerial)
+{
+  HostSetAnalogSource(SketchAnalog);
+  HostSetSerialSink(sink);
+  setup();
+}
+
+//The longest loop() over seconds of emulated time, in us
+static unsigned long WorstLoop (unsigned long seconds)
+{
+  unsigned long worst = 0;
+  unsigned long long end = HostWallMicros() + seconds * 1000000ULL;
+  while (HostWallMicros() < end)
+  {
+    unsigned long began = micros();
+    loop();
+    unsigned long took = micros() - began;
+    if (took > worst) worst = took;
+  }
+  return (worst);
+}
+
+bool TestMorseLatency (void)
+{
+  static const char *const Messages[] = {"", "5", "1234", "13.84V"};
+  bool ok = true;
+  SketchBegin();
+  WorstLoop(LATENCY_SECONDS);     //Past start up
+  unsigned long quiet = 0;
+  for (unsigned int i = 0; i < sizeof(Messages) / sizeof(Messages[0]); i++)
+  {
+    Morse.Wait();
+    unsigned long began = micros();
+    if (*Messages[i]) Morse.SendString(Messages[i]);
+    unsigned long queued = micros() - began;
+    unsigned long worst = WorstLoop(LATENCY_SECONDS);
+    if (!i) quiet = worst;
+    printf("message \"%s\": queued in %luus, worst loop() %luus\n", Messages[i], queued, worst);
+    ok &= CHECK(queued <= QUEUE_MOST_US);
+    ok &= CHECK(worst <= quiet + LATENCY_SLACK_US);
+  }
+  return (ok);
+}
+
+bool TestNoAllocation (void)
+{
+  bool ok = true;
+  Counting = true;
+  delete new std::string(40, 'x');      //Past the small string buffer, so it allocates
+  Counting = false;
+  ok &= CHECK(Allocations > 0);
+
+  SketchBegin();
+  WorstLoop(LATENCY_SECONDS);     //Past start up
+  unsigned long flashes = 0;
+  int led = HostPinLevel(13);
+  Allocations = 0;
+  Counting = true;
+  unsigned long long end = HostWallMicros() + STEADY_SECONDS * 1000000ULL;
+  while (HostWallMicros() < end)
+  {
+    loop();
+    if (HostPinLevel(13) != led) led = HostPinLevel(13), flashes++;
+  }
+  Counting = false;
+  printf("%lu allocations in %us of loop(), %lu LED changes\n", Allocations, STEADY_SECONDS, flashes);
+  ok &= CHECK(flashes > 0);
+  ok &= CHECK(Allocations == 0);
+  return (ok);
+}
+
+static int LinkBoard = -1;        //The pty's master, the board's UART
+static int LinkHost = -1;         //Its slave, where link_decode would be
+static LinkReader HostLink;
+static byte Reply[LINK_MAX_PAYLOAD];
+static byte ReplyLength = 0;
+static unsigned int StatusFrames = 0, StatusGaps = 0, StatusFar = 0;
+static byte StatusSeq;
+
+static void LinkSerial (uint8_t c)
+{
+  if (LinkBoard >= 0 && write(LinkBoard, &c, 1) != 1) LinkBoard = -1;
+}
+
+//Moves bytes both ways through the pty as the emulated time goes by
+static void LinkPump (unsigned long long wall)
+{
+  (void)wall;
+  byte buf[64];
+  ssize_t n;
+  while (LinkBoard >= 0 && (n = read(LinkBoard, buf, sizeof(buf))) > 0) HostSerialInput(buf, n);
+  while (LinkHost >= 0 && (n = read(LinkHost, buf, sizeof(buf))) > 0)
+    for (ssize_t i = 0; i < n; i++)
+    {
+      if (!HostLink.Receive(buf[i])) continue;
+      const byte *p = HostLink.Payload();
+      if (p[0] != LINK_STATUS)
+      {
+        ReplyLength = HostLink.Length();
+        memcpy(Reply, p, ReplyLength);
+        continue;
+      }
+      long mV = p[6] | (p[7] << 8);
+      if (StatusFrames++ && p[1] != (byte)(StatusSeq + 1)) StatusGaps++;
+      if (labs(mV - (long)(SKETCH_BATTERY_V * 1000)) > LINK_NEAR_MV || p[13]) StatusFar++;
+      StatusSeq = p[1];
+    }
+}
+
+static bool LinkOpen (void)
+{
+  LinkBoard = posix_openpt(O_RDWR | O_NOCTTY);
+  if (LinkBoard < 0 || grantpt(LinkBoard) || unlockpt(LinkBoard)) return (false);
+  LinkHost = open(ptsname(LinkBoard), O_RDWR | O_NOCTTY);
+  struct termios t;
+  if (LinkHost < 0 || tcgetattr(LinkHost, &t)) return (false);
+  cfmakeraw(&t);
+  tcsetattr(LinkHost, TCSANOW, &t);
+  fcntl(LinkBoard, F_SETFL, O_NONBLOCK);
+  fcntl(LinkHost, F_SETFL, O_NONBLOCK);
+  return (true);
+}
+
+//Writes a command into the host's end and runs the sketch until it is answered,
+//gives the answer's frame type or 0 if there wasn't one. badCRC changes the first
+//byte after the CRC is worked out, it is never zero so the COBS still holds.
+static byte LinkCommand (const byte *command, byte len, bool badCRC = false)
+{
+  byte frame[LINK_MAX_FRAME];
+  byte n = LinkEncode(command, len, frame);
+  if (badCRC) frame[1] ^= 0x80;
+  ReplyLength = 0;
+  if (write(LinkHost, frame, n) != n) return (0);
+  unsigned long long end = HostWallMicros() + LINK_REPLY_US;
+  while (!ReplyLength && HostWallMicros() < end) loop();
+  return (ReplyLength ? Reply[0] : 0);
+}
+
+//A setting from a LINK_SETTINGS answer
+static unsigned int ReplySetting (byte setting)
+{
+  return (Reply[2 * setting - 1] | (Reply[2 * setting] << 8));
+}
+
+bool TestLinkLoopback (void)
+{
+  static const byte Get[] = {LINK_GET};
+  static const byte NoSetting[] = {LINK_SET, 0, 0, 0};
+  static const byte Short[] = {LINK_SET, LINK_TARGET, 0};
+  static const byte Unknown[] = {0x7F};
+
+  bool ok = CHECK(LinkOpen());
+  if (!ok) return (false);
+  HostSetTimeHook(LinkPump);
+  SketchBegin(LinkSerial);
+  WorstLoop(LINK_SECONDS);
+  printf("%u status frames in %us, %u out of sequence, %u not the battery held\n", StatusFrames, LINK_SECONDS, StatusGaps, StatusFar);
+  ok &= CHECK(StatusFrames >= LINK_SECONDS * 1000UL / WAIT_TIME);
+  ok &= CHECK(StatusGaps == 0 && StatusFar == 0);
+
+  ok &= CHECK(LinkCommand(Get, sizeof(Get)) == LINK_SETTINGS);
+  ok &= CHECK(ReplySetting(LINK_TARGET) == Profile.AbsorbmV);
+
+  unsigned int was = Profile.AbsorbmV, target = was + 100;
+  const byte set[] = {LINK_SET, LINK_TARGET, (byte)(target & 0xFF), (byte)(target >> 8)};
+  ok &= CHECK(LinkCommand(set, sizeof(set)) == LINK_SETTINGS);
+  printf("target set to %umV, answered with %umV, in use %umV\n", target, ReplySetting(LINK_TARGET), Profile.AbsorbmV);
+  ok &= CHECK(ReplySetting(LINK_TARGET) == target && Profile.AbsorbmV == target);
+  ok &= CHECK(Profile.Chemistry == PROFILE_CUSTOM);
+
+  ok &= CHECK(LinkCommand(NoSetting, sizeof(NoSetting)) == LINK_NAK && Reply[1] == LINK_SET && Reply[2] == LINK_BAD_VALUE);
+  ok &= CHECK(LinkCommand(Short, sizeof(Short)) == LINK_NAK && Reply[2] == LINK_BAD_LENGTH);
+  ok &= CHECK(LinkCommand(Unknown, sizeof(Unknown)) == LINK_NAK && Reply[1] == 0x7F && Reply[2] == LINK_BAD_COMMAND);
+
+  static const byte Resistors[][4] = {
+    {LINK_BATT_HIGH, 0x00, 0x80},     //32768, past an int
+    {LINK_SOLAR_LOW, 0xFF, 0xFF},
+    {LINK_BATT_LOW, 55, 0},           //680 over 55 reads 66.8V at full scale
+    {LINK_SOLAR_LOW, 0, 0},
+  };
+  unsigned int highR = Profile.BattHighR;
+  for (unsigned int i = 0; i < sizeof(Resistors) / sizeof(Resistors[0]); i++)
+  {
+    const byte divider[] = {LINK_SET, Resistors[i][0], Resistors[i][1], Resistors[i][2]};
+    ok &= CHECK(LinkCommand(divider, sizeof(divider)) == LINK_NAK && Reply[2] == LINK_BAD_VALUE);
+  }
+  const byte lowest[] = {LINK_SET, LINK_BATT_LOW, 58, 0};     //63.6V, just inside
+  ok &= CHECK(LinkCommand(lowest, sizeof(lowest)) == LINK_SETTINGS && Profile.BattLowR == 58);
+  ok &= CHECK(Profile.BattHighR == highR);
+
+  ChargeProfile odd = Profile;      //Compensation figures can only come from EEPROM
+  odd.TempCoeffmV = INT16_MIN;
+  ok &= CHECK(!ProfileValid(odd));
+  odd.TempCoeffmV = TEMP_COEFF_MV;
+  odd.TempRefC = 300;
+  ok &= CHECK(!ProfileValid(odd));
+  odd.TempRefC = TEMP_REF_C;
+  ok &= CHECK(ProfileValid(odd));
+  unsigned int cold = CompensatedmV(14400, (long)TEMP_COEFF_MV * (TEMP_COMP_MIN_C - TEMP_REF_C));    //15750mV
+  printf("absorb 14400mV compensated for %dC: %umV\n", TEMP_COMP_MIN_C, cold);
+  ok &= CHECK(cold == PROFILE_MAX_MV);
+
+  const byte back[] = {LINK_SET, LINK_TARGET, (byte)(was & 0xFF), (byte)(was >> 8)};
+  unsigned int errors = Link.Errors();
+  ok &= CHECK(LinkCommand(back, sizeof(back), true) == 0);
+  printf("bad CRC: %u counted by the board, target %umV\n", Link.Errors() - errors, Profile.AbsorbmV);
+  ok &= CHECK(Link.Errors() == errors + 1 && Profile.AbsorbmV == target);
+
+  ok &= CHECK(HostLink.Errors() == 0 && Link.Dropped() == 0);
+  HostSetTimeHook(0);
+  return (ok);
+}
@@ -0,0 +1,170 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  ChargeStateMachine tests
+//
+//  state_machine   every row of the transition table in ChargeStateMachine.cpp, driven with
+//                  made up readings: a run with the float law and one with the hysteresis law,
+//                  each step giving the state it should end in and the exit and entry actions
+//                  it should run on the way, "bulk>absorb" for leaving bulk for absorption. A
+//                  Step() can pass through more than one state (sleeping>off off>absorb), the
+//                  actions are checked to come in pairs in that order. Absorption time is
+//                  carried over a night, started again after one that drew the battery down,
+//                  and reset at bulk. After each run the entries of each state are checked
+//                  against the actions seen, and the seconds in them add up to the run.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include "ChargeStateMachine.h"
+
+#define STATE_BULK_MV    12500
+#define STATE_ABSORB_MV  14400
+#define STATE_FLOAT_MV   13500
+#define STATE_GAP_MV       500
+#define STATE_MINUTES       60      //Of absorption before float
+#define STATE_LIGHT_MV   18000      //Panel in sun
+#define STATE_DARK_MV     5000
+#define STATE_PATH         128
+
+struct StateStep {
+  const char *What;
+  unsigned int BatterymV;
+  unsigned int SolarmV;
+  unsigned long Seconds;
+  bool Fault;
+  byte State;                     //After the Step()
+  const char *Path;               //Actions it runs, see top of file
+};
+
+//Float law, absorption for STATE_MINUTES then float
+static const StateStep FloatRun[] = {
+  {"start in the dark",        12000, STATE_DARK_MV,       0, false, CHARGE_SLEEPING, "off>sleeping"},
+  {"dawn in bulk",             12000, STATE_LIGHT_MV,      0, false, CHARGE_BULK,     "sleeping>off off>bulk"},
+  {"still bulk",               12500, STATE_LIGHT_MV,     10, false, CHARGE_BULK,     ""},
+  {"above bulk",               13000, STATE_LIGHT_MV,     20, false, CHARGE_ABSORB,   "bulk>absorb"},
+  {"at absorption",            14400, STATE_LIGHT_MV,   1000, false, CHARGE_ABSORB,   ""},      //Only hysteresis holds
+  {"dusk, 1980s absorbed",     14400, STATE_DARK_MV,    2000, false, CHARGE_SLEEPING, "absorb>sleeping"},
+  {"still dark",               13800, STATE_DARK_MV,    4000, false, CHARGE_SLEEPING, ""},
+  {"dawn, kept the 1980s",     13200, STATE_LIGHT_MV,   5000, false, CHARGE_ABSORB,   "sleeping>off off>absorb"},
+  {"a second short",           14400, STATE_LIGHT_MV,   6619, false, CHARGE_ABSORB,   ""},
+  {"absorption done",          14400, STATE_LIGHT_MV,   6620, false, CHARGE_FLOAT,    "absorb>float"},
+  {"float holds",              13500, STATE_LIGHT_MV,   8000, false, CHARGE_FLOAT,    ""},
+  {"dusk in float",            13400, STATE_DARK_MV,    9000, false, CHARGE_SLEEPING, "float>sleeping"},
+  {"dawn, drawn down",         12900, STATE_LIGHT_MV,  30000, false, CHARGE_ABSORB,   "sleeping>off off>absorb"},
+  {"starts again",             14400, STATE_LIGHT_MV,  33599, false, CHARGE_ABSORB,   ""},      //3599s this time round
+  {"fault",                    14400, STATE_LIGHT_MV,  33599, true,  CHARGE_FAULT,    "absorb>fault"},
+  {"fault held",               12000, STATE_DARK_MV,   33700, true,  CHARGE_FAULT,    ""},      //Ahead of dark and bulk
+  {"fault cleared at bulk",    12000, STATE_LIGHT_MV,  33800, false, CHARGE_BULK,     "fault>off off>bulk"},
+  {"above bulk",               13000, STATE_LIGHT_MV,  33810, false, CHARGE_ABSORB,   "bulk>absorb"},
+  {"bulk again",               12400, STATE_LIGHT_MV,  33820, false, CHARGE_BULK,     "absorb>bulk"},
+  {"above bulk, from nothing", 13000, STATE_LIGHT_MV,  33830, false, CHARGE_ABSORB,   "bulk>absorb"},
+  {"absorbed as dusk falls",   14400, STATE_DARK_MV,   37430, false, CHARGE_SLEEPING, "absorb>sleeping"},   //Dark first
+  {"dawn, still full",         13600, STATE_LIGHT_MV,  60000, false, CHARGE_FLOAT,    "sleeping>off off>float"},
+  {"load pulls it to bulk",    12300, STATE_LIGHT_MV,  61000, false, CHARGE_BULK,     "float>bulk"},
+  {"dusk in bulk",             12300, STATE_DARK_MV,   62000, false, CHARGE_SLEEPING, "bulk>sleeping"},
+  {"dark at dawn goes back",   12300, 12200,           80000, false, CHARGE_SLEEPING, ""},
+};
+
+//Hysteresis law, between absorption and hold, never float
+static const StateStep HoldRun[] = {
+  {"start above bulk",         13000, STATE_LIGHT_MV,      0, false, CHARGE_ABSORB,   "off>absorb"},
+  {"reached absorption",       14400, STATE_LIGHT_MV,     10, false, CHARGE_HOLD,     "absorb>hold"},
+  {"within the gap",           13900, STATE_LIGHT_MV,     20, false, CHARGE_HOLD,     ""},
+  {"dropped past the gap",     13899, STATE_LIGHT_MV,     30, false, CHARGE_ABSORB,   "hold>absorb"},
+  {"an hour on, no float",     14000, STATE_LIGHT_MV,   7200, false, CHARGE_ABSORB,   ""},
+  {"reached again",            14500, STATE_LIGHT_MV,   7210, false, CHARGE_HOLD,     "absorb>hold"},
+  {"dusk in hold",             14200, STATE_DARK_MV,    7300, false, CHARGE_SLEEPING, "hold>sleeping"},
+  {"dawn at absorption",       14400, STATE_LIGHT_MV,  20000, false, CHARGE_HOLD,     "sleeping>off off>absorb absorb>hold"},
+  {"load pulls it to bulk",    12000, STATE_LIGHT_MV,  21000, false, CHARGE_BULK,     "hold>bulk"},
+  {"fault in bulk",            12000, STATE_LIGHT_MV,  21100, true,  CHARGE_FAULT,    "bulk>fault"},
+  {"cleared above bulk",       13000, STATE_LIGHT_MV,  21200, false, CHARGE_ABSORB,   "fault>off off>absorb"},
+};
+
+struct StateLog {
+  char Path[STATE_PATH];
+  byte Entered;                   //Last entry, to check the exit after it
+  bool Paired;
+  unsigned int Entries[CHARGE_STATES];
+};
+
+static void Append (StateLog &log, const char *text)
+{
+  strncat(log.Path, text, STATE_PATH - strlen(log.Path) - 1);
+}
+
+static void OnExit (byte state, void *context)
+{
+  StateLog &log = *(StateLog *)context;
+  if (state != log.Entered) log.Paired = false;
+  if (*log.Path) Append(log, " ");
+  Append(log, ChargeStateMachine::Name(state));
+  log.Entered = 0xFF;             //Until the entry
+}
+
+static void OnEntry (byte state, void *context)
+{
+  StateLog &log = *(StateLog *)context;
+  if (log.Entered != 0xFF) log.Paired = false;
+  Append(log, ">");
+  Append(log, ChargeStateMachine::Name(state));
+  log.Entered = state;
+  log.Entries[state]++;
+}
+
+static bool Run (const char *law, bool hysteresis, const StateStep *steps, unsigned int count)
+{
+  bool ok = true;
+  StateLog log = {};
+  ChargeStateMachine machine(hysteresis);
+  machine.Setpoints(STATE_BULK_MV, STATE_ABSORB_MV, STATE_FLOAT_MV, STATE_GAP_MV, STATE_MINUTES);
+  machine.Actions(OnEntry, OnExit, &log);
+  machine.Begin(0);
+  log.Entered = CHARGE_OFF;       //Begin() runs no action
+  log.Paired = true;
+  log.Entries[CHARGE_OFF]++;
+  printf("%s law:\n", law);
+  for (unsigned int i = 0; i < count; i++)
+  {
+    const StateStep &s = steps[i];
+    byte before = machine.State();
+    *log.Path = 0;
+    machine.Fault(s.Fault);
+    byte state = machine.Step(s.BatterymV, s.SolarmV, s.Seconds);
+    bool right = (state == s.State && state == machine.State() && !strcmp(log.Path, s.Path));
+    if (*log.Path) right &= (machine.Previous() != state);
+    printf("  %-26s %5umV %5umV %6lus %-8s %-36s %s\n", s.What, s.BatterymV, s.SolarmV, s.Seconds, machine.Name(before),
+           log.Path, right ? "" : "WRONG");
+    ok &= CHECK(right);
+  }
+  ok &= CHECK(log.Paired);
+
+  unsigned long end = steps[count - 1].Seconds, total = 0;
+  for (byte s = 0; s < CHARGE_STATES; s++)
+  {
+    printf("  %-8s entered %u for %lus\n", machine.Name(s), machine.Entries(s), machine.Seconds(s, end));
+    ok &= CHECK(machine.Entries(s) == log.Entries[s]);
+    total += machine.Seconds(s, end);
+  }
+  ok &= CHECK(total == end);
+  return (ok);
+}
+
+bool TestStateMachine (void)
+{
+  bool ok = Run("float", false, FloatRun, sizeof(FloatRun) / sizeof(FloatRun[0]));
+  ok &= Run("hysteresis", true, HoldRun, sizeof(HoldRun) / sizeof(HoldRun[0]));
+
+  //After a reset, straight back in with the absorption time so far and the entry action run
+  StateLog log = {};
+  ChargeStateMachine machine(false);
+  machine.Setpoints(STATE_BULK_MV, STATE_ABSORB_MV, STATE_FLOAT_MV, STATE_GAP_MV, STATE_MINUTES);
+  machine.Actions(OnEntry, OnExit, &log);
+  log.Entered = 0xFF;
+  machine.Resume(CHARGE_ABSORB, 3000, 100);
+  ok &= CHECK(!strcmp(log.Path, ">absorb") && machine.AbsorbSeconds(100) == 3000);
+  *log.Path = 0;
+  ok &= CHECK(machine.Step(14400, STATE_LIGHT_MV, 699) == CHARGE_ABSORB);
+  ok &= CHECK(machine.Step(14400, STATE_LIGHT_MV, 700) == CHARGE_FLOAT && !strcmp(log.Path, "absorb>float"));
+  printf("resumed: absorb for 3000s, float at %s\n", log.Path);
+  return (ok);
+}
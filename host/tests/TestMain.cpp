@@ -0,0 +1,45 @@
+#include "HostTest.h"
+
+//  Host test runner, see HostTest.h
+
+struct HostTest {
+  const char *Name;
+  bool (*Run)(void);
+};
+
+static const HostTest Tests[] = {
+  {"morse_latency",      TestMorseLatency},
+  {"fixed_point",        TestFixedPoint},
+  {"morse_timing",       TestMorseTiming},
+  {"no_allocation",      TestNoAllocation},
+  {"pump_registers",     TestPumpRegisters},
+  {"link_loopback",      TestLinkLoopback},
+  {"state_machine",      TestStateMachine},
+  {"channel_latency",    TestChannelLatency},
+};
+
+#define TEST_COUNT (sizeof(Tests) / sizeof(Tests[0]))
+
+bool HostCheck (bool ok, const char *what, const char *file, int line)
+{
+  if (!ok) printf("FAILED %s at %s:%d\n", what, file, line);
+  return (ok);
+}
+
+int main (int argc, char **argv)
+{
+  if (argc == 2 && !strcmp(argv[1], "--list"))
+  {
+    for (unsigned int i = 0; i < TEST_COUNT; i++) printf("%s\n", Tests[i].Name);
+    return 0;
+  }
+  for (unsigned int i = 0; argc == 2 && i < TEST_COUNT; i++)
+  {
+    if (strcmp(argv[1], Tests[i].Name)) continue;
+    bool passed = Tests[i].Run();
+    printf("%s %s\n", Tests[i].Name, passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+  }
+  fprintf(stderr, "usage: %s test | --list\n", argv[0]);
+  return 1;
+}
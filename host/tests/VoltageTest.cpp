@@ -0,0 +1,63 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  VoltageSensor tests
+//
+//  fixed_point     the fixed point conversion against the float one it replaced, AD / (1023 /
+//                  (5.0 / (low / (low + high)))), for every A-D code on the battery and solar
+//                  dividers and the pin itself (LowReading). It rounds to the mV, so it can be
+//                  out by half of one, and a little over for the Q16 scale's own rounding.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include "PWM_Charge_Controller.h"
+#include "PWMLibs.h"
+#include <math.h>
+
+#define FIXED_POINT_WORST_MV 0.52
+
+static unsigned int TestCode;
+
+static unsigned int CodeAnalog (uint8_t channel)
+{
+  (void)channel;
+  return ((TestCode * 5000UL + 511) / 1023);      //The mV the emulated A-D reads as TestCode
+}
+
+//Worst difference in mV over every code, false if a code didn't read back as itself
+static bool Compare (int high, int low, double &worstFull, double &worstLow)
+{
+  VoltageSensor sensor(A0, high, low);
+  float acrossLowR = (float)low / ((float)low + (float)high);
+  float lowRangeConvRatio = 1023 / 5.0;
+  float fullRangeConvRatio = 1023 / (5.0 / acrossLowR);
+  bool ok = true;
+  worstFull = 0;
+  worstLow = 0;
+  for (TestCode = 0; TestCode < 1024; TestCode++)
+  {
+    unsigned int full = sensor.milliVolts();
+    ok &= CHECK(sensor.ADValue() == (int)TestCode);
+    double fullError = fabs(full - 1000.0 * (TestCode / fullRangeConvRatio));
+    double lowError = fabs(sensor.LowReading() * 1000.0 - 1000.0 * (TestCode / lowRangeConvRatio));
+    if (fullError > worstFull) worstFull = fullError;
+    if (lowError > worstLow) worstLow = lowError;
+  }
+  return (ok);
+}
+
+bool TestFixedPoint (void)
+{
+  static const int Dividers[][2] = {{BATTPOT_HIHGSIDE, BATTPOT_LOWSIDE}, {SOLARPOT_HIGHSIDE, SOLARPOT_LOWSIDE}};
+  bool ok = true;
+  HostSetAnalogSource(CodeAnalog);
+  for (unsigned int i = 0; i < sizeof(Dividers) / sizeof(Dividers[0]); i++)
+  {
+    double worstFull, worstLow;
+    ok &= Compare(Dividers[i][0], Dividers[i][1], worstFull, worstLow);
+    printf("divider %d/%d: worst %.3fmV full scale, %.3fmV at the pin\n", Dividers[i][0], Dividers[i][1], worstFull, worstLow);
+    ok &= CHECK(worstFull <= FIXED_POINT_WORST_MV);
+    ok &= CHECK(worstLow <= FIXED_POINT_WORST_MV);
+  }
+  return (ok);
+}